@@ -12,7 +12,8 @@ import sys,os,copy,time
 from . import util
 import numpy as np
 from astropy.io import fits
-from stsci.tools import fileutil, logutil, mputil, teal
+from astropy import wcs as pywcs
+from stsci.tools import fileutil, logutil, teal
 from . import outputimage, wcs_functions, processInput, util
 import stwcs
 from stwcs import distortion
@@ -28,12 +29,13 @@ except ImportError:
     raise ImportError
 
 if util.can_parallel:
-    import multiprocessing
+    from multiprocessing.pool import ThreadPool
 
 __all__ = ['drizzle', 'run', 'drizSeparate', 'drizFinal', 'mergeDQarray',
            'updateInputDQArray', 'buildDrizParamDict', 'interpret_maskval',
-           'run_driz', 'run_driz_img', 'run_driz_chip', 'do_driz',
-           'get_data', 'create_output', 'help', 'getHelpAsString']
+           'run_driz', 'run_driz_img', 'run_driz_chip', 'do_driz', 'redo_driz',
+           'get_data', 'create_output', 'interleaved_output', 'unpack_output',
+           'read_checkpoint', 'write_checkpoint', 'check_checkpoint_inputs', 'help', 'getHelpAsString']
 
 
 __taskname__ = "drizzlepac.adrizzle"
@@ -42,6 +44,10 @@ _final_step_num_ = 7
 
 log = logutil.create_logger(__name__, level=logutil.logging.NOTSET)
 
+# Record type of an interleaved drizzle output, see interleaved_output()
+INTERLEAVED_OUTPUT_DTYPE = np.dtype([('data', '<f4'), ('wht', '<f4'),
+                                     ('con', '<i4')])
+
 time_pre_all = []
 time_driz_all = []
 time_post_all = []
@@ -382,6 +388,7 @@ def drizFinal(imageObjectList, output_wcs, configObj,build=None,wcsmap=None,proc
             build = paramDict['build']
         # Record whether or not intermediate files should be deleted when finished
         paramDict['clean'] = configObj['STATE OF INPUT FILES']['clean']
+        paramDict['num_cores'] = configObj.get('num_cores')
 
         log.info('USER INPUT PARAMETERS for Final Drizzle Step:')
         util.printParams(paramDict, log=log)
@@ -576,6 +583,19 @@ def run_driz(imageObjectList,output_wcs,paramDict,single,build,wcsmap=None):
         if single: # not yet an option for final drizzle, msg would confuse
             log.info('Executing serially')
 
+    # When the images are not farmed out to a pool of workers, split
+    # the output of each chip over threads inside 'tdriz' instead.  Only
+    # the kernels that can be gathered give the same result however
+    # many threads there are, so the others stay serial and products do
+    # not depend on the number of cores of the host.
+    paramDict['gather'] = paramDict['kernel'] in ('square', 'point', 'turbo')
+    if will_parallel or not paramDict['gather']:
+        paramDict['num_threads'] = 1
+    else:
+        paramDict['num_threads'] = util.get_pool_size(paramDict.get('num_cores'), None)
+    if paramDict['num_threads'] > 1:
+        log.info('Drizzling each chip with %d threads' % paramDict['num_threads'])
+
     # Set parameters for each input and run drizzle on it here.
     #
     # Perform drizzling...
@@ -585,6 +605,31 @@ def run_driz(imageObjectList,output_wcs,paramDict,single,build,wcsmap=None):
         numctx += img._nmembers
     _numctx = {'all':numctx}
 
+    # An incremental final drizzle carries on from the running sums left
+    # by earlier runs, numbering the new inputs after the old ones
+    checkpoint = None
+    if not single and paramDict.get('checkpoint'):
+        paramDict['accumulate'] = True
+        checkpoint = read_checkpoint(paramDict['checkpoint'], output_wcs)
+        if checkpoint is None:
+            log.info('Starting checkpoint %s' % paramDict['checkpoint'])
+            paramDict['checkpoint_prior'] = {'nimages':0, 'inputs':[],
+                                             'texptime':0.0, 'expstart':None,
+                                             'expend':None}
+        else:
+            log.info('Adding to the %d inputs of checkpoint %s' %
+                     (checkpoint['nimages'], paramDict['checkpoint']))
+            paramDict['checkpoint_prior'] = checkpoint
+            numctx += checkpoint['nimages']
+        # The inputs of this run, in the order they are numbered
+        paramDict['checkpoint_inputs'] = [
+            checkpoint_input_name(chip)
+            for img in imageObjectList
+            for chip in img.returnAllChips(extname=img.scienceExt)]
+        if checkpoint is not None:
+            check_checkpoint_inputs(checkpoint, paramDict['checkpoint_inputs'],
+                                    paramDict['checkpoint'])
+
     #            if single:
     # Determine how many chips make up each single image
     for img in imageObjectList:
@@ -594,7 +639,7 @@ def run_driz(imageObjectList,output_wcs,paramDict,single,build,wcsmap=None):
             else: _numctx[plsingle] = 1
 
     # Compute how many planes will be needed for the context image.
-    _nplanes = int((_numctx['all']-1) / 32) + 1
+    _nplanes = int((numctx-1) / 32) + 1
     # For single drizzling or when context is turned off,
     # minimize to 1 plane only...
     if single or imageObjectList[0][1].outputNames['outContext'] in [None,'',' ']:
@@ -619,6 +664,13 @@ def run_driz(imageObjectList,output_wcs,paramDict,single,build,wcsmap=None):
         _outctx=np.zeros((_nplanes,output_wcs._naxis2,output_wcs._naxis1),dtype=np.int32)
         _hdrlist = []
 
+    if checkpoint is not None:
+        _outsci[...] = checkpoint['sci']
+        _outwht[...] = checkpoint['wht']
+        ncopy = min(_nplanes, checkpoint['ctx'].shape[0])
+        _outctx[:ncopy] = checkpoint['ctx'][:ncopy]
+        del checkpoint
+
     # Keep track of how many chips have been processed
     # For single case, this will determine when to close
     # one product and open the next.
@@ -632,7 +684,13 @@ def run_driz(imageObjectList,output_wcs,paramDict,single,build,wcsmap=None):
     #
     # Work on each image
     #
-    subprocs = []
+    if will_parallel:
+        # 'tdriz' releases the GIL while it drizzles, so threads are enough
+        # to keep the cores busy; unlike separate processes they need no
+        # pickling of the inputs nor a multiprocessing.Manager to hand the
+        # in-memory outputs back.
+        pool = ThreadPool(pool_size)
+        subprocs = []
     for img in imageObjectList:
 
         chiplist = img.returnAllChips(extname=img.scienceExt)
@@ -654,16 +712,12 @@ def run_driz(imageObjectList,output_wcs,paramDict,single,build,wcsmap=None):
 
         # Work each image, possibly in parallel
         if will_parallel:
-            # use multiprocessing.Manager only if in parallel and in memory
-            if img.inmemory:
-                manager = multiprocessing.Manager()
-                dproxy = manager.dict(img.virtualOutputs) # copy & wrap it in proxy
-                img.virtualOutputs = dproxy
-
-            # parallelize run_driz_img (currently for separate drizzle only)
-            p = multiprocessing.Process(target=run_driz_img,
-                name='adrizzle.run_driz_img()', # for err msgs
-                args=(img,chiplist,output_wcs,outwcs,template,paramDict,
+            # parallelize run_driz_img (currently for separate drizzle only).
+            # Each task gets its own copy of paramDict and template, as the
+            # processes used to: run_driz_chip writes to paramDict, and
+            # template is still extended here for the next image.
+            p = pool.apply_async(run_driz_img,
+                args=(img,chiplist,output_wcs,outwcs,list(template),paramDict.copy(),
                       single,num_in_prod,build,_versions,_numctx,_nplanes,
                       _chipIdx,None,None,None,None,wcsmap))
             subprocs.append(p)
@@ -680,7 +734,10 @@ def run_driz(imageObjectList,output_wcs,paramDict,single,build,wcsmap=None):
 
     # do the join if we spawned tasks
     if will_parallel:
-        mputil.launch_and_wait(subprocs, pool_size) # blocks till all done
+        pool.close()
+        pool.join() # blocks till all done
+        for p in subprocs:
+            p.get() # re-raise any exception from the workers
 
     del _outsci,_outwht,_outctx,_hdrlist
     # have looped over each img/chip
@@ -827,6 +884,8 @@ def run_driz_chip(img,chip,output_wcs,outwcs,template,paramDict,single,
             _bunit = None
 
     _uniqid = _numchips + 1
+    if not single and 'checkpoint_prior' in paramDict:
+        _uniqid += paramDict['checkpoint_prior']['nimages']
     if _nplanes == 1:
         # We need to reset what gets passed to TDRIZ
         # when only 1 context image plane gets generated
@@ -916,7 +975,10 @@ def run_driz_chip(img,chip,output_wcs,outwcs,template,paramDict,single,
                 wcslin_pscale=chip.wcslin_pscale, uniqid=_uniqid,
                 pixfrac=paramDict['pixfrac'], kernel=paramDict['kernel'],
                 fillval=paramDict['fillval'], stepsize=paramDict['stepsize'],
-                wcsmap=wcsmap)
+                wcsmap=wcsmap, num_threads=paramDict.get('num_threads', 1),
+                gather=paramDict.get('gather', False),
+                accumulate=paramDict.get('accumulate', False),
+                kernel_tolerance=paramDict.get('kernel_tolerance', 0.0))
     time_driz = time.time() - epoch; epoch = time.time()
 
     # Set up information for generating output FITS image
@@ -940,6 +1002,30 @@ def run_driz_chip(img,chip,output_wcs,outwcs,template,paramDict,single,
     time_post = time.time() - epoch; epoch = time.time()
 
     if doWrite:
+        _texptime = img.outputValues['texptime']
+
+        # Keep the weighted sums for the next run before they are divided
+        # out, and make the product header cover the earlier inputs too
+        if not single and 'checkpoint_prior' in paramDict:
+            prior = paramDict['checkpoint_prior']
+            _texptime += prior['texptime']
+            if prior['expstart'] is not None:
+                _hdrlist[0]['texpstart'] = min(_hdrlist[0]['texpstart'],
+                                               prior['expstart'])
+                _hdrlist[-1]['texpend'] = max(_hdrlist[-1]['texpend'],
+                                              prior['expend'])
+            _hdrlist[0]['texptime'] = _texptime
+            write_checkpoint(paramDict['checkpoint'], output_wcs,
+                             _outsci, _outwht, _outctx,
+                             prior['inputs'] +
+                             paramDict['checkpoint_inputs'], _texptime,
+                             _hdrlist[0]['texpstart'],
+                             _hdrlist[-1]['texpend'])
+
+        # Weighted sums are only divided out once everything is in
+        if paramDict.get('accumulate', False):
+            cdriz.tnormalize(_outsci, _outwht)
+
         ###########################
         #
         #   IMPLEMENTATION REQUIREMENT:
@@ -968,7 +1054,7 @@ def run_driz_chip(img,chip,output_wcs,outwcs,template,paramDict,single,
             if single:
                 _expscale = chip._exptime
             else:
-                _expscale = img.outputValues['texptime']
+                _expscale = _texptime
             np.multiply(_outsci, _expscale, _outsci)
         #
         # Write output arrays to FITS file(s)
@@ -1017,13 +1103,80 @@ def do_driz(insci, input_wcs, inwht,
             output_wcs, outsci, outwht, outcon,
             expin, in_units, wt_scl,
             wcslin_pscale=1.0,uniqid=1, pixfrac=1.0, kernel='square',
-            fillval="INDEF", stepsize=10,wcsmap=None):
+            fillval="INDEF", stepsize=10,wcsmap=None,num_threads=1,
+            accumulate=False, compensation=None, kernel_tolerance=0.0,
+            remove=False, gather=False, stepsize_tolerance=0.0,
+            stepsize_cubic=False):
     """
     Core routine for performing 'drizzle' operation on a single input image
     All input values will be Python objects such as ndarrays, instead
     of filenames.
     File handling (input and output) will be performed by calling routine.
 
+    ``num_threads`` > 1 splits the input lines over that many threads; it
+    takes effect with the WCSLIB-based mappings (``cdriz.DefaultWCSMapping``),
+    not with Python mapping functions.  Each thread drizzles its band into
+    a tile of its own and the tiles are summed in band order, so the result
+    does not depend on thread scheduling, but it does depend on the number
+    of threads, to rounding.  Use ``gather`` for results that do not.
+    Where the tiles together would be more than twice the size of the
+    output, as for a rotated input, the 'square', 'point' and 'turbo'
+    kernels are gathered and the others use fewer bands.
+
+    ``insci`` is only read: for 'counts' input the division by ``expin``
+    is done as each pixel is drizzled.
+
+    ``inwht`` may be None for unit weights and ``outcon`` None when no
+    context image is wanted, which saves work for every output pixel hit.
+
+    ``outsci`` may also be an array made by `interleaved_output`, which
+    holds the output weight and context as well; ``outwht`` and ``outcon``
+    are then ignored.
+
+    With ``accumulate`` set, ``outsci`` collects the sum of weight times
+    data rather than the weighted mean, so that no division is done per
+    input pixel.  Once the last input is in, ``cdriz.tnormalize(outsci,
+    outwht)`` turns it into the weighted mean image.
+
+    For deep stacks, ``compensation`` may be a zeroed float32 array of
+    shape ``(2,) + outsci.shape``.  It then keeps the rounding errors of the
+    accumulated data and weight sums (implying ``accumulate``), for
+    close to double-precision totals, at about 1.5 times the drizzling
+    time.  Pass it to ``cdriz.tnormalize`` as well.
+
+    A ``kernel_tolerance`` above 0 makes the 'gaussian' kernel use
+    tabulated x and y factors, each within that much of the exact
+    (peak 1) value, instead of an ``exp()`` per output pixel.  The
+    output weights then differ from the exact kernel's by about that
+    fraction of the peak weight; 0 keeps the exact kernel.  The tables
+    are single precision, so tolerances below the float32 epsilon
+    (1.2e-7) are refused.
+
+    With ``remove`` set, an input drizzled before into the accumulated
+    sums with the same parameters (``uniqid`` included) and WCS is taken
+    out of them again, along with its bit in ``outcon``.  See `redo_driz`.
+    The context tells which output pixels are left empty, so ``remove``
+    is refused when ``outcon`` is None.  The Lanczos kernels may leave
+    no mark in it, so with them it also needs ``compensation``, and a
+    pixel is empty once its weight is within rounding of nothing.
+
+    With ``gather`` set, the 'square', 'point' and 'turbo' kernels split
+    the output rather than the input lines over the ``num_threads``
+    threads, each filling its own strips of output rows.  This needs no
+    private copies of the output and gives the same result as a single
+    thread.
+
+    A ``stepsize_tolerance`` above 0 (in output pixels) refines the
+    ``stepsize`` grid of the WCSLIB-based mapping where interpolating
+    in it would be out by more than that, down to half-pixel steps, so
+    that a coarse ``stepsize`` can be used where the distortion is mild.
+    The largest error left is logged.
+
+    Otherwise ``stepsize_cubic`` interpolates in the ``stepsize`` grid
+    with cubic convolution instead of bilinearly.  That is about as
+    accurate as a bilinear grid 4 times finer, so ``stepsize`` can be
+    made 4 times larger for 16 times fewer WCS evaluations.
+
     """
     # Insure that the fillval parameter gets properly interpreted for use with tdriz
     if util.is_blank(fillval):
@@ -1041,7 +1194,13 @@ def do_driz(insci, input_wcs, inwht,
     planeid = int((uniqid-1) / 32)
 
     # Check if the context image has this many planes
-    if outcon.ndim == 3:
+    if outsci.dtype == INTERLEAVED_OUTPUT_DTYPE:
+        # The weight and context are drizzled into outsci itself
+        nplanes = 1
+    elif outcon is None:
+        # No context image is kept
+        nplanes = planeid + 1
+    elif outcon.ndim == 3:
         nplanes = outcon.shape[0]
     elif outcon.ndim == 2:
         nplanes = 1
@@ -1051,18 +1210,23 @@ def do_driz(insci, input_wcs, inwht,
     if nplanes <= planeid:
         raise IndexError("Not enough planes in drizzle context image")
 
-    # Alias context image to the requested plane if 3d
-    if outcon.ndim == 2:
-        outctx = outcon
+    # A 3d context image is passed whole: the C code sets the bit
+    # for this input in the right plane
+    if outsci.dtype == INTERLEAVED_OUTPUT_DTYPE:
+        outwht = outctx = None
     else:
-        outctx = outcon[planeid]
+        outctx = outcon
 
     pix_ratio = output_wcs.pscale/wcslin_pscale
 
     if wcsmap is None and cdriz is not None:
         log.info('Using WCSLIB-based coordinate transformation...')
         log.info('stepsize = %s' % stepsize)
-        mapping = cdriz.DefaultWCSMapping(input_wcs,output_wcs,int(input_wcs._naxis1),int(input_wcs._naxis2),stepsize)
+        mapping = cdriz.DefaultWCSMapping(input_wcs,output_wcs,int(input_wcs._naxis1),int(input_wcs._naxis2),stepsize,
+                                          tolerance=stepsize_tolerance,
+                                          cubic=stepsize_cubic)
+        if stepsize_tolerance > 0 and stepsize > 0:
+            log.info('stepsize grid max. error = %g pixels' % mapping.max_error)
     else:
         #
         ##Using the Python class for the WCS-based transformation
@@ -1092,7 +1256,9 @@ def do_driz(insci, input_wcs, inwht,
         outctx, uniqid, ystart, 1, 1, _dny,
         pix_ratio, 1.0, 1.0, 'center', pixfrac,
         kernel, in_units, expscale, wt_scl,
-        fillval, nmiss, nskip, 1, mapping)
+        fillval, nmiss, nskip, 1, mapping, num_threads, 0,
+        int(accumulate or compensation is not None), compensation,
+        kernel_tolerance, int(remove), int(gather))
 
     if nmiss > 0:
         log.warning('! %s points were outside the output image.' % nmiss)
@@ -1102,6 +1268,157 @@ def do_driz(insci, input_wcs, inwht,
     return _vers
 
 
+def redo_driz(insci, old_wcs, new_wcs, inwht,
+              output_wcs, outsci, outwht, outcon,
+              expin, in_units, wt_scl, **kwargs):
+    """
+    Re-drizzle one input whose WCS has changed, for instance after
+    realignment, into accumulated sums (see `do_driz`) built from many
+    inputs, without drizzling the others again.
+
+    Its old contribution is removed using ``old_wcs``, which must be the
+    WCS it was drizzled with, and it is then drizzled again with
+    ``new_wcs``.  ``insci``, ``inwht`` and the other arguments, passed on
+    to `do_driz` (``uniqid`` included), must be those it was drizzled
+    with before.  The sums then differ from drizzling the whole stack
+    afresh only by rounding, which ``compensation`` keeps to about
+    double precision.
+
+    As for ``remove`` in `do_driz`, ``outcon`` must not be None, and the
+    'lanczos2' and 'lanczos3' kernels need ``compensation``.
+    """
+    kwargs['accumulate'] = True
+    do_driz(insci, old_wcs, inwht, output_wcs, outsci, outwht, outcon,
+            expin, in_units, wt_scl, remove=True, **kwargs)
+    return do_driz(insci, new_wcs, inwht, output_wcs, outsci, outwht, outcon,
+                   expin, in_units, wt_scl, **kwargs)
+
+
+def interleaved_output(shape):
+    """
+    Create a zeroed drizzle output which keeps the science, weight and
+    context values of each output pixel next to each other.
+
+    Drizzling into it (as ``outsci`` of `do_driz`) touches one cache
+    line per output pixel instead of three.  The three images can be
+    read back with `unpack_output`.
+    """
+    return np.zeros(shape, dtype=INTERLEAVED_OUTPUT_DTYPE)
+
+
+def unpack_output(output):
+    """
+    Return the science, weight and context images of an output made by
+    `interleaved_output`.  These are views into ``output``, not copies.
+    """
+    return output['data'], output['wht'], output['con']
+
+
+def checkpoint_input_name(chip):
+    """
+    The name an input chip is known by in a checkpoint: its file and
+    extension, without the directory.
+    """
+    return os.path.basename(chip.outputNames['data'])
+
+
+def check_checkpoint_inputs(checkpoint, inputs, filename=''):
+    """
+    Refuse to add ``inputs`` (names as in `write_checkpoint`) to a
+    checkpoint read by `read_checkpoint` that holds any of them already:
+    they would be counted twice.
+    """
+    repeated = [name for name in inputs if name in checkpoint['inputs']]
+    if repeated:
+        raise ValueError("Checkpoint %s already holds %s; remove them from "
+                         "the inputs, or start from a new checkpoint" %
+                         (filename, ', '.join(repeated)))
+
+
+def write_checkpoint(filename, output_wcs, outsci, outwht, outctx, inputs,
+                     texptime, expstart, expend):
+    """
+    Save the running state of an accumulating drizzle (see `do_driz`) so
+    that more inputs can be added to it later by `read_checkpoint`.
+
+    ``outsci`` and ``outwht`` must still hold the weighted sums, before
+    ``cdriz.tnormalize``.  ``inputs`` names the inputs drizzled so far,
+    which are numbered 1 to ``len(inputs)`` in the context image in that
+    order; they are kept in an INPUTS table, so that none of them is
+    added twice.  The exposure time and the start and end of the
+    exposures in it are kept for the header of the combined product.
+    """
+    nimages = len(inputs)
+    phdu = fits.PrimaryHDU()
+    phdu.header['NDRIZIM'] = (nimages, 'Number of inputs drizzled so far')
+    phdu.header['OUTNX'] = (output_wcs._naxis1, 'Output image X size')
+    phdu.header['OUTNY'] = (output_wcs._naxis2, 'Output image Y size')
+    phdu.header['TEXPTIME'] = (texptime, 'Total exposure time of the inputs')
+    phdu.header['EXPSTART'] = (expstart, 'Start of the first input')
+    phdu.header['EXPEND'] = (expend, 'End of the last input')
+
+    hdulist = fits.HDUList([phdu,
+                            fits.ImageHDU(data=outsci, name='SUMSCI',
+                                          header=output_wcs.to_header()),
+                            fits.ImageHDU(data=outwht, name='SUMWHT'),
+                            fits.ImageHDU(data=outctx, name='CTX'),
+                            fits.BinTableHDU.from_columns(
+                                [fits.Column(name='UNIQID', format='J',
+                                             array=np.arange(1, nimages + 1)),
+                                 fits.Column(name='NAME', format='%dA' %
+                                             max([len(n) for n in inputs] + [1]),
+                                             array=np.array(inputs, dtype=str))],
+                                name='INPUTS')])
+    # Write the new state in full before it replaces the old one
+    hdulist.writeto(filename + '.tmp', overwrite=True)
+    os.rename(filename + '.tmp', filename)
+
+
+def read_checkpoint(filename, output_wcs):
+    """
+    Read back the state saved by `write_checkpoint`, as a dictionary of
+    the ``sci`` and ``wht`` sums, the ``ctx`` context image, the list of
+    ``inputs`` and the ``nimages``, ``texptime``, ``expstart`` and
+    ``expend`` values.
+
+    Returns None if there is no such file yet.  The checkpoint must be
+    for the same output frame as ``output_wcs``.
+    """
+    if not os.path.exists(filename):
+        return None
+
+    with fits.open(filename, memmap=False) as hdulist:
+        phdr = hdulist[0].header
+        shape = (output_wcs._naxis2, output_wcs._naxis1)
+        if (phdr['OUTNY'], phdr['OUTNX']) != shape:
+            raise ValueError("Checkpoint %s is for a %dx%d output, not %dx%d" %
+                             (filename, phdr['OUTNX'], phdr['OUTNY'],
+                              shape[1], shape[0]))
+
+        # The corners of the output frame must land on the same sky
+        corners = np.array([[1.0, 1.0], [shape[1], 1.0],
+                            [1.0, shape[0]], [shape[1], shape[0]]])
+        sky = pywcs.WCS(hdulist['SUMSCI'].header).wcs_pix2world(corners, 1)
+        if not np.allclose(output_wcs.wcs_world2pix(sky, 1), corners,
+                           rtol=0.0, atol=1e-3):
+            raise ValueError("Checkpoint %s is for a different output WCS" %
+                             filename)
+
+        inputs = [str(name) for name in hdulist['INPUTS'].data['NAME']]
+        if len(inputs) != phdr['NDRIZIM']:
+            raise ValueError("Checkpoint %s lists %d inputs, not %d" %
+                             (filename, len(inputs), phdr['NDRIZIM']))
+
+        return {'sci':hdulist['SUMSCI'].data.astype(np.float32),
+                'wht':hdulist['SUMWHT'].data.astype(np.float32),
+                'ctx':hdulist['CTX'].data.astype(np.int32),
+                'nimages':phdr['NDRIZIM'],
+                'inputs':inputs,
+                'texptime':phdr['TEXPTIME'],
+                'expstart':phdr['EXPSTART'],
+                'expend':phdr['EXPEND']}
+
+
 def get_data(filename):
     fileroot,extn = fileutil.parseFilename(filename)
     extname = fileutil.parseExtn(extn)
@@ -0,0 +1,90 @@
+"""
+Small synthetic inputs and WCS shared by the cdriz tests.
+
+The inputs are random images on a distorted (SIP) WCS, each shifted a
+little from the last, drizzled onto a larger undistorted output so that
+the output has empty pixels around them.
+"""
+from __future__ import absolute_import, division, print_function
+
+import numpy as np
+from astropy import wcs
+
+from drizzlepac import cdriz
+
+NX, NY = 60, 50
+ONX, ONY = 90, 80
+
+IN_PSCALE = 0.05
+OUT_PSCALE = 0.04
+
+
+def make_wcs(nx, ny, pscale, rot=0.0, sip=False, shift=(0.0, 0.0)):
+    """A TAN (or TAN-SIP) WCS of ``pscale`` arcsec pixels, rotated by
+    ``rot`` degrees, with its reference pixel ``shift`` from the centre."""
+    w = wcs.WCS(naxis=2)
+    w.wcs.ctype = (['RA---TAN-SIP', 'DEC--TAN-SIP'] if sip
+                   else ['RA---TAN', 'DEC--TAN'])
+    w.wcs.crval = [150.0, 2.0]
+    w.wcs.crpix = [nx / 2.0 + shift[0], ny / 2.0 + shift[1]]
+    c, s = np.cos(np.radians(rot)), np.sin(np.radians(rot))
+    w.wcs.cd = pscale / 3600.0 * np.array([[-c, s], [s, c]])
+    if sip:
+        a = np.zeros((4, 4))
+        b = np.zeros((4, 4))
+        a[2, 0] = 2e-5
+        a[1, 1] = -1e-5
+        a[0, 3] = 2e-7
+        b[0, 2] = 1.5e-5
+        b[3, 0] = -3e-7
+        w.sip = wcs.Sip(a, b, None, None, w.wcs.crpix)
+    w.wcs.set()
+    return w
+
+
+def output_wcs():
+    return make_wcs(ONX, ONY, OUT_PSCALE)
+
+
+def with_size(w, nx, ny, pscale):
+    """Add the image size and pixel scale that adrizzle reads from an
+    stwcs HSTWCS to the astropy WCS ``w``."""
+    w._naxis1, w._naxis2 = nx, ny
+    w.pscale = pscale
+    return w
+
+
+def make_input(k):
+    """The WCS, science and weight arrays of input ``k``.  Its weights
+    are zero along one column so that it leaves holes of its own."""
+    rng = np.random.RandomState(k)
+    w = make_wcs(NX, NY, IN_PSCALE, rot=10.0 + 7.0 * k, sip=True,
+                 shift=(3.3 * k, -2.1 * k))
+    sci = rng.uniform(1.0, 100.0, (NY, NX)).astype(np.float32)
+    wht = rng.uniform(0.5, 1.5, (NY, NX)).astype(np.float32)
+    wht[:, 5 + 7 * k] = 0.0
+    return w, sci, wht
+
+
+def empty_output(context=True):
+    sci = np.zeros((ONY, ONX), np.float32)
+    wht = np.zeros((ONY, ONX), np.float32)
+    con = np.zeros((1, ONY, ONX), np.int32) if context else None
+    return sci, wht, con
+
+
+def tdriz(k, outsci, outwht, outcon, kernel='square', pixfrac=1.0,
+          fill='INDEF', nthreads=1, accumulate=False, compensation=None,
+          remove=False, gather=False, uniqid=None, factor=10.0,
+          tile_size=0):
+    """Drizzle input ``k`` with cdriz.tdriz; returns (nmiss, nskip)."""
+    w, sci, wht = make_input(k)
+    mapping = cdriz.DefaultWCSMapping(w, output_wcs(), NX, NY, factor)
+    if uniqid is None:
+        uniqid = k + 1
+    _vers, nmiss, nskip = cdriz.tdriz(
+        sci, wht, outsci, outwht, outcon, uniqid, 0, 1, 1, NY,
+        OUT_PSCALE / IN_PSCALE, 1.0, 1.0, 'center', pixfrac, kernel,
+        'cps', 1.0, 1.0, fill, 0, 0, 1, mapping, nthreads, tile_size,
+        int(accumulate), compensation, 0.0, int(remove), int(gather))
+    return nmiss, nskip
@@ -0,0 +1,135 @@
+"""
+Accumulated sums (tdriz accumulate=1) normalized by cdriz.tnormalize
+give the weighted mean image that tdriz makes directly.
+"""
+from __future__ import absolute_import, division, print_function
+
+import numpy as np
+import pytest
+
+from drizzlepac import cdriz
+from drizzlepac.tests.drizzle_helpers import empty_output, tdriz
+
+KERNELS = ['square', 'point', 'turbo', 'gaussian', 'lanczos3']
+NINPUTS = 3
+
+
+def drizzle_mean(kernel, fill):
+    sci, wht, con = empty_output()
+    for k in range(NINPUTS):
+        tdriz(k, sci, wht, con, kernel=kernel, fill=fill)
+    return sci, wht, con
+
+
+def drizzle_accumulated(kernel, fill, compensation=False):
+    sci, wht, con = empty_output()
+    comp = np.zeros((2,) + sci.shape, np.float32) if compensation else None
+    for k in range(NINPUTS):
+        tdriz(k, sci, wht, con, kernel=kernel, fill=fill, accumulate=True,
+              compensation=comp)
+    return sci, wht, con, comp
+
+
+def check_same_mean(mean, normalized, fill):
+    sci, wht, con = mean
+    nsci, nwht, ncon = normalized
+
+    np.testing.assert_array_equal(ncon, con)
+    np.testing.assert_array_equal(nwht == 0, wht == 0)
+    np.testing.assert_allclose(nwht, wht, rtol=1e-5, atol=1e-6)
+
+    # Pixels holding something other than a near-cancelling sum of
+    # (Lanczos) weights agree to float32 rounding
+    good = np.abs(wht) > 1e-3
+    np.testing.assert_allclose(nsci[good], sci[good], rtol=1e-4)
+
+    empty = (wht == 0)
+    assert empty.any()
+    if fill == 'INDEF':
+        assert (nsci[empty] == 0).all()
+    else:
+        assert (nsci[empty] == float(fill)).all()
+        assert (sci[empty] == float(fill)).all()
+
+
+@pytest.mark.parametrize('fill', ['INDEF', '-7.5'])
+@pytest.mark.parametrize('kernel', KERNELS)
+def test_tnormalize_in_place(kernel, fill):
+    mean = drizzle_mean(kernel, fill)
+    sci, wht, con, _ = drizzle_accumulated(kernel, fill)
+    cdriz.tnormalize(sci, wht)
+    check_same_mean(mean, (sci, wht, con), fill)
+
+
+@pytest.mark.parametrize('kernel', KERNELS)
+def test_tnormalize_into_result_keeps_sums(kernel):
+    sci, wht, con, _ = drizzle_accumulated(kernel, '-7.5')
+    sums = sci.copy()
+    result = np.zeros_like(sci)
+    cdriz.tnormalize(sci, wht, result)
+    np.testing.assert_array_equal(sci, sums)
+    check_same_mean(drizzle_mean(kernel, '-7.5'), (result, wht, con), '-7.5')
+
+
+@pytest.mark.parametrize('fill', ['INDEF', '-7.5'])
+@pytest.mark.parametrize('kernel', KERNELS)
+def test_compensated_tnormalize(kernel, fill):
+    mean = drizzle_mean(kernel, fill)
+    sci, wht, con, comp = drizzle_accumulated(kernel, fill, compensation=True)
+    cdriz.tnormalize(sci, wht, None, comp)
+    check_same_mean(mean, (sci, wht, con), fill)
+    # The error terms are folded into the weights and cleared
+    assert (comp == 0).all()
+
+
+def test_compensation_keeps_deep_sums_exact():
+    # Many drops of a constant onto the same output pixels: the plain
+    # float32 sums drift, the compensated ones stay within rounding of
+    # the float64 total.
+    nrepeat = 400
+    plain = empty_output(context=False)
+    comp_out = empty_output(context=False)
+    comp = np.zeros((2,) + plain[0].shape, np.float32)
+    ref_wht = np.zeros(plain[0].shape, np.float64)
+
+    for r in range(nrepeat):
+        tdriz(0, plain[0], plain[1], None, accumulate=True)
+        tdriz(0, comp_out[0], comp_out[1], None, accumulate=True,
+              compensation=comp)
+        one = empty_output(context=False)
+        tdriz(0, one[0], one[1], None, accumulate=True)
+        ref_wht += one[1]
+
+    covered = ref_wht > 0
+    plain_err = np.abs(plain[1][covered] - ref_wht[covered]) / ref_wht[covered]
+    comp_total = comp_out[1].astype(np.float64) + comp[1]
+    comp_err = np.abs(comp_total[covered] - ref_wht[covered]) / ref_wht[covered]
+
+    assert comp_err.max() < 1e-6
+    assert comp_err.max() < plain_err.max()
+
+
+
+def test_compensation_through_zero_weight():
+    # The weights of a pixel may add up to exactly zero on the way, with
+    # an error term left: that term must not be dropped.
+    n = 4
+    sci = np.ones((n, n), np.float32)
+    outsci = np.zeros((n, n), np.float32)
+    outwht = np.zeros((n, n), np.float32)
+    comp = np.zeros((2, n, n), np.float32)
+
+    def identity(x, y):
+        return x, y
+
+    for w in (1.0, 1e-8, -1.0, 0.5):
+        wht = np.full((n, n), w, np.float32)
+        cdriz.tdriz(sci, wht, outsci, outwht, None, 1, 0, 1, 1, n,
+                    1.0, 1.0, 1.0, 'center', 1.0, 'point', 'cps', 1.0, 1.0,
+                    'INDEF', 0, 0, 1, identity, 1, 0, 1, comp)
+
+    expected = 0.5 + float(np.float32(1e-8))
+    np.testing.assert_allclose(outwht.astype(np.float64) + comp[1], expected,
+                               rtol=1e-12)
+    np.testing.assert_allclose(outsci.astype(np.float64) + comp[0], expected,
+                               rtol=1e-12)
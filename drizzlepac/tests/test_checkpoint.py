@@ -0,0 +1,85 @@
+"""
+An incremental drizzle through a checkpoint file (adrizzle.write_checkpoint
+and read_checkpoint) gives the same image as drizzling all inputs at once.
+"""
+from __future__ import absolute_import, division, print_function
+
+import numpy as np
+import pytest
+
+from drizzlepac import adrizzle, cdriz
+from drizzlepac.tests.drizzle_helpers import (IN_PSCALE, NX, NY, ONX, ONY,
+                                              OUT_PSCALE, empty_output,
+                                              make_input, make_wcs,
+                                              output_wcs, with_size)
+
+NAMES = ['in%d_flt.fits[sci,1]' % k for k in range(3)]
+
+
+def sized_output_wcs():
+    return with_size(output_wcs(), ONX, ONY, OUT_PSCALE)
+
+
+def do_driz(k, outsci, outwht, outcon, uniqid):
+    w, sci, wht = make_input(k)
+    adrizzle.do_driz(sci, with_size(w, NX, NY, IN_PSCALE), wht,
+                     sized_output_wcs(), outsci, outwht, outcon,
+                     1.0, 'cps', 1.0, wcslin_pscale=IN_PSCALE,
+                     uniqid=uniqid, kernel='square', accumulate=True)
+
+
+def test_add_visit_to_checkpoint(tmp_path):
+    filename = str(tmp_path / 'final_ckpt.fits')
+    assert adrizzle.read_checkpoint(filename, sized_output_wcs()) is None
+
+    # First visit: inputs 0 and 1
+    sci, wht, con = empty_output()
+    for k in range(2):
+        do_driz(k, sci, wht, con, uniqid=k + 1)
+    adrizzle.write_checkpoint(filename, sized_output_wcs(), sci, wht, con,
+                              NAMES[:2], 200.0, 50000.0, 50000.5)
+
+    # Second visit: input 2, numbered after the first two
+    checkpoint = adrizzle.read_checkpoint(filename, sized_output_wcs())
+    assert checkpoint['nimages'] == 2
+    assert checkpoint['inputs'] == NAMES[:2]
+    assert checkpoint['texptime'] == 200.0
+    assert (checkpoint['expstart'], checkpoint['expend']) == (50000.0, 50000.5)
+    adrizzle.check_checkpoint_inputs(checkpoint, NAMES[2:], filename)
+    sci, wht, con = checkpoint['sci'], checkpoint['wht'], checkpoint['ctx']
+    do_driz(2, sci, wht, con, uniqid=checkpoint['nimages'] + 1)
+    cdriz.tnormalize(sci, wht)
+
+    # The same three inputs drizzled in one go
+    ref_sci, ref_wht, ref_con = empty_output()
+    for k in range(3):
+        do_driz(k, ref_sci, ref_wht, ref_con, uniqid=k + 1)
+    cdriz.tnormalize(ref_sci, ref_wht)
+
+    np.testing.assert_array_equal(sci, ref_sci)
+    np.testing.assert_array_equal(wht, ref_wht)
+    np.testing.assert_array_equal(con, ref_con)
+
+
+def test_inputs_are_not_added_twice(tmp_path):
+    filename = str(tmp_path / 'final_ckpt.fits')
+    sci, wht, con = empty_output()
+    do_driz(0, sci, wht, con, uniqid=1)
+    adrizzle.write_checkpoint(filename, sized_output_wcs(), sci, wht, con,
+                              NAMES[:1], 100.0, 50000.0, 50000.2)
+
+    checkpoint = adrizzle.read_checkpoint(filename, sized_output_wcs())
+    with pytest.raises(ValueError, match=r'already holds in0_flt\.fits'):
+        adrizzle.check_checkpoint_inputs(checkpoint, NAMES[:2], filename)
+
+
+def test_checkpoint_for_other_output(tmp_path):
+    filename = str(tmp_path / 'final_ckpt.fits')
+    sci, wht, con = empty_output()
+    adrizzle.write_checkpoint(filename, sized_output_wcs(), sci, wht, con,
+                              [], 0.0, 0.0, 0.0)
+
+    other = with_size(make_wcs(ONX, ONY, OUT_PSCALE, rot=5.0),
+                      ONX, ONY, OUT_PSCALE)
+    with pytest.raises(ValueError, match='different output WCS'):
+        adrizzle.read_checkpoint(filename, other)
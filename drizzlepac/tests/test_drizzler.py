@@ -0,0 +1,146 @@
+"""
+cdriz.Drizzler gives the same output as a tdriz call per input.
+"""
+from __future__ import absolute_import, division, print_function
+
+import numpy as np
+import pytest
+
+from drizzlepac import cdriz
+from drizzlepac.tests.drizzle_helpers import (IN_PSCALE, NX, NY, OUT_PSCALE,
+                                              empty_output, make_input,
+                                              output_wcs, tdriz)
+
+NINPUTS = 3
+
+
+def add_image(drizzler, k, **kwargs):
+    w, sci, wht = make_input(k)
+    mapping = cdriz.DefaultWCSMapping(w, output_wcs(), NX, NY, 10.0)
+    return drizzler.add_image(sci, wht, mapping,
+                              scale=OUT_PSCALE / IN_PSCALE, **kwargs)
+
+
+@pytest.mark.parametrize('accumulate', [False, True])
+@pytest.mark.parametrize('kernel', ['square', 'gaussian', 'lanczos3',
+                                    'turbo'])
+def test_add_image_matches_tdriz(kernel, accumulate):
+    ref = empty_output()
+    ref_miss = [tdriz(k, *ref, kernel=kernel, pixfrac=0.8,
+                      accumulate=accumulate) for k in range(NINPUTS)]
+
+    out = empty_output()
+    drizzler = cdriz.Drizzler(*out, kernel=kernel, pixfrac=0.8,
+                              accumulate=accumulate)
+    got_miss = [add_image(drizzler, k) for k in range(NINPUTS)]
+
+    assert got_miss == ref_miss
+    for got, expected in zip(out, ref):
+        np.testing.assert_array_equal(got, expected)
+    assert drizzler.output is out[0]
+    assert drizzler.outweight is out[1]
+
+
+def test_uniqid_follows_nimages():
+    sci, wht, con = empty_output()
+    drizzler = cdriz.Drizzler(sci, wht, con)
+    assert drizzler.nimages == 0
+
+    add_image(drizzler, 0)
+    add_image(drizzler, 1)
+    assert drizzler.nimages == 2
+    add_image(drizzler, 2, uniqid=5)
+    assert drizzler.nimages == 5
+    add_image(drizzler, 0)
+    assert drizzler.nimages == 6
+
+    # Each input set its own bit of the context
+    bits = np.bitwise_or.reduce(con.ravel())
+    assert bits == (1 << 0) | (1 << 1) | (1 << 4) | (1 << 5)
+
+
+def test_not_set_up():
+    drizzler = cdriz.Drizzler.__new__(cdriz.Drizzler)
+    with pytest.raises(RuntimeError, match='not set up'):
+        add_image(drizzler, 0)
+    with pytest.raises(RuntimeError, match='not ready'):
+        drizzler.fill(0.0)
+
+
+def test_busy():
+    # A Python mapping is called back while the Drizzler is drizzling,
+    # so it can try to use the Drizzler again
+    sci, wht, con = empty_output()
+    drizzler = cdriz.Drizzler(sci, wht, con)
+    w, insci, inwht = make_input(0)
+    wcs_mapping = cdriz.DefaultWCSMapping(w, output_wcs(), NX, NY, 10.0)
+    errors = []
+
+    def mapping(x, y):
+        if not errors:
+            for call in (lambda: add_image(drizzler, 1),
+                         lambda: drizzler.fill(0.0),
+                         lambda: drizzler.normalize()):
+                try:
+                    call()
+                except RuntimeError as e:
+                    errors.append(str(e))
+        return wcs_mapping(x, y)
+
+    drizzler.add_image(insci, inwht, mapping, scale=OUT_PSCALE / IN_PSCALE)
+    assert len(errors) == 3
+    assert 'in use' in errors[0]
+
+    # and it is free again afterwards
+    add_image(drizzler, 1)
+    assert drizzler.nimages == 2
+
+
+@pytest.mark.parametrize('kernel', ['square', 'gaussian', 'point'])
+def test_context_table(kernel):
+    # Inputs past 32, which a bitmask plane has no room for
+    uniqids = [1, 2, 40, 41]
+
+    ref_sci, ref_wht, _ = empty_output(context=False)
+    ref_con = np.zeros((2,) + ref_sci.shape, np.int32)
+    for k, uniqid in enumerate(uniqids):
+        tdriz(k % 3, ref_sci, ref_wht, ref_con, kernel=kernel, pixfrac=0.8,
+              uniqid=uniqid)
+
+    sci, wht, _ = empty_output(context=False)
+    con = np.zeros(sci.shape, np.int32)
+    drizzler = cdriz.Drizzler(sci, wht, con, kernel=kernel, pixfrac=0.8,
+                              context_table=True)
+    for k, uniqid in enumerate(uniqids):
+        add_image(drizzler, k % 3, uniqid=uniqid)
+
+    np.testing.assert_array_equal(sci, ref_sci)
+    np.testing.assert_array_equal(wht, ref_wht)
+
+    # Each pixel's context lists the inputs that set their bit
+    ref_images = [tuple(u for u in uniqids
+                        if ref_con[(u - 1) // 32, j, i] & (1 << ((u - 1) % 32)))
+                  for j, i in np.ndindex(sci.shape)]
+    images = [drizzler.context_images(c) for c in con.ravel()]
+    assert images == ref_images
+
+    # and the table holds each set of inputs once, including the ones
+    # pixels passed through on the way
+    contexts = [drizzler.context_images(c)
+                for c in range(drizzler.ncontexts)]
+    assert contexts[0] == ()
+    assert len(set(contexts)) == len(contexts)
+    assert set(ref_images) <= set(contexts)
+
+
+def test_context_table_needs_empty_context():
+    sci, wht, con = empty_output()
+    with pytest.raises(Exception, match='empty 2-D context'):
+        cdriz.Drizzler(sci, wht, con, context_table=True)
+    con = np.ones(sci.shape, np.int32)
+    with pytest.raises(Exception, match='empty 2-D context'):
+        cdriz.Drizzler(sci, wht, con, context_table=True)
+
+    drizzler = cdriz.Drizzler(sci, wht)
+    with pytest.raises(RuntimeError, match='no context table'):
+        drizzler.context_images(0)
@@ -0,0 +1,52 @@
+"""
+The tabulated Gaussian kernel (kernel_tolerance above 0) against the
+exact one.
+"""
+from __future__ import absolute_import, division, print_function
+
+import numpy as np
+import pytest
+
+from drizzlepac import cdriz
+from drizzlepac.tests.drizzle_helpers import (IN_PSCALE, NX, NY, OUT_PSCALE,
+                                              empty_output, make_input,
+                                              output_wcs)
+
+SCALE = OUT_PSCALE / IN_PSCALE
+
+
+def drizzle_isolated(pixfrac, tolerance):
+    """Drizzle every tenth pixel of every tenth line of input 0, far
+    enough apart that no output pixel gets more than one drop."""
+    w, sci, _ = make_input(0)
+    wht = np.zeros_like(sci)
+    wht[::10, ::10] = 1.0
+    outsci, outwht, _ = empty_output()
+    cdriz.tdriz(
+        sci, wht, outsci, outwht, None, 1, 0, 1, 1, NY,
+        SCALE, 1.0, 1.0, 'center', pixfrac, 'gaussian', 'cps', 1.0, 1.0,
+        'INDEF', 0, 0, 1,
+        cdriz.DefaultWCSMapping(w, output_wcs(), NX, NY, 10.0),
+        1, 0, 0, None, tolerance)
+    return outwht
+
+
+@pytest.mark.parametrize('pixfrac', [1.0, 0.5])
+@pytest.mark.parametrize('tolerance', [1e-3, 1e-5, 2.5e-7])
+def test_weights_within_tolerance(pixfrac, tolerance):
+    exact = drizzle_isolated(pixfrac, 0.0)
+    tabulated = drizzle_isolated(pixfrac, tolerance)
+
+    # Each drop is es times a product of two factors, each within the
+    # tolerance, and rounded to single precision
+    efac = 2.3548 ** 2 * SCALE ** 2 / pixfrac ** 2 / 2.0
+    es = efac / np.pi
+    bound = es * (2.0 * tolerance + tolerance ** 2 +
+                  2.0 * np.finfo(np.float32).eps)
+    assert exact.max() > 0.5 * es
+    assert np.abs(tabulated - exact).max() <= bound
+
+
+def test_tolerance_below_single_precision():
+    with pytest.raises(Exception, match='finer than single precision'):
+        drizzle_isolated(1.0, 1e-8)
@@ -0,0 +1,69 @@
+"""
+The lines that tdriz skips (nskip) as falling off the output, against
+transforming every pixel of every line.
+"""
+from __future__ import absolute_import, division, print_function
+
+import numpy as np
+import pytest
+
+from drizzlepac import cdriz
+from drizzlepac.tests.drizzle_helpers import make_wcs
+
+# A large input onto a small output, which only some of its lines reach
+NX, NY = 150, 140
+ONX, ONY = 60, 50
+
+
+def skipped_lines(win, wout, margin):
+    """The number of input lines with no pixel centre within ``margin``
+    output pixels of the output."""
+    exact = cdriz.DefaultWCSMapping(win, wout, NX, NY, 0.0)
+    x = np.tile(np.arange(1.0, NX + 1), NY)
+    y = np.repeat(np.arange(1.0, NY + 1), NX)
+    ox, oy = exact(x, y)
+    near = ((ox >= 1 - margin) & (ox <= ONX + margin) &
+            (oy >= 1 - margin) & (oy <= ONY + margin)).reshape(NY, NX)
+    return int((~near.any(axis=1)).sum())
+
+
+@pytest.mark.parametrize('kernel', ['square', 'point', 'turbo', 'gaussian'])
+@pytest.mark.parametrize('rot,shift', [(10.0, (0.0, 0.0)),
+                                       (30.0, (40.0, -30.0)),
+                                       (0.0, (70.0, 0.0))])
+def test_nskip_follows_lines(kernel, rot, shift):
+    win = make_wcs(NX, NY, 0.05, rot=rot, sip=True, shift=shift)
+    wout = make_wcs(ONX, ONY, 0.04)
+    sci = np.ones((NY, NX), np.float32)
+    out = np.zeros((ONY, ONX), np.float32)
+    wht = np.zeros((ONY, ONX), np.float32)
+    _vers, _nmiss, nskip = cdriz.tdriz(
+        sci, np.ones_like(sci), out, wht, None, 1, 0, 1, 1, NY,
+        0.8, 1.0, 1.0, 'center', 1.0, kernel, 'cps', 1.0, 1.0, 'INDEF',
+        0, 0, 1, cdriz.DefaultWCSMapping(win, wout, NX, NY, 10.0))
+
+    # No line that comes within the 5 pixel margin is skipped, and few
+    # that stay well clear of it are drizzled
+    assert skipped_lines(win, wout, 12.0) <= nskip
+    assert nskip <= skipped_lines(win, wout, 5.0)
+
+
+@pytest.mark.parametrize('kernel,tile_size', [('square', 0), ('square', 16),
+                                              ('gaussian', 0)])
+def test_nskip_same_for_any_nthreads(kernel, tile_size):
+    win = make_wcs(NX, NY, 0.05, rot=30.0, sip=True, shift=(40.0, -30.0))
+    wout = make_wcs(ONX, ONY, 0.04)
+    sci = np.ones((NY, NX), np.float32)
+    counts = []
+    for nthreads in (1, 3, 8):
+        out = np.zeros((ONY, ONX), np.float32)
+        wht = np.zeros((ONY, ONX), np.float32)
+        _vers, nmiss, nskip = cdriz.tdriz(
+            sci, np.ones_like(sci), out, wht, None, 1, 0, 1, 1, NY,
+            0.8, 1.0, 1.0, 'center', 1.0, kernel, 'cps', 1.0, 1.0, 'INDEF',
+            0, 0, 1, cdriz.DefaultWCSMapping(win, wout, NX, NY, 10.0),
+            nthreads, tile_size)
+        counts.append((nmiss, nskip))
+
+    assert counts[1] == counts[0]
+    assert counts[2] == counts[0]
@@ -0,0 +1,101 @@
+"""
+Each way tdriz can be run, against the same inputs drizzled on one
+thread into separate science, weight and context images.
+"""
+from __future__ import absolute_import, division, print_function
+
+import numpy as np
+import pytest
+
+from drizzlepac import adrizzle
+from drizzlepac.tests.drizzle_helpers import ONX, ONY, empty_output, tdriz
+
+KERNELS = ['square', 'point', 'turbo', 'gaussian', 'lanczos3']
+NINPUTS = 3
+
+
+def check_identical(result, ref):
+    for value, ref_value in zip(result[:3], ref[:3]):
+        np.testing.assert_array_equal(value, ref_value)
+    assert result[3] == ref[3]
+
+
+def drizzle(kernel, **kwargs):
+    """Drizzle all of the inputs; returns the science, weight and
+    context images and the (nmiss, nskip) of each input."""
+    sci, wht, con = empty_output()
+    counts = [tdriz(k, sci, wht, con, kernel=kernel, **kwargs)
+              for k in range(NINPUTS)]
+    return sci, wht, con, counts
+
+
+@pytest.mark.parametrize('nthreads', [2, 3, 8])
+@pytest.mark.parametrize('kernel', KERNELS)
+def test_band_threads(kernel, nthreads):
+    ref_sci, ref_wht, ref_con, ref_counts = drizzle(kernel)
+    sci, wht, con, counts = drizzle(kernel, nthreads=nthreads)
+
+    # The bands are summed in another order, so the sums round
+    # differently.  The weighted sums are compared rather than the
+    # means, which the near-cancelling Lanczos weights blow up.
+    assert counts == ref_counts
+    np.testing.assert_array_equal(con, ref_con)
+    for value, ref in ((wht, ref_wht), (sci * wht, ref_sci * ref_wht)):
+        np.testing.assert_allclose(value, ref, rtol=1e-6,
+                                   atol=1e-6 * np.abs(ref).max())
+
+
+@pytest.mark.parametrize('nthreads', [1, 3])
+@pytest.mark.parametrize('kernel', ['square', 'point', 'turbo'])
+def test_gather(kernel, nthreads):
+    check_identical(drizzle(kernel, nthreads=nthreads, gather=True),
+                    drizzle(kernel))
+
+
+@pytest.mark.parametrize('pixfrac', [1.0, 0.6])
+@pytest.mark.parametrize('tile_size', [1, 8, 64])
+def test_tiles(tile_size, pixfrac):
+    check_identical(drizzle('square', pixfrac=pixfrac, tile_size=tile_size),
+                    drizzle('square', pixfrac=pixfrac))
+
+
+@pytest.mark.parametrize('nthreads', [1, 3])
+@pytest.mark.parametrize('kernel', KERNELS)
+def test_interleaved_output(kernel, nthreads):
+    out = adrizzle.interleaved_output((ONY, ONX))
+    counts = [tdriz(k, out, None, None, kernel=kernel, nthreads=nthreads)
+              for k in range(NINPUTS)]
+    sci, wht, con = adrizzle.unpack_output(out)
+
+    check_identical((sci, wht, con[np.newaxis], counts),
+                    drizzle(kernel, nthreads=nthreads))
+
+
+@pytest.mark.parametrize('nthreads', [1, 3])
+@pytest.mark.parametrize('kernel', ['square', 'gaussian'])
+def test_context_cube(kernel, nthreads):
+    # Images 33 on go in the second plane, at the bits they would have
+    # in a single plane
+    ref_sci, ref_wht, _ = empty_output(context=False)
+    ref_con = np.zeros((ONY, ONX), np.int32)
+    ref_counts = [tdriz(k, ref_sci, ref_wht, ref_con, kernel=kernel,
+                        nthreads=nthreads, uniqid=33 + k)
+                  for k in range(NINPUTS)]
+
+    sci, wht, _ = empty_output(context=False)
+    con = np.zeros((2, ONY, ONX), np.int32)
+    counts = [tdriz(k, sci, wht, con, kernel=kernel, nthreads=nthreads,
+                    uniqid=33 + k)
+              for k in range(NINPUTS)]
+
+    assert not con[0].any()
+    check_identical((sci, wht, con[1], counts),
+                    (ref_sci, ref_wht, ref_con, ref_counts))
+
+
+def test_context_cube_too_small():
+    sci, wht, con = empty_output()
+    with pytest.raises(Exception, match='Not enough planes'):
+        tdriz(0, sci, wht, con, uniqid=33)
+    assert not sci.any()
+    assert not wht.any()
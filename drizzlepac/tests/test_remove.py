@@ -0,0 +1,81 @@
+"""
+Taking an input out of accumulated sums (tdriz remove=1) leaves what
+drizzling the other inputs alone gives.
+"""
+from __future__ import absolute_import, division, print_function
+
+import numpy as np
+import pytest
+
+from drizzlepac import cdriz
+from drizzlepac.tests.drizzle_helpers import empty_output, tdriz
+
+KERNELS = ['square', 'turbo', 'lanczos3']
+
+
+def accumulate(inputs, kernel, compensation, remove=()):
+    sci, wht, con = empty_output()
+    comp = np.zeros((2,) + sci.shape, np.float32) if compensation else None
+    for k in inputs:
+        tdriz(k, sci, wht, con, kernel=kernel, pixfrac=0.8, accumulate=True,
+              compensation=comp)
+    for k in remove:
+        tdriz(k, sci, wht, con, kernel=kernel, pixfrac=0.8, accumulate=True,
+              compensation=comp, remove=True)
+    cdriz.tnormalize(sci, wht, None, comp)
+    return sci, wht, con
+
+
+@pytest.mark.parametrize('compensation', [False, True])
+@pytest.mark.parametrize('kernel', KERNELS)
+def test_remove_one_of_two(kernel, compensation):
+    if kernel == 'lanczos3' and not compensation:
+        pytest.skip('needs compensation, see test_lanczos_needs_compensation')
+
+    sci, wht, con = accumulate([0, 1], kernel, compensation, remove=[0])
+    ref_sci, ref_wht, ref_con = accumulate([1], kernel, compensation)
+
+    np.testing.assert_array_equal(con, ref_con)
+    empty = (wht == 0)
+    ref_empty = (ref_wht == 0)
+    assert (sci[empty] == 0).all()
+    if kernel == 'lanczos3':
+        # Besides the pixels that only input 0 reached, those where the
+        # Lanczos weights of input 1 cancel to within rounding are empty
+        assert empty[ref_empty].all()
+        assert (np.abs(ref_wht[empty]) < 1e-9 * np.abs(ref_wht).max()).all()
+    else:
+        np.testing.assert_array_equal(empty, ref_empty)
+
+    # What is left of a pixel that both inputs reached is rounded as the
+    # sum of both was, so it is compared at that scale
+    both = accumulate([0, 1], kernel, compensation)[1]
+    tol = 1e-5 if compensation else 1e-6 * np.abs(both).max()
+    np.testing.assert_allclose(wht, ref_wht, rtol=1e-5, atol=tol)
+    good = np.abs(ref_wht) > 0.05 * np.abs(ref_wht).max()
+    np.testing.assert_allclose(sci[good], ref_sci[good], rtol=1e-3)
+
+
+def test_remove_both():
+    sci, wht, con = accumulate([0, 1], 'lanczos3', True, remove=[1, 0])
+    assert (wht == 0).all()
+    assert (sci == 0).all()
+    assert (con == 0).all()
+
+
+@pytest.mark.parametrize('kernel', KERNELS)
+def test_remove_needs_context(kernel):
+    sci, wht, _ = empty_output(context=False)
+    comp = np.zeros((2,) + sci.shape, np.float32)
+    tdriz(0, sci, wht, None, kernel=kernel, accumulate=True, compensation=comp)
+    with pytest.raises(Exception, match='bitmask context'):
+        tdriz(0, sci, wht, None, kernel=kernel, accumulate=True,
+              compensation=comp, remove=True)
+
+
+def test_lanczos_needs_compensation():
+    sci, wht, con = empty_output()
+    tdriz(0, sci, wht, con, kernel='lanczos3', accumulate=True)
+    with pytest.raises(Exception, match='compensated sums'):
+        tdriz(0, sci, wht, con, kernel='lanczos3', accumulate=True,
+              remove=True)
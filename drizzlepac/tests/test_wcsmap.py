@@ -0,0 +1,140 @@
+"""
+The interpolated cdriz.DefaultWCSMapping against the exact one
+(factor=0) on a strongly distorted SIP WCS.
+"""
+from __future__ import absolute_import, division, print_function
+
+import numpy as np
+import pytest
+from astropy import wcs
+
+from drizzlepac import cdriz
+from drizzlepac.tests.drizzle_helpers import empty_output, make_wcs, tdriz
+
+NX, NY = 200, 150
+
+
+def distorted_wcs():
+    w = make_wcs(NX, NY, 0.05, rot=10.0, sip=True)
+    w.sip = wcs.Sip(30.0 * w.sip.a, 30.0 * w.sip.b, None, None, w.wcs.crpix)
+    w.wcs.set()
+    return w
+
+
+def sample_points():
+    """Scattered points, and points along a row and along a column."""
+    rng = np.random.RandomState(1)
+    x = np.concatenate([rng.uniform(1.0, NX, 5000),
+                        np.linspace(1.0, NX, 2001), np.full(1501, 77.3)])
+    y = np.concatenate([rng.uniform(1.0, NY, 5000),
+                        np.full(2001, 33.7), np.linspace(1.0, NY, 1501)])
+    return x, y
+
+
+def mapping(factor, **kwargs):
+    return cdriz.DefaultWCSMapping(distorted_wcs(), make_wcs(300, 250, 0.04),
+                                   NX, NY, factor, **kwargs)
+
+
+def mapping_error(m):
+    x, y = sample_points()
+    ex, ey = mapping(0.0)(x, y)
+    mx, my = m(x, y)
+    return np.hypot(mx - ex, my - ey).max()
+
+
+@pytest.mark.parametrize('tolerance', [0.05, 0.01, 0.002])
+@pytest.mark.parametrize('factor', [50.0, 10.0])
+def test_tolerance(factor, tolerance):
+    assert mapping_error(mapping(factor)) > tolerance
+
+    m = mapping(factor, tolerance=tolerance)
+    error = mapping_error(m)
+    assert m.tolerance == tolerance
+    assert error <= tolerance
+    # The reported error is measured where bilinear interpolation is
+    # furthest out, so it is close to the true one
+    assert 0.0 < m.max_error <= tolerance
+    assert 0.7 * m.max_error <= error <= 1.05 * m.max_error
+
+
+def test_no_tolerance():
+    m = mapping(10.0)
+    assert m.tolerance == 0.0
+    assert m.max_error == 0.0
+
+
+@pytest.mark.parametrize('factor', [50.0, 20.0, 10.0])
+def test_cubic_beats_bilinear(factor):
+    bilinear = mapping_error(mapping(factor))
+    cubic = mapping_error(mapping(factor, cubic=True))
+    assert cubic < 0.25 * bilinear
+
+
+@pytest.fixture
+def scalar_and_simd():
+    """Run a function with the vector code off, then on."""
+    def run(f):
+        try:
+            cdriz.use_simd(False)
+            scalar = f()
+        finally:
+            cdriz.use_simd(True)
+        return scalar, f()
+    return run
+
+
+@pytest.mark.parametrize('cubic', [False, True])
+def test_simd_mapping_matches_scalar(scalar_and_simd, cubic):
+    # Along rows, as the kernels ask for them, from odd starting points
+    # so that the vector loops have ends to finish off
+    x = np.linspace(1.3, NX - 0.4, 1003)
+
+    def run():
+        m = mapping(10.0, cubic=cubic)
+        return [m(x, np.full(x.shape, y)) for y in (1.0, 33.7, 74.5, NY)]
+
+    scalar, simd = scalar_and_simd(run)
+    for (sx, sy), (vx, vy) in zip(scalar, simd):
+        np.testing.assert_array_equal(sx, vx)
+        np.testing.assert_array_equal(sy, vy)
+
+
+@pytest.mark.parametrize('kernel', ['square', 'turbo'])
+def test_simd_drizzle_matches_scalar(scalar_and_simd, kernel):
+    def run():
+        out = empty_output()
+        for k in range(3):
+            tdriz(k, *out, kernel=kernel, pixfrac=0.8)
+        return out
+
+    scalar, simd = scalar_and_simd(run)
+    for s, v in zip(scalar, simd):
+        np.testing.assert_array_equal(s, v)
+
+
+@pytest.mark.parametrize('level', ['avx2', 'avx512'])
+def test_square_kernel_versions_match(level):
+    # Each version of the square kernel's overlaps, forced in turn
+    def run():
+        out = empty_output()
+        for k in range(3):
+            tdriz(k, *out, kernel='square', pixfrac=0.8)
+        return out
+
+    try:
+        assert cdriz.use_simd('scalar') == 'scalar'
+        scalar = run()
+        if cdriz.use_simd(level) != level:
+            pytest.skip('the CPU does not support {}'.format(level))
+        vector = run()
+    finally:
+        cdriz.use_simd(True)
+
+    for s, v in zip(scalar, vector):
+        np.testing.assert_array_equal(s, v)
+
+
+def test_unknown_vector_code():
+    with pytest.raises(ValueError, match='Unknown vector code'):
+        cdriz.use_simd('sse9')
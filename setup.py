@@ -78,6 +78,11 @@ include_dirs.extend(wcs_includes)
 # Setup C module macros
 define_macros = []
 
+# Threaded drizzling uses POSIX threads everywhere but on Windows
+libraries = []
+if sys.platform != 'win32':
+    libraries.append('pthread')
+
 # Handle MSVC `wcsset` redefinition
 if sys.platform == 'win32':
     define_macros += [
@@ -217,6 +222,7 @@ setup(
         Extension('drizzlepac.cdriz',
                   glob('src/*.c'),
                   include_dirs=include_dirs,
+                  libraries=libraries,
                   define_macros=define_macros),
     ],
     cmdclass={
@@ -9,18 +9,68 @@
 #include <float.h>
 #define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
 #include <numpy/arrayobject.h>
+#include <structmember.h>
 
 #include "astropy_wcs_api.h"
 #include "astropy_wcs.h"
 
 #include "cdrizzleblot.h"
 #include "cdrizzlebox.h"
+#include "cdrizzlecontext.h"
 #include "cdrizzlemap.h"
+#include "cdrizzleoverlap.h"
 #include "cdrizzleutil.h"
 #include "cdrizzlewcs.h"
 
 static PyObject *gl_Error;
 
+/*
+ The record type of an interleaved drizzle output: the output data,
+ weight and context of each pixel, one after the other.  Each field of
+ such an array can be used on the Python side as an ordinary 2D view.
+*/
+static int
+is_interleaved_output(PyArrayObject *arr)
+{
+  PyObject *spec = NULL;
+  PyArray_Descr *dtype = NULL;
+  int result = 0;
+
+  spec = Py_BuildValue("[(ss)(ss)(ss)]",
+                       "data", "<f4", "wht", "<f4", "con", "<i4");
+  if (spec == NULL || !PyArray_DescrConverter(spec, &dtype)) {
+    PyErr_Clear();
+    goto _exit;
+  }
+
+  result = (PyArray_NDIM(arr) == 2 &&
+            PyArray_IS_C_CONTIGUOUS(arr) &&
+            PyArray_ISWRITEABLE(arr) &&
+            PyObject_RichCompareBool((PyObject *)PyArray_DESCR(arr),
+                                     (PyObject *)dtype, Py_EQ) == 1);
+
+ _exit:
+  Py_XDECREF(spec);
+  Py_XDECREF(dtype);
+  return result;
+}
+
+/*
+ The error terms of compensated accumulation, [2][ony][onx] float32
+ (data, then weight), which tdriz and tnormalize update in place.
+*/
+static int
+is_compensation_array(PyArrayObject *arr, npy_intp ony, npy_intp onx)
+{
+  return (PyArray_TYPE(arr) == NPY_FLOAT32 &&
+          PyArray_NDIM(arr) == 3 &&
+          PyArray_DIMS(arr)[0] == 2 &&
+          PyArray_DIMS(arr)[1] == ony &&
+          PyArray_DIMS(arr)[2] == onx &&
+          PyArray_IS_C_CONTIGUOUS(arr) &&
+          PyArray_ISWRITEABLE(arr));
+}
+
 
 /*
  A mapping callback that delegates to a Python-based drizzle
@@ -34,6 +84,9 @@ static PyObject *gl_Error;
  xin, yin are the input coordinates, and xout and yout are the output
  coordinates.  All are 1-dimensional Numpy DOUBLE arrays of the same
  length.
+
+ The drizzling and blotting loops run with the GIL released, so the
+ GIL is reacquired here for the duration of the call.
 */
 static int
 py_mapping_callback(void* state,
@@ -53,8 +106,11 @@ py_mapping_callback(void* state,
   PyArrayObject* py_yout = NULL;
   PyObject* callback_result = NULL;
   PyObject* callback_tuple = NULL;
+  PyGILState_STATE gstate;
   int result = TRUE;
 
+  gstate = PyGILState_Ensure();
+
   py_xin = (PyArrayObject*)PyArray_SimpleNewFromData(1, &dims, NPY_FLOAT64, (double*)xin);
   if (py_xin == NULL)
     goto _py_mapping_callback_exit;
@@ -110,6 +166,8 @@ py_mapping_callback(void* state,
   Py_XDECREF(py_xout);
   Py_XDECREF(py_yout);
 
+  PyGILState_Release(gstate);
+
   if (result)
     driz_error_set_message(error, "<PYTHON>");
 
@@ -129,17 +187,91 @@ in addition to the C-based transformations.
 typedef struct {
   PyObject_HEAD
   struct wcsmap_param_t m;
+  /* Copies of the WCS objects as they were when the mapping was made */
   PyObject* py_input;
   PyObject* py_output;
+  /* Further copies of those that the mapping transforms with, input
+     and output in turn, with their wcsprm in the C form.  Nothing else
+     sees them, so they are converted just once and the transformations
+     can run without the GIL.  The direct mapping gets one pair for
+     each thread that can transform at once. */
+  PyObject* py_copies;
 } PyWCSMap;
 
+static PyObject*
+PyWCSMap_deepcopy(PyObject* wcs_obj)
+{
+  PyObject* copy_module;
+  PyObject* result;
+
+  copy_module = PyImport_ImportModule("copy");
+  if (copy_module == NULL) {
+    return NULL;
+  }
+  result = PyObject_CallMethod(copy_module, "deepcopy", "O", wcs_obj);
+  Py_DECREF(copy_module);
+
+  return result;
+}
+
+/*
+ Make another pair of working copies of the WCS and convert them to the
+ C form.  The pipelines of the new pair are returned in \a input and
+ \a output.
+*/
+static int
+PyWCSMap_add_copies(PyWCSMap* self,
+                    /* Output parameters */
+                    pipeline_t** input, pipeline_t** output)
+{
+  PyObject* copies[2];
+  int i, status = -1;
+
+  copies[0] = PyWCSMap_deepcopy(self->py_input);
+  copies[1] = (copies[0] != NULL) ? PyWCSMap_deepcopy(self->py_output) : NULL;
+  if (copies[1] == NULL) {
+    goto exit;
+  }
+
+  for (i = 0; i < 2; ++i) {
+    if (PyList_Append(self->py_copies, copies[i])) {
+      goto exit;
+    }
+    wcsprm_python2c(((Wcs*)copies[i])->x.wcs);
+  }
+
+  *input = &((Wcs*)copies[0])->x;
+  *output = &((Wcs*)copies[1])->x;
+  status = 0;
+
+ exit:
+  Py_XDECREF(copies[0]);
+  Py_XDECREF(copies[1]);
+
+  return status;
+}
+
+static void
+PyWCSMap_clear(PyWCSMap* self)
+{
+  Py_ssize_t i;
+
+  wcsmap_param_free(&self->m);
+  if (self->py_copies != NULL) {
+    for (i = 0; i < PyList_GET_SIZE(self->py_copies); ++i) {
+      wcsprm_c2python(((Wcs*)PyList_GET_ITEM(self->py_copies, i))->x.wcs);
+    }
+  }
+  Py_CLEAR(self->py_copies);
+  Py_CLEAR(self->py_input);
+  Py_CLEAR(self->py_output);
+}
+
 static void
 PyWCSMap_dealloc(PyWCSMap* self)
 {
   /* Deal with our reference-counted members */
-  Py_XDECREF(self->py_input);  self->py_input = NULL;
-  Py_XDECREF(self->py_output); self->py_output = NULL;
-  wcsmap_param_free(&self->m);
+  PyWCSMap_clear(self);
 
   Py_TYPE(self)->tp_free((PyObject*)self);
 }
@@ -150,9 +282,10 @@ PyWCSMap_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
   PyWCSMap *self;
 
   self = (PyWCSMap *)type->tp_alloc(type, 0);
-  self->py_input = NULL;
-  self->py_output = NULL;
   if (self != NULL) {
+    self->py_input = NULL;
+    self->py_output = NULL;
+    self->py_copies = NULL;
     wcsmap_param_init(&self->m);
   }
 
@@ -167,25 +300,44 @@ PyWCSMap_init(PyWCSMap *self, PyObject *args, PyObject *kwds)
   PyObject *output_obj = NULL;
   int nx, ny;
   double factor;
+  double tolerance = 0.0;
+  int cubic = 0;
   int status = -1;
+  pipeline_t *input, *output;
 
   /* Other miscellaneous local variables */
   struct driz_error_t error;
   int istat = 1;
+  static char *kwlist[] = {"input", "output", "nx", "ny", "factor",
+                           "tolerance", "cubic", NULL};
 
   driz_error_init(&error);
 
-  /* TODO: Make factor a kwarg */
-  if (! PyArg_ParseTuple(args, "OOiid:DefaultWCSMapping.__init__",
-                         &input_obj, &output_obj, &nx, &ny, &factor)){
+  if (! PyArg_ParseTupleAndKeywords(args, kwds,
+                                    "OOiid|di:DefaultWCSMapping.__init__",
+                                    kwlist, &input_obj, &output_obj,
+                                    &nx, &ny, &factor, &tolerance, &cubic)){
+    goto exit;
+  }
+
+  /* Start again from scratch if __init__ is called more than once */
+  PyWCSMap_clear(self);
+
+  /* The mapping keeps to the WCS as they are now: later changes to
+     input_obj and output_obj do not affect it */
+  self->py_input = PyWCSMap_deepcopy(input_obj);
+  self->py_output = PyWCSMap_deepcopy(output_obj);
+  self->py_copies = PyList_New(0);
+  if (self->py_input == NULL || self->py_output == NULL ||
+      self->py_copies == NULL ||
+      PyWCSMap_add_copies(self, &input, &output)) {
     goto exit;
   }
 
   /* Create the C struct from all of these mapping parameters */
   istat = default_wcsmap_init(
-      &self->m,
-      &((Wcs*)input_obj)->x, &((Wcs*)output_obj)->x,
-      nx, ny, factor,
+      &self->m, input, output,
+      nx, ny, factor, tolerance, (bool_t)(cubic != 0),
       &error);
 
   if (istat || driz_error_is_set(&error)) {
@@ -194,11 +346,6 @@ PyWCSMap_init(PyWCSMap *self, PyObject *args, PyObject *kwds)
     goto exit;
   }
 
-  Py_INCREF(input_obj);
-  Py_INCREF(output_obj);
-  self->py_input = input_obj;
-  self->py_output = output_obj;
-
   status = 0;
 
  exit:
@@ -281,6 +428,14 @@ PyWCSMap_call(PyWCSMap* self, PyObject* args, PyObject* kwargs)
   return result;
 }
 
+static PyMemberDef PyWCSMap_members[] = {
+  {"tolerance", T_DOUBLE, offsetof(PyWCSMap, m.tolerance), READONLY,
+   "Interpolation error the table was refined to, in output pixels"},
+  {"max_error", T_DOUBLE, offsetof(PyWCSMap, m.max_error), READONLY,
+   "Largest interpolation error found while refining the table, in output pixels"},
+  {NULL, 0, 0, 0, NULL}  /* sentinel */
+};
+
 static PyTypeObject WCSMapType = {
   PyVarObject_HEAD_INIT(NULL, 0)
   (char *) "cdriz.DefaultWCSMapping",              /*tp_name*/
@@ -302,7 +457,7 @@ static PyTypeObject WCSMapType = {
   0,                                               /*tp_setattro*/
   0,                                               /*tp_as_buffer*/
   (long) Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /*tp_flags*/
-  (char *) "DefaultWCSMapping(input,output)",      /* tp_doc */
+  (char *) "DefaultWCSMapping(input, output, nx, ny, factor, tolerance=0.0, cubic=False)", /* tp_doc */
   0,                                               /* tp_traverse */
   0,                                               /* tp_clear */
   0,                                               /* tp_richcompare */
@@ -310,7 +465,7 @@ static PyTypeObject WCSMapType = {
   0,                                               /* tp_iter */
   0,                                               /* tp_iternext */
   0,                                               /* tp_methods */
-  0,                                               /* tp_members */
+  PyWCSMap_members,                                /* tp_members */
   0,                                               /* tp_getset */
   0,                                               /* tp_base */
   0,                                               /* tp_dict */
@@ -322,6 +477,61 @@ static PyTypeObject WCSMapType = {
   PyWCSMap_new,                                    /* tp_new */
 };
 
+/*
+ Make sure the direct mapping of \a self has working copies of the WCS
+ for \a nthreads threads, and return how many threads it can serve.
+*/
+static integer_t
+PyWCSMap_reserve(PyWCSMap* self, integer_t nthreads)
+{
+  pipeline_t *input, *output;
+  struct driz_error_t error;
+
+  if (self->m.factor != 0 || self->m.nscratch == 0) {
+    return nthreads;
+  }
+
+  driz_error_init(&error);
+  nthreads = MIN(nthreads, WCSMAP_MAX_SCRATCH);
+  while (self->m.nscratch < nthreads) {
+    if (PyWCSMap_add_copies(self, &input, &output)) {
+      /* Fewer threads will do */
+      PyErr_Clear();
+      break;
+    }
+    if (wcsmap_param_add_scratch(&self->m, input, output, &error)) {
+      break;
+    }
+  }
+
+  return MIN(nthreads, self->m.nscratch);
+}
+
+/*
+ Pick the C mapping callback for a drizzle mapping object, limiting
+ the number of threads as the callback requires.
+*/
+static void
+select_mapping(PyObject *callback_obj,
+               /* Output parameters */
+               mapping_callback_t *callback, void **callback_state,
+               integer_t *nthreads)
+{
+  if (PyObject_TypeCheck(callback_obj, &WCSMapType)) {
+    /* If we're using the default mapping, we can set things up to avoid
+       the Python/C bridge */
+    *callback = default_wcsmap;
+    *callback_state = (void *)&(((PyWCSMap *)callback_obj)->m);
+    /*scale = ((PyWCSMap *)callback_obj)->m.scale; */
+    *nthreads = PyWCSMap_reserve((PyWCSMap *)callback_obj, *nthreads);
+  } else {
+    *callback = py_mapping_callback;
+    *callback_state = (void *)callback_obj;
+    /* Python callbacks are serialized on the GIL anyway */
+    *nthreads = 1;
+  }
+}
+
 static PyObject *
 tdriz(PyObject *obj UNUSED_PARAM, PyObject *args)
 {
@@ -336,9 +546,17 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args)
   char *fillstr;
   integer_t nmiss, nskip, vflag;
   PyObject *callback_obj;
+  integer_t nthreads = 1;
+  integer_t tile_size = 0;
+  integer_t accumulate = 0;
+  PyObject *ocomp = Py_None;
+  double kernel_tolerance = 0.0;
+  integer_t remove = 0;
+  integer_t gather = 0;
 
   /* Derived values */
   PyArrayObject *img = NULL, *wei = NULL, *out = NULL, *wht = NULL, *con = NULL;
+  PyArrayObject *comp = NULL;
   enum e_align_t align;
   enum e_kernel_t kernel;
   enum e_unit_t inun;
@@ -348,6 +566,7 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args)
   float fill_value;
   mapping_callback_t callback = NULL;
   void* callback_state = NULL;
+  PyThreadState *thread_state = NULL;
   int istat = 0;
   struct driz_error_t error;
   struct driz_param_t p;
@@ -358,12 +577,14 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args)
 
   driz_error_init(&error);
 
-  if (!PyArg_ParseTuple(args,"OOOOOllllldddsdssffsiiiO:tdriz",
+  if (!PyArg_ParseTuple(args,"OOOOOllllldddsdssffsiiiO|iiiOdii:tdriz",
                         &oimg, &owei, &oout, &owht, &ocon, &uniqid, &ystart,
                         &xmin, &ymin, &dny, &scale, &xscale, &yscale,
                         &align_str, &pfract, &kernel_str, &inun_str,
                         &expin, &wtscl, &fillstr, &nmiss,&nskip, &vflag,
-                        &callback_obj)) {
+                        &callback_obj, &nthreads, &tile_size,
+                        &accumulate, &ocomp, &kernel_tolerance, &remove,
+                        &gather)) {
     return PyErr_Format(gl_Error, "cdriz.tdriz: Invalid Parameters.");
   }
 
@@ -383,16 +604,7 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args)
     goto _exit;
   }
 
-  if (PyObject_TypeCheck(callback_obj, &WCSMapType)) {
-    /* If we're using the default mapping, we can set things up to avoid
-       the Python/C bridge */
-    callback = default_wcsmap;
-    callback_state = (void *)&(((PyWCSMap *)callback_obj)->m);
-    /*scale = ((PyWCSMap *)callback_obj)->m.scale; */
-  } else {
-    callback = py_mapping_callback;
-    callback_state = (void *)callback_obj;
-  }
+  select_mapping(callback_obj, &callback, &callback_state, &nthreads);
 
   /* Get raw C-array data */
   img = (PyArrayObject *)PyArray_ContiguousFromAny(oimg, NPY_FLOAT32, 2, 2);
@@ -401,28 +613,54 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args)
     goto _exit;
   }
 
-  wei = (PyArrayObject *)PyArray_ContiguousFromAny(owei, NPY_FLOAT32, 2, 2);
-  if (!wei) {
-    driz_error_set_message(&error, "Invalid weights array");
-    goto _exit;
+  /* No weights: every input pixel weighs 1 */
+  if (owei != Py_None) {
+    wei = (PyArrayObject *)PyArray_ContiguousFromAny(owei, NPY_FLOAT32, 2, 2);
+    if (!wei) {
+      driz_error_set_message(&error, "Invalid weights array");
+      goto _exit;
+    }
   }
 
-  out = (PyArrayObject *)PyArray_ContiguousFromAny(oout, NPY_FLOAT32, 2, 2);
-  if (!out) {
-    driz_error_set_message(&error, "Invalid output array");
-    goto _exit;
-  }
+  if (PyArray_Check(oout) &&
+      PyDataType_HASFIELDS(PyArray_DESCR((PyArrayObject *)oout))) {
+    /* Data, weight and context interleaved in one array: it is
+       written in place, so it cannot be converted */
+    if (!is_interleaved_output((PyArrayObject *)oout)) {
+      driz_error_set_message(&error, "Invalid interleaved output array");
+      goto _exit;
+    }
+    out = (PyArrayObject *)oout;
+    Py_INCREF(out);
+  } else {
+    out = (PyArrayObject *)PyArray_ContiguousFromAny(oout, NPY_FLOAT32, 2, 2);
+    if (!out) {
+      driz_error_set_message(&error, "Invalid output array");
+      goto _exit;
+    }
 
-  wht = (PyArrayObject *)PyArray_ContiguousFromAny(owht, NPY_FLOAT32, 2, 2);
-  if (!wht) {
-    driz_error_set_message(&error, "Invalid array");
-    goto _exit;
-  }
+    wht = (PyArrayObject *)PyArray_ContiguousFromAny(owht, NPY_FLOAT32, 2, 2);
+    if (!wht) {
+      driz_error_set_message(&error, "Invalid array");
+      goto _exit;
+    }
 
-  con = (PyArrayObject *)PyArray_ContiguousFromAny(ocon, NPY_INT32, 2, 2);
-  if (!con) {
-    driz_error_set_message(&error, "Invalid context array");
-    goto _exit;
+    /* Either a single context plane or the whole [nplanes][ony][onx]
+       cube, in which this image's plane is picked by dobox.  None
+       leaves out the context. */
+    if (ocon != Py_None) {
+      con = (PyArrayObject *)PyArray_ContiguousFromAny(ocon, NPY_INT32, 2, 3);
+      if (!con) {
+        driz_error_set_message(&error, "Invalid context array");
+        goto _exit;
+      }
+    }
+    if (con != NULL && PyArray_NDIM(con) == 3 &&
+        (PyArray_DIMS(con)[1] != PyArray_DIMS(out)[0] ||
+         PyArray_DIMS(con)[2] != PyArray_DIMS(out)[1])) {
+      driz_error_set_message(&error, "Context planes do not match the output");
+      goto _exit;
+    }
   }
 
   /* Convert strings to enumerations */
@@ -469,10 +707,19 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args)
   driz_param_init(&p);
 
   p.data = PyArray_DATA(img);
-  p.weights = PyArray_DATA(wei);
-  p.output_data = PyArray_DATA(out);
-  p.output_counts = PyArray_DATA(wht);
-  p.output_context = PyArray_DATA(con);
+  p.weights = (wei != NULL) ? PyArray_DATA(wei) : NULL;
+  if (wht == NULL) {
+    driz_param_set_interleaved_output(&p, PyArray_DATA(out));
+  } else {
+    p.output_data = PyArray_DATA(out);
+    p.output_counts = PyArray_DATA(wht);
+    if (con != NULL) {
+      p.output_context = PyArray_DATA(con);
+      if (PyArray_NDIM(con) == 3) {
+        p.context_planes = PyArray_DIMS(con)[0];
+      }
+    }
+  }
   p.uuid = uniqid;
   p.xmin = xmin;
   p.ymin = ymin;
@@ -492,6 +739,27 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args)
   p.weight_scale = wtscl;
   p.mapping_callback = callback;
   p.mapping_callback_state = callback_state;
+  p.nthreads = MAX(nthreads, 1);
+  p.tile_size = MAX(tile_size, 0);
+  p.accumulate = (bool_t)(accumulate != 0);
+  p.gaussian.tolerance = MAX(kernel_tolerance, 0.0);
+  p.remove = (bool_t)(remove != 0);
+  p.gather = (bool_t)(gather != 0);
+
+  if (ocomp != Py_None) {
+    if (!p.accumulate) {
+      driz_error_set_message(&error, "Compensated sums need accumulate");
+      goto _exit;
+    }
+    if (!PyArray_Check(ocomp) ||
+        !is_compensation_array((PyArrayObject *)ocomp, ony, onx)) {
+      driz_error_set_message(&error, "Invalid compensation array");
+      goto _exit;
+    }
+    comp = (PyArrayObject *)ocomp;
+    Py_INCREF(comp);
+    p.output_compensation = PyArray_DATA(comp);
+  }
 
   /* Setup reasonable defaults for drizzling */
   p.no_over = FALSE;
@@ -499,10 +767,11 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args)
   /*
   start_t = clock();
   */
-  /* Do the drizzling */
-  if (dobox(&p, ystart, &nmiss, &nskip, &error)) {
-    goto _exit;
-  }
+  /* Do the drizzling.  The arrays are owned by the references taken
+     above, so other Python threads may run in the meantime. */
+  thread_state = PyEval_SaveThread();
+
+  istat = dobox(&p, ystart, &nmiss, &nskip, &error);
   /*
   end_t = clock();
   delta_time = difftime(end_t, start_t)/1e+6;
@@ -511,9 +780,13 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args)
   start_t = clock();
   */
   /* Put in the fill values (if defined) */
-  if (do_fill) {
+  if (!istat && do_fill) {
     put_fill(&p, fill_value);
   }
+
+  if (thread_state != NULL) {
+    PyEval_RestoreThread(thread_state);
+  }
   /*
   if (callback == default_wcsmap){
     m = (struct wcsmap_param_t *)p.mapping_callback_state;
@@ -527,6 +800,7 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args)
   Py_XDECREF(wei);
   Py_XDECREF(out);
   Py_XDECREF(wht);
+  Py_XDECREF(comp);
 
   if (istat || driz_error_is_set(&error)) {
     if (strcmp(driz_error_get_message(&error), "<PYTHON>") != 0)
@@ -622,6 +896,637 @@ twdriz(PyObject *obj, PyObject *args)
 }*/
 
 
+/*
+ Turn an output accumulated by tdriz(..., accumulate=1) into the
+ weighted mean image, in place or into result.  output and outweight
+ are as passed to tdriz.
+*/
+static PyObject *
+tnormalize(PyObject *obj UNUSED_PARAM, PyObject *args)
+{
+  PyObject *oout, *owht, *oresult = Py_None, *ocomp = Py_None;
+  PyArrayObject *out = NULL, *wht = NULL, *result = NULL, *comp = NULL;
+  struct driz_error_t error;
+  struct driz_param_t p;
+
+  driz_error_init(&error);
+
+  if (!PyArg_ParseTuple(args, "OO|OO:tnormalize", &oout, &owht, &oresult,
+                        &ocomp)) {
+    return PyErr_Format(gl_Error, "cdriz.tnormalize: Invalid Parameters.");
+  }
+
+  driz_param_init(&p);
+
+  /* The sums are rewritten in place, so none of these may be copies */
+  if (!PyArray_Check(oout)) {
+    driz_error_set_message(&error, "Invalid output array");
+    goto _exit;
+  }
+  out = (PyArrayObject *)oout;
+  Py_INCREF(out);
+
+  if (PyDataType_HASFIELDS(PyArray_DESCR(out))) {
+    if (!is_interleaved_output(out)) {
+      driz_error_set_message(&error, "Invalid interleaved output array");
+      goto _exit;
+    }
+    driz_param_set_interleaved_output(&p, PyArray_DATA(out));
+  } else {
+    wht = (PyArrayObject *)PyArray_ContiguousFromAny(owht, NPY_FLOAT32, 2, 2);
+    if (!wht) {
+      driz_error_set_message(&error, "Invalid array");
+      goto _exit;
+    }
+    if (PyArray_TYPE(out) != NPY_FLOAT32 || PyArray_NDIM(out) != 2 ||
+        !PyArray_IS_C_CONTIGUOUS(out) || !PyArray_ISWRITEABLE(out) ||
+        !PyArray_SAMESHAPE(out, wht)) {
+      driz_error_set_message(&error, "Invalid output array");
+      goto _exit;
+    }
+    p.output_data = PyArray_DATA(out);
+    p.output_counts = PyArray_DATA(wht);
+  }
+  p.onx = PyArray_DIMS(out)[1];
+  p.ony = PyArray_DIMS(out)[0];
+
+  if (oresult != Py_None) {
+    if (!PyArray_Check(oresult)) {
+      driz_error_set_message(&error, "Invalid result array");
+      goto _exit;
+    }
+    result = (PyArrayObject *)oresult;
+    Py_INCREF(result);
+    if (PyArray_TYPE(result) != NPY_FLOAT32 || PyArray_NDIM(result) != 2 ||
+        !PyArray_IS_C_CONTIGUOUS(result) || !PyArray_ISWRITEABLE(result) ||
+        PyArray_DIMS(result)[0] != p.ony || PyArray_DIMS(result)[1] != p.onx) {
+      driz_error_set_message(&error, "Invalid result array");
+      goto _exit;
+    }
+  }
+
+  if (ocomp != Py_None) {
+    if (!PyArray_Check(ocomp) ||
+        !is_compensation_array((PyArrayObject *)ocomp, p.ony, p.onx)) {
+      driz_error_set_message(&error, "Invalid compensation array");
+      goto _exit;
+    }
+    comp = (PyArrayObject *)ocomp;
+    Py_INCREF(comp);
+    p.output_compensation = PyArray_DATA(comp);
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  normalize_output(&p, result ? PyArray_DATA(result) : NULL);
+  Py_END_ALLOW_THREADS
+
+ _exit:
+  Py_XDECREF(out);
+  Py_XDECREF(wht);
+  Py_XDECREF(result);
+  Py_XDECREF(comp);
+
+  if (driz_error_is_set(&error)) {
+    PyErr_SetString(PyExc_Exception, driz_error_get_message(&error));
+    return NULL;
+  }
+
+  Py_RETURN_NONE;
+}
+
+/**
+
+A drizzle output kept set up from one input to the next.
+
+Drizzling thousands of small inputs onto one output through tdriz
+checks and converts the output arrays and sets up the line buffers and
+kernel tables for each of them.  A Drizzler holds on to the output
+arrays, which it updates in place, and to a dobox workspace, so that
+add_image only has the input to deal with.
+
+With context_table set, the context image holds, for each output
+pixel, the number of its context -- the set of inputs drizzled onto it
+-- in a table that the Drizzler keeps, rather than a bit per input.
+There is then no limit on the number of inputs.
+
+*/
+typedef struct {
+  PyObject_HEAD
+  struct driz_param_t p;
+  struct dobox_workspace_t workspace;
+  PyArrayObject* output;
+  PyArrayObject* outweight;
+  PyArrayObject* context;
+  PyArrayObject* compensation;
+  int nimages;
+  /* Set while add_image runs without the GIL */
+  int busy;
+  /* The contexts the context image refers to, with context_table */
+  struct context_table_t table;
+} PyDrizzler;
+
+static void
+PyDrizzler_dealloc(PyDrizzler* self)
+{
+  Py_XDECREF(self->output);       self->output = NULL;
+  Py_XDECREF(self->outweight);    self->outweight = NULL;
+  Py_XDECREF(self->context);      self->context = NULL;
+  Py_XDECREF(self->compensation); self->compensation = NULL;
+  dobox_workspace_free(&self->workspace);
+  context_table_free(&self->table);
+
+  Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject *
+PyDrizzler_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+  PyDrizzler *self;
+
+  self = (PyDrizzler *)type->tp_alloc(type, 0);
+  if (self != NULL) {
+    self->output = NULL;
+    self->outweight = NULL;
+    self->context = NULL;
+    self->compensation = NULL;
+    self->nimages = 0;
+    self->busy = 0;
+    driz_param_init(&self->p);
+    dobox_workspace_init(&self->workspace);
+    memset(&self->table, 0, sizeof(self->table));
+  }
+
+  return (PyObject *)self;
+}
+
+/* An array the results can be written to in place */
+static int
+is_output_array(PyObject *obj, int type, npy_intp ony, npy_intp onx)
+{
+  PyArrayObject *arr = (PyArrayObject *)obj;
+
+  return (PyArray_Check(obj) &&
+          PyArray_TYPE(arr) == type &&
+          PyArray_NDIM(arr) == 2 &&
+          PyArray_DIMS(arr)[0] == ony &&
+          PyArray_DIMS(arr)[1] == onx &&
+          PyArray_IS_C_CONTIGUOUS(arr) &&
+          PyArray_ISWRITEABLE(arr));
+}
+
+/* A context array with nothing drizzled onto it yet */
+static int
+is_empty_context(PyArrayObject *arr)
+{
+  const integer_t *con = PyArray_DATA(arr);
+  const npy_intp n = PyArray_SIZE(arr);
+  npy_intp i;
+
+  for (i = 0; i < n; ++i) {
+    if (con[i] != 0) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static int
+PyDrizzler_init(PyDrizzler *self, PyObject *args, PyObject *kwds)
+{
+  static char *kwlist[] = {"output", "outweight", "context", "kernel",
+                           "pixfrac", "accumulate", "compensation",
+                           "nthreads", "tile_size", "kernel_tolerance",
+                           "gather", "context_table", NULL};
+  PyObject *oout, *owht = Py_None, *ocon = Py_None, *ocomp = Py_None;
+  char *kernel_str = "square";
+  double pfract = 1.0;
+  int accumulate = 0;
+  integer_t nthreads = 1;
+  integer_t tile_size = 0;
+  double kernel_tolerance = 0.0;
+  int gather = 0;
+  int context_table = 0;
+  PyArrayObject *out;
+  npy_intp onx, ony;
+  struct driz_param_t* p = &self->p;
+  struct driz_error_t error;
+
+  driz_error_init(&error);
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OOsdiOiidii:Drizzler",
+                                   kwlist, &oout, &owht, &ocon, &kernel_str,
+                                   &pfract, &accumulate, &ocomp, &nthreads,
+                                   &tile_size, &kernel_tolerance, &gather,
+                                   &context_table)) {
+    return -1;
+  }
+
+  if (self->busy) {
+    PyErr_SetString(PyExc_RuntimeError, "Drizzler is in use");
+    return -1;
+  }
+
+  /* Start again from scratch if __init__ is called more than once */
+  Py_CLEAR(self->output);
+  Py_CLEAR(self->outweight);
+  Py_CLEAR(self->context);
+  Py_CLEAR(self->compensation);
+  self->nimages = 0;
+  context_table_free(&self->table);
+  driz_param_init(p);
+  p->workspace = &self->workspace;
+
+  if (pfract < 0.0) {
+    driz_error_format_message(&error, "Invalid pixfrac %f (must be greater than or equal to 0.0)", pfract);
+    goto _exit;
+  }
+
+  if (kernel_str2enum(kernel_str, &p->kernel, &error)) {
+    goto _exit;
+  }
+  if (pfract <= 0.001) {
+    p->kernel = kernel_point;
+  }
+
+  /* The sums are updated in place by every add_image, so none of
+     these may be copies */
+  if (!PyArray_Check(oout)) {
+    driz_error_set_message(&error, "Invalid output array");
+    goto _exit;
+  }
+  out = (PyArrayObject *)oout;
+  if (PyArray_NDIM(out) != 2) {
+    driz_error_set_message(&error, "Invalid output array");
+    goto _exit;
+  }
+  onx = PyArray_DIMS(out)[1];
+  ony = PyArray_DIMS(out)[0];
+
+  if (PyDataType_HASFIELDS(PyArray_DESCR(out))) {
+    if (!is_interleaved_output(out) || owht != Py_None || ocon != Py_None) {
+      driz_error_set_message(&error, "Invalid interleaved output array");
+      goto _exit;
+    }
+    driz_param_set_interleaved_output(p, PyArray_DATA(out));
+  } else {
+    if (!is_output_array(oout, NPY_FLOAT32, ony, onx)) {
+      driz_error_set_message(&error, "Invalid output array");
+      goto _exit;
+    }
+    if (!is_output_array(owht, NPY_FLOAT32, ony, onx)) {
+      driz_error_set_message(&error, "Invalid weight array");
+      goto _exit;
+    }
+    p->output_data = PyArray_DATA(out);
+    p->output_counts = PyArray_DATA((PyArrayObject *)owht);
+    Py_INCREF(owht);
+    self->outweight = (PyArrayObject *)owht;
+
+    /* As for tdriz: a single context plane, or the whole cube of them */
+    if (ocon != Py_None) {
+      if (PyArray_Check(ocon) &&
+          PyArray_NDIM((PyArrayObject *)ocon) == 3 &&
+          PyArray_TYPE((PyArrayObject *)ocon) == NPY_INT32 &&
+          PyArray_DIMS((PyArrayObject *)ocon)[1] == ony &&
+          PyArray_DIMS((PyArrayObject *)ocon)[2] == onx &&
+          PyArray_IS_C_CONTIGUOUS((PyArrayObject *)ocon) &&
+          PyArray_ISWRITEABLE((PyArrayObject *)ocon)) {
+        p->context_planes = PyArray_DIMS((PyArrayObject *)ocon)[0];
+      } else if (!is_output_array(ocon, NPY_INT32, ony, onx)) {
+        driz_error_set_message(&error, "Invalid context array");
+        goto _exit;
+      }
+      p->output_context = PyArray_DATA((PyArrayObject *)ocon);
+      Py_INCREF(ocon);
+      self->context = (PyArrayObject *)ocon;
+    }
+  }
+  Py_INCREF(out);
+  self->output = out;
+
+  if (ocomp != Py_None) {
+    if (!accumulate) {
+      driz_error_set_message(&error, "Compensated sums need accumulate");
+      goto _exit;
+    }
+    if (!PyArray_Check(ocomp) ||
+        !is_compensation_array((PyArrayObject *)ocomp, ony, onx)) {
+      driz_error_set_message(&error, "Invalid compensation array");
+      goto _exit;
+    }
+    p->output_compensation = PyArray_DATA((PyArrayObject *)ocomp);
+    Py_INCREF(ocomp);
+    self->compensation = (PyArrayObject *)ocomp;
+  }
+
+  if (context_table) {
+    /* The indices all start out at the empty context */
+    if (self->context == NULL || p->context_planes > 0 ||
+        !is_empty_context(self->context)) {
+      driz_error_set_message(&error, "A context table needs an empty 2-D context array");
+      goto _exit;
+    }
+    if (context_table_init(&self->table, &error)) {
+      goto _exit;
+    }
+    p->context_table = &self->table;
+  }
+
+  p->onx = (integer_t)onx;
+  p->ony = (integer_t)ony;
+  p->xmin = p->ymin = 1;
+  p->xmax = p->onx;
+  p->ymax = p->ony;
+  p->pixel_fraction = pfract;
+  p->nthreads = MAX(nthreads, 1);
+  p->tile_size = MAX(tile_size, 0);
+  p->accumulate = (bool_t)(accumulate != 0);
+  p->gaussian.tolerance = MAX(kernel_tolerance, 0.0);
+  p->gather = (bool_t)(gather != 0);
+
+ _exit:
+  if (driz_error_is_set(&error)) {
+    Py_CLEAR(self->output);
+    Py_CLEAR(self->outweight);
+    Py_CLEAR(self->context);
+    Py_CLEAR(self->compensation);
+    context_table_free(&self->table);
+    driz_param_init(p);
+    PyErr_SetString(PyExc_Exception, driz_error_get_message(&error));
+    return -1;
+  }
+
+  return 0;
+}
+
+static PyObject *
+PyDrizzler_add_image(PyDrizzler *self, PyObject *args, PyObject *kwds)
+{
+  static char *kwlist[] = {"image", "weight", "mapping", "uniqid", "expin",
+                           "wtscl", "in_units", "scale", "xmin", "ymin",
+                           "ystart", "dny", "remove", NULL};
+  PyObject *oimg, *owei, *callback_obj;
+  long uniqid = 0, xmin = 1, ymin = 1, ystart = 0, dny = 0;
+  float expin = 1.0, wtscl = 1.0;
+  char *inun_str = "cps";
+  double scale = 1.0;
+  int remove = 0;
+  PyArrayObject *img = NULL, *wei = NULL;
+  integer_t nmiss = 0, nskip = 0;
+  PyThreadState *thread_state = NULL;
+  struct driz_error_t error;
+  struct driz_param_t p;
+
+  driz_error_init(&error);
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOO|lffsdllllp:add_image",
+                                   kwlist, &oimg, &owei, &callback_obj,
+                                   &uniqid, &expin, &wtscl, &inun_str,
+                                   &scale, &xmin, &ymin, &ystart, &dny,
+                                   &remove)) {
+    return NULL;
+  }
+
+  if (self->output == NULL) {
+    PyErr_SetString(PyExc_RuntimeError, "Drizzler is not set up");
+    return NULL;
+  }
+  if (self->busy) {
+    PyErr_SetString(PyExc_RuntimeError, "Drizzler is in use");
+    return NULL;
+  }
+
+  if (scale == 0.0) {
+    driz_error_format_message(&error, "Invalid scale %f (must be non-zero)", scale);
+    goto _exit;
+  }
+
+  if (expin <= 0.0) {
+    driz_error_format_message(&error, "Invalid expin %f (must be greater than 0.0)", expin);
+    goto _exit;
+  }
+
+  /* Only what changes from one input to the next is set up here */
+  p = self->p;
+
+  select_mapping(callback_obj, &p.mapping_callback,
+                 &p.mapping_callback_state, &p.nthreads);
+
+  if (unit_str2enum(inun_str, &p.in_units, &error)) {
+    goto _exit;
+  }
+
+  img = (PyArrayObject *)PyArray_ContiguousFromAny(oimg, NPY_FLOAT32, 2, 2);
+  if (!img) {
+    driz_error_set_message(&error, "Invalid input array");
+    goto _exit;
+  }
+
+  if (owei != Py_None) {
+    wei = (PyArrayObject *)PyArray_ContiguousFromAny(owei, NPY_FLOAT32, 2, 2);
+    if (!wei || !PyArray_SAMESHAPE(img, wei)) {
+      driz_error_set_message(&error, "Invalid weights array");
+      goto _exit;
+    }
+  }
+
+  /* Number the inputs 1, 2, ... unless told otherwise */
+  p.uuid = (uniqid > 0) ? uniqid : self->nimages + 1;
+  p.data = PyArray_DATA(img);
+  p.weights = (wei != NULL) ? PyArray_DATA(wei) : NULL;
+  p.dnx = PyArray_DIMS(img)[1];
+  p.dny = PyArray_DIMS(img)[0];
+  p.ny = (dny > 0) ? dny : p.dny;
+  p.xmin = xmin;
+  p.ymin = ymin;
+  p.scale = scale;
+  p.exposure_time = expin;
+  p.weight_scale = wtscl;
+  p.no_over = FALSE;
+  p.remove = (bool_t)(remove != 0);
+
+  self->busy = 1;
+  thread_state = PyEval_SaveThread();
+
+  dobox(&p, ystart, &nmiss, &nskip, &error);
+
+  if (thread_state != NULL) {
+    PyEval_RestoreThread(thread_state);
+  }
+  self->busy = 0;
+
+  if (!driz_error_is_set(&error) && !p.remove) {
+    self->nimages = MAX(self->nimages, p.uuid);
+  }
+
+ _exit:
+  Py_XDECREF(img);
+  Py_XDECREF(wei);
+
+  if (driz_error_is_set(&error)) {
+    if (strcmp(driz_error_get_message(&error), "<PYTHON>") != 0)
+      PyErr_SetString(PyExc_Exception, driz_error_get_message(&error));
+    return NULL;
+  }
+
+  return Py_BuildValue("ii", nmiss, nskip);
+}
+
+static PyObject *
+PyDrizzler_context_images(PyDrizzler *self, PyObject *args)
+{
+  integer_t context, n, i;
+  const integer_t* images;
+  PyObject *result;
+
+  if (!PyArg_ParseTuple(args, "i:context_images", &context)) {
+    return NULL;
+  }
+
+  if (self->p.context_table == NULL || self->busy) {
+    PyErr_SetString(PyExc_RuntimeError, "Drizzler has no context table");
+    return NULL;
+  }
+  if (context < 0 || context >= self->table.ncontexts) {
+    PyErr_Format(PyExc_IndexError, "No context %d", (int)context);
+    return NULL;
+  }
+
+  images = context_table_images(&self->table, context, &n);
+  if ((result = PyTuple_New(n)) == NULL) {
+    return NULL;
+  }
+  for (i = 0; i < n; ++i) {
+    PyTuple_SET_ITEM(result, i, PyLong_FromLong((long)images[i]));
+  }
+
+  return result;
+}
+
+static PyObject *
+PyDrizzler_fill(PyDrizzler *self, PyObject *args)
+{
+  float fill_value;
+
+  if (!PyArg_ParseTuple(args, "f:fill", &fill_value)) {
+    return NULL;
+  }
+
+  if (self->output == NULL || self->busy) {
+    PyErr_SetString(PyExc_RuntimeError, "Drizzler is not ready");
+    return NULL;
+  }
+
+  put_fill(&self->p, fill_value);
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+PyDrizzler_normalize(PyDrizzler *self, PyObject *args)
+{
+  PyObject *oresult = Py_None;
+  float *result = NULL;
+
+  if (!PyArg_ParseTuple(args, "|O:normalize", &oresult)) {
+    return NULL;
+  }
+
+  if (self->output == NULL || self->busy) {
+    PyErr_SetString(PyExc_RuntimeError, "Drizzler is not ready");
+    return NULL;
+  }
+
+  if (!self->p.accumulate) {
+    PyErr_SetString(PyExc_Exception, "Only accumulated sums need normalizing");
+    return NULL;
+  }
+
+  if (oresult != Py_None) {
+    if (!is_output_array(oresult, NPY_FLOAT32, self->p.ony, self->p.onx)) {
+      PyErr_SetString(PyExc_Exception, "Invalid result array");
+      return NULL;
+    }
+    result = PyArray_DATA((PyArrayObject *)oresult);
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  normalize_output(&self->p, result);
+  Py_END_ALLOW_THREADS
+
+  Py_RETURN_NONE;
+}
+
+static PyMethodDef PyDrizzler_methods[] = {
+  {"add_image", (PyCFunction)PyDrizzler_add_image, METH_VARARGS | METH_KEYWORDS,
+   "add_image(image, weight, mapping, uniqid=0, expin=1.0, wtscl=1.0, in_units='cps', scale=1.0, xmin=1, ymin=1, ystart=0, dny=0, remove=False) -> (nmiss, nskip)\n\n"
+   "Drizzle an input onto the output.  uniqid=0 numbers it one above the\n"
+   "highest so far, dny=0 drizzles all of its lines.  With remove, an\n"
+   "input added before with the same arguments is taken out of the\n"
+   "accumulated sums instead; that needs a context, and compensation\n"
+   "for the Lanczos kernels."},
+  {"context_images", (PyCFunction)PyDrizzler_context_images, METH_VARARGS,
+   "context_images(index)\n\nThe inputs (uniqid) drizzled onto the output pixels whose\n"
+   "context holds index, in order, with context_table set."},
+  {"fill", (PyCFunction)PyDrizzler_fill, METH_VARARGS,
+   "fill(value)\n\nSet the output pixels that nothing has been drizzled onto."},
+  {"normalize", (PyCFunction)PyDrizzler_normalize, METH_VARARGS,
+   "normalize(result=None)\n\nAs tnormalize, for accumulated sums."},
+  {NULL, NULL, 0, NULL}  /* sentinel */
+};
+
+static PyMemberDef PyDrizzler_members[] = {
+  {"output", T_OBJECT, offsetof(PyDrizzler, output), READONLY, "Output data"},
+  {"outweight", T_OBJECT, offsetof(PyDrizzler, outweight), READONLY, "Output weights"},
+  {"context", T_OBJECT, offsetof(PyDrizzler, context), READONLY, "Output context"},
+  {"compensation", T_OBJECT, offsetof(PyDrizzler, compensation), READONLY, "Compensated summation error terms"},
+  {"nimages", T_INT, offsetof(PyDrizzler, nimages), READONLY, "Highest input number so far"},
+  {"ncontexts", T_INT, offsetof(PyDrizzler, table.ncontexts), READONLY, "Number of contexts in the context table, the empty one included"},
+  {NULL, 0, 0, 0, NULL}  /* sentinel */
+};
+
+static PyTypeObject DrizzlerType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  (char *) "cdriz.Drizzler",                       /*tp_name*/
+  sizeof(PyDrizzler),                              /*tp_basicsize*/
+  0,                                               /*tp_itemsize*/
+  (destructor) PyDrizzler_dealloc,                 /*tp_dealloc*/
+  0,                                               /*tp_print*/
+  0,                                               /*tp_getattr*/
+  0,                                               /*tp_setattr*/
+  0,                                               /*tp_compare*/
+  0,                                               /*tp_repr*/
+  0,                                               /*tp_as_number*/
+  0,                                               /*tp_as_sequence*/
+  0,                                               /*tp_as_mapping*/
+  0,                                               /*tp_hash */
+  0,                                               /*tp_call*/
+  0,                                               /*tp_str*/
+  0,                                               /*tp_getattro*/
+  0,                                               /*tp_setattro*/
+  0,                                               /*tp_as_buffer*/
+  (long) Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /*tp_flags*/
+  (char *) "Drizzler(output, outweight=None, context=None, kernel='square', pixfrac=1.0, accumulate=False, compensation=None, nthreads=1, tile_size=0, kernel_tolerance=0.0, gather=False, context_table=False)", /* tp_doc */
+  0,                                               /* tp_traverse */
+  0,                                               /* tp_clear */
+  0,                                               /* tp_richcompare */
+  0,                                               /* tp_weaklistoffset */
+  0,                                               /* tp_iter */
+  0,                                               /* tp_iternext */
+  PyDrizzler_methods,                              /* tp_methods */
+  PyDrizzler_members,                              /* tp_members */
+  0,                                               /* tp_getset */
+  0,                                               /* tp_base */
+  0,                                               /* tp_dict */
+  0,                                               /* tp_descr_get */
+  0,                                               /* tp_descr_set */
+  0,                                               /* tp_dictoffset */
+  (initproc)PyDrizzler_init,                       /* tp_init */
+  0,                                               /* tp_alloc */
+  PyDrizzler_new,                                  /* tp_new */
+};
+
 static PyObject *
 tblot(PyObject *obj, PyObject *args)
 {
@@ -715,7 +1620,11 @@ tblot(PyObject *obj, PyObject *args)
   p.mapping_callback = callback;
   p.mapping_callback_state = callback_state;
 
+  /* The mapping is always a Python callback here, which takes the GIL
+     back for itself */
+  Py_BEGIN_ALLOW_THREADS
   istat = doblot(&p, &error);
+  Py_END_ALLOW_THREADS
 
  _exit:
   Py_DECREF(img);
@@ -731,24 +1640,20 @@ tblot(PyObject *obj, PyObject *args)
 }
 
 
-/* To replace the default prinf log; instead log to a pythonic log */
+/* To replace the default prinf log; instead log to a pythonic log.
+   The core may call this with the GIL released, so take it here. */
 void cdriz_log_func(const char *format, ...) {
   static PyObject *logging = NULL;
   va_list args;
+  PyGILState_STATE gstate;
   PyObject *logger;
   PyObject *string;
+  PyObject *result;
   char msg[256];
   int n;
 
   va_start(args, format);
-
-  if (logging == NULL) {
-    logging = PyImport_ImportModuleNoBlock("logging");
-    if (logging == NULL) return;
-  }
-
   n = PyOS_vsnprintf(msg, sizeof(msg), format, args);
-
   va_end(args);
 
   if (n < 0) {
@@ -756,21 +1661,32 @@ void cdriz_log_func(const char *format, ...) {
     return;
   }
 
+  gstate = PyGILState_Ensure();
+
+  if (logging == NULL) {
+    logging = PyImport_ImportModuleNoBlock("logging");
+    if (logging == NULL) goto _cdriz_log_func_exit;
+  }
+
   /* XXX: Provide a way to specify the log level to use */
   string = Py_BuildValue("s", msg);
-  if (string == NULL) return;
+  if (string == NULL) goto _cdriz_log_func_exit;
 
   logger = PyObject_CallMethod(logging, "getLogger", "s",
                                "drizzlepac.cdriz");
   if (logger == NULL) {
       Py_XDECREF(string);
-      return;
+      goto _cdriz_log_func_exit;
   }
 
-  PyObject_CallMethod(logger, "info", "O", string);
+  result = PyObject_CallMethod(logger, "info", "O", string);
 
+  Py_XDECREF(result);
   Py_XDECREF(logger);
   Py_XDECREF(string);
+
+ _cdriz_log_func_exit:
+  PyGILState_Release(gstate);
   return;
 }
 
@@ -1164,9 +2080,43 @@ arrxyzero(PyObject *obj, PyObject *args)
   return PyArray_Return(ozpmat);
 }
 
+/*
+ Choose the x86 vector code, to test the versions against each other.
+*/
+static PyObject *
+use_simd(PyObject *obj UNUSED_PARAM, PyObject *args)
+{
+  PyObject *level_obj = NULL;
+  const char *level_str = NULL;
+  enum e_simd_t level;
+  struct driz_error_t error;
+
+  if (!PyArg_ParseTuple(args, "O:use_simd", &level_obj)) {
+    return NULL;
+  }
+
+  driz_error_init(&error);
+  if (PyBool_Check(level_obj)) {
+    level = (level_obj == Py_True) ? simd_avx512 : simd_scalar;
+  } else {
+    if (!PyArg_Parse(level_obj, "s", &level_str)) {
+      return NULL;
+    }
+    if (simd_str2enum(level_str, &level, &error)) {
+      PyErr_SetString(PyExc_ValueError, driz_error_get_message(&error));
+      return NULL;
+    }
+  }
+
+  wcsmap_use_simd(level);
+  return Py_BuildValue("s", simd_enum2str(boxer_use_simd(level)));
+}
+
 static PyMethodDef cdriz_methods[] =
   {
-    {"tdriz",  tdriz, METH_VARARGS, "tdriz(image, weight, output, outweight, context, uniqid, ystart, xmin, ymin, dny, scale, xscale, yscale, align, pfrace, kernel, inun, expin, wtscl, fill, nmiss, nskip, vflag, callback)"},
+    {"tdriz",  tdriz, METH_VARARGS, "tdriz(image, weight, output, outweight, context, uniqid, ystart, xmin, ymin, dny, scale, xscale, yscale, align, pfrace, kernel, inun, expin, wtscl, fill, nmiss, nskip, vflag, callback, nthreads=1, tile_size=0, accumulate=0, compensation=None, kernel_tolerance=0.0, remove=0, gather=0)"},
+    {"tnormalize",  tnormalize, METH_VARARGS, "tnormalize(output, outweight, result=None, compensation=None)"},
+    {"use_simd",  use_simd, METH_VARARGS, "use_simd(level)\n\nUse the x86 vector code up to level ('scalar', 'avx2' or 'avx512'; True for the best there is, the default, and False for 'scalar') where the CPU supports it.  Returns the version of the square kernel overlaps now used.  For testing the versions against each other; not while drizzling."},
     /*{"twdriz",  tdriz, METH_VARARGS, "triz(image, weight, output, outweight, ystart, xmin, ymin, dny, wcsin, wcsout,pxg,pyg,pfract, kernel, coeffs, fillstr,nmiss,nskip,vflag)"},*/
     {"tblot",  tblot, METH_VARARGS, "tblot(image, output, xmin, xmax, ymin, ymax, scale, kscale, xscale, yscale, align, interp, ef, misval, sinscl, vflag, callback)"},
     {"arrmoments", arrmoments, METH_VARARGS, "arrmoments(image, p, q)"},
@@ -1199,7 +2149,7 @@ void initcdriz(void)
   driz_log_func = &cdriz_log_func;
 
 #if PY_MAJOR_VERSION >= 3
-  if (PyType_Ready(&WCSMapType) < 0) {
+  if (PyType_Ready(&WCSMapType) < 0 || PyType_Ready(&DrizzlerType) < 0) {
     return NULL;
   }
   m = PyModule_Create(&moduledef);
@@ -1208,7 +2158,7 @@ void initcdriz(void)
   }
 
 #else
-  if (PyType_Ready(&WCSMapType) < 0)
+  if (PyType_Ready(&WCSMapType) < 0 || PyType_Ready(&DrizzlerType) < 0)
     return;
   m = Py_InitModule("cdriz", cdriz_methods);
   if (m == NULL)
@@ -1220,6 +2170,8 @@ void initcdriz(void)
 
   Py_INCREF(&WCSMapType);
   PyModule_AddObject(m, "DefaultWCSMapping", (PyObject *)&WCSMapType);
+  Py_INCREF(&DrizzlerType);
+  PyModule_AddObject(m, "Drizzler", (PyObject *)&DrizzlerType);
 
 #if PY_MAJOR_VERSION >= 3
   return m;
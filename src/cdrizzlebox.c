@@ -4,16 +4,20 @@
 #include "driz_portability.h"
 #include "cdrizzlemap.h"
 #include "cdrizzlebox.h"
+#include "cdrizzlecontext.h"
+#include "cdrizzleoverlap.h"
 #include "cdrizzlewcs.h"
 #include "cdrizzleutil.h"
 
 #include <assert.h>
+#include <float.h>
 #define _USE_MATH_DEFINES       /* needed for MS Windows to define M_PI */
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-static inline_macro double*
+static force_inline_macro double*
 mapping_4_ptr(struct driz_param_t* p, double* arr, integer_t i0, integer_t i1) {
   assert(p);
   assert(arr);
@@ -22,7 +26,7 @@ mapping_4_ptr(struct driz_param_t* p, double* arr, integer_t i0, integer_t i1) {
   return (arr + ((i1 * p->dnx) + i0));
 }
 
-static inline_macro double*
+static force_inline_macro double*
 mapping_ptr(struct driz_param_t* p, double* arr, integer_t i0) {
   assert(p);
   assert(arr);
@@ -31,160 +35,142 @@ mapping_ptr(struct driz_param_t* p, double* arr, integer_t i0) {
 }
 
 /**
-Check how much of a line will overlap an output image, if any,
-after applying the standard drizzle transformation.
-
-This is intended to allow the number of points which are needlessly
-drizzled outside the output image to be minimized.
-
-was: CHOVER
+Find which pixels of each input line [j0, j1) can drop onto the output
+subset, allowing a margin of \a margin output pixels around it.  The
+pixels x1..x2 of line j may do so when \a x1[j - j0] <= \a x2[j - j0];
+x1 > x2 when none of the line can and it is skipped.
+
+This replaces checking each line on its own (the old CHOVER, which
+transformed 21 points of every line).  A coarse grid over the lines,
+with about ten cells across and square cells, is transformed at once.
+In each cell whose corners land near the output subset, the ends of
+every line across the cell are interpolated between the corners, and
+the lines whose ends land near the subset, and the lines next to them,
+are let through from one grid column before the cell to one after it.
+Since the cells tile the input, a line that only reaches the output
+between two grid columns, or between lines sampled by the grid, is not
+missed.
 */
-#define CHECK_OVER_NPOINT 21
+#define LINE_SPANS_NSTEP 10
 
 static int
-check_over(struct driz_param_t* p, const integer_t y, const integer_t margin,
+line_spans(struct driz_param_t* p, const integer_t ystart,
+           const integer_t j0, const integer_t j1, const integer_t margin,
            /* Output parameters */
-           double* ofrac, integer_t* x1, integer_t* x2,
+           integer_t* x1 /*[j1-j0]*/, integer_t* x2 /*[j1-j0]*/,
            struct driz_error_t* error) {
-  const integer_t npoint = CHECK_OVER_NPOINT;
-  double xval[CHECK_OVER_NPOINT], yval[CHECK_OVER_NPOINT];
-  double xtmp[CHECK_OVER_NPOINT], ytmp[CHECK_OVER_NPOINT];
-  double xout[CHECK_OVER_NPOINT], yout[CHECK_OVER_NPOINT];
-  integer_t logo[CHECK_OVER_NPOINT];
-  integer_t step, first, last;
-  integer_t nhit, nmiss;
-  integer_t i, np;
+  const integer_t nlines = j1 - j0;
+  integer_t step, ncol, nrow, n, i, k, c, r, j, ja, jb, xa, xb, last;
+  double* memory = NULL;
+  double *xin, *yin, *xtmp, *ytmp, *xout, *yout;
+  double xlo, xhi, ylo, yhi, t, end[4];
+  integer_t k00, k10, k01, k11;
 
   assert(p);
-  assert(ofrac);
   assert(x1);
   assert(x2);
-  assert(error);
-
-  if (p->dnx < npoint)
-    step = 1;
-  else
-    step = p->dnx / (npoint / 2);
+  assert(nlines > 0);
 
-  for (i = 1, np = 0; i <= p->dnx; i += step, ++np) {
-    assert(np < npoint);
-    xval[np] = (double)i;
-    yval[np] = (double)y;
-  }
-  assert(np < npoint);
+  step = (p->dnx < 2 * LINE_SPANS_NSTEP + 1) ? 1 : p->dnx / LINE_SPANS_NSTEP;
 
-  /* Check end point */
-  if (xval[np - 1] < (double)p->dnx) {
-    xval[np] = (double)p->dnx;
-    yval[np] = (double)y;
-    ++np;
-  }
+  /* Grid nodes, the last column and row clamped to the edges.  A single
+     column or line makes cells of zero width or height. */
+  ncol = MAX((p->dnx - 1 + step - 1) / step, 1) + 1;
+  nrow = MAX((nlines - 1 + step - 1) / step, 1) + 1;
+  n = ncol * nrow;
 
-  /* Transform */
-  if (map_value(p, FALSE, np, xval, yval, xtmp, ytmp, xout, yout, error))
+  memory = malloc((size_t)n * 6 * sizeof(double));
+  if (memory == NULL) {
+    driz_error_set_message(error, "Out of memory");
     return 1;
-
-  /* Check where the overlap starts and ends */
-  for (i = 0; i < np; ++i) {
-    logo[i] = 0;
-  }
-
-  for (i = 0; i < np - 1; ++i) {
-    if (MAX(xout[i], xout[i+1]) >= 1.0 - (double)margin &&
-        MIN(xout[i], xout[i+1]) < (double)(p->onx + margin) &&
-        MAX(yout[i], yout[i+1]) >= 1.0 - (double)margin &&
-        MIN(yout[i], yout[i+1]) < (double)(p->ony + margin)) {
-      logo[i] = 1;
-      logo[i+1] = 1;
-    }
-  }
-
-  nhit = 0;
-  for (i = 0; i < np; ++i) {
-    if (logo[i]) {
-      ++nhit;
-    }
-  }
-
-  nmiss = np - nhit;
-
-  if (nhit == 0) {
-    *ofrac = 0.0;
-    *x1 = 0;
-    *x2 = 0;
-    return 0;
   }
-
-  first = 0;
-  last = 0;
-
-  for (i = 0; i < np; ++i) {
-    if (logo[i]) {
-      first = i;
-      break;
+  xin = memory;
+  yin = xin + n;
+  xtmp = yin + n;
+  ytmp = xtmp + n;
+  xout = ytmp + n;
+  yout = xout + n;
+
+  for (r = 0, k = 0; r < nrow; ++r) {
+    for (c = 0; c < ncol; ++c, ++k) {
+      xin[k] = (double)MIN(1 + c * step, p->dnx);
+      yin[k] = (double)(ystart + MIN(j0 + r * step, j1 - 1) + 1);
     }
   }
 
-  for (i = np - 1; i >= 0; --i) {
-    if (logo[i]) {
-      last = i;
-      break;
-    }
+  if (map_value(p, FALSE, n, xin, yin, xtmp, ytmp, xout, yout, error)) {
+    free(memory);
+    return 1;
   }
 
-  if (nhit == 0 && nmiss == 0) {
-    *ofrac = 0.0;
-  } else {
-    *ofrac = (double)nhit / (double)(nhit + nmiss);
+  for (j = 0; j < nlines; ++j) {
+    x1[j] = p->dnx + 1;
+    x2[j] = 0;
   }
-  *x1 = (first > 0) ? (integer_t)xval[first - 1] : (integer_t)xval[0];
-  *x2 = (last < np - 1) ? (integer_t)xval[last + 1] : (integer_t)xval[np - 1];
-
-  assert(*x1 > 0 && *x1 <= p->dnx);
-  assert(*x2 > 0 && *x2 <= p->dnx);
-
-  return 0;
-}
 
-/**
-Match up a context against a context table Note that after drizzle
-V0.40 (EIS) the context table itself has an extra second column for
-the counter.
-*/
-static bool_t
-match(const integer_t* a /*[n]*/, const integer_t* b /*[n]*/,
-      const integer_t n UNUSED_PARAM) {
-  integer_t i, an, bn;
+  for (r = 0; r < nrow - 1; ++r) {
+    for (c = 0; c < ncol - 1; ++c) {
+      /* The bounding box of the corners that could be transformed */
+      xlo = ylo = MAX_DOUBLE;
+      xhi = yhi = -MAX_DOUBLE;
+      for (i = 0; i < 4; ++i) {
+        k = (r + i / 2) * ncol + c + i % 2;
+        if (xout[k] != xout[k] || yout[k] != yout[k])
+          continue;
+        xlo = MIN(xlo, xout[k]);
+        xhi = MAX(xhi, xout[k]);
+        ylo = MIN(ylo, yout[k]);
+        yhi = MAX(yhi, yout[k]);
+      }
 
-  assert(a);
-  assert(b);
+      if (!(xhi >= (double)(p->xmin - margin) &&
+            xlo < (double)(p->xmax + margin) &&
+            yhi >= (double)(p->ymin - margin) &&
+            ylo < (double)(p->ymax + margin))) {
+        continue;
+      }
 
-  an = a[0];
-  bn = b[0];
+      ja = (integer_t)yin[r * ncol] - ystart - 1 - j0;
+      jb = (integer_t)yin[(r + 1) * ncol] - ystart - 1 - j0;
+      xa = (integer_t)xin[MAX(c - 1, 0)];
+      xb = (integer_t)xin[MIN(c + 2, ncol - 1)];
+      k00 = r * ncol + c;
+      k10 = k00 + 1;
+      k01 = k00 + ncol;
+      k11 = k01 + 1;
+
+      /* last is the last line let through so far, ja - 2 for none */
+      last = ja - 2;
+      for (j = ja; j <= jb; ++j) {
+        t = (jb > ja) ? (double)(j - ja) / (double)(jb - ja) : 0.0;
+        end[0] = xout[k00] + t * (xout[k01] - xout[k00]);
+        end[1] = xout[k10] + t * (xout[k11] - xout[k10]);
+        end[2] = yout[k00] + t * (yout[k01] - yout[k00]);
+        end[3] = yout[k10] + t * (yout[k11] - yout[k10]);
+
+        /* A line with an end that could not be transformed is let
+           through */
+        if (end[0] == end[0] && end[1] == end[1] &&
+            end[2] == end[2] && end[3] == end[3] &&
+            !(MAX(end[0], end[1]) >= (double)(p->xmin - margin) &&
+              MIN(end[0], end[1]) < (double)(p->xmax + margin) &&
+              MAX(end[2], end[3]) >= (double)(p->ymin - margin) &&
+              MIN(end[2], end[3]) < (double)(p->ymax + margin))) {
+          continue;
+        }
 
-  if (an != bn) {
-    return 0;
-  } else {
-    assert(an <= n - 2);
-    for (i = 1; i <= an; ++i) {
-      if (a[i] != b[i+1])
-        return 0;
+        /* This line, the one before and the one after */
+        for (i = MAX(MAX(j - 1, ja), last + 1); i <= MIN(j + 1, jb); ++i) {
+          x1[i] = MIN(x1[i], xa);
+          x2[i] = MAX(x2[i], xb);
+        }
+        last = MIN(j + 1, jb);
+      }
     }
   }
 
-  return 1;
-}
-
-/* A comparision predicate for use with qsort, used by update_context */
-static int
-_compare_integer_t(const void* a, const void* b) {
-  integer_t ad = *(integer_t*)a;
-  integer_t bd = *(integer_t*)b;
-  if (ad < bd)
-    return -1;
-  if (ad == bd)
-    return 0;
-  return 1;
+  free(memory);
+  return 0;
 }
 
 /**
@@ -201,10 +187,11 @@ update_context_image(struct driz_param_t* p, const integer_t ii, const integer_t
                      integer_t* oldcon,
                      /* Output parameters */
                      integer_t* newcon, struct driz_error_t* error) {
-  integer_t icon, nn, k;
-  integer_t newma[100];
+  struct context_table_t* t = p->context_table;
+  integer_t icon;
 
   assert(p);
+  assert(t);
   assert(oldcon);
   assert(newcon);
   assert(error);
@@ -217,79 +204,25 @@ update_context_image(struct driz_param_t* p, const integer_t ii, const integer_t
   /* If it is the same as the last one, we don't need to go further */
   if (icon == *oldcon) {
     *output_context_ptr(p, ii, jj) = *newcon;
-    goto upcon_continue;
-  }
-
-  /* Combine with the new one */
-  if (icon == 0) {
-    nn = 0;
-    newma[0] = 0;
-    newma[1] = p->uuid;
   } else {
-    nn = *intab_ptr(p, 0, icon);
-
-    /* Check for whether this image is already on this pixel */
-    for (k = 2; k <= nn+1; ++k)
-      if (p->uuid == *intab_ptr(p, k, icon))
-        goto upcon_continue;
-
-    /* If not create the new context by adding the current image */
-    newma[0] = nn + 1;
-    for (k = 1; k <= nn; ++k)
-      newma[k] = *intab_ptr(p, k+1, icon);
-
-    /* Check for too many images at a given context */
-    if (nn > MAXIM - 3) {
-      driz_error_set_message(error, "Too many images.  Context table overloaded.");
+    /* Combine with the new one: the table finds (or makes) the context
+       with this image added */
+    if (context_table_add_image(t, icon, p->uuid,
+                                output_context_ptr(p, ii, jj), error)) {
       return 1;
     }
 
-    newma[nn+2] = p->uuid; /* TODO: Base check */
-  }
-
-  /* Before matching sort the context array */
-  if (nn > 0) {
-    qsort(newma, (size_t)nn, sizeof(integer_t), &_compare_integer_t);
-  }
-
-  /* See whether we have had this context before */
-  for (k = p->nen; k >= 0; --k) {
-    if (match(newma, intab_ptr(p, 0, k), MAXIM)) {
-      *output_context_ptr(p, ii, jj) = k;
-      goto upcon_continue;
-    }
-  }
-
-  /* No context match found: make a new one */
-  ++(p->nen);
-
-  /* Check for full table */
-  if (p->nen == MAXEN) {
-    driz_error_set_message(error, "Context table full");
-    return 1;
-  }
-
-  *output_context_ptr(p, ii, jj) = p->nen;
-  *intab_ptr(p, 0, p->nen) = newma[0];
-  *intab_ptr(p, 1, p->nen) = 0;
-  for (k = 2; k < nn+4; ++k) { /* TODO: Base check */
-    *intab_ptr(p, k, p->nen) = newma[k - 1];
+    /* Save the old values for quick comparison */
+    *oldcon = icon;
+    *newcon = *output_context_ptr(p, ii, jj);
   }
 
-  /* Tell the user about this new context */
-  /* TODO */
-
- upcon_continue:
-  /* Save the old values for quick comparison */
-  *oldcon = icon;
-  *newcon = *output_context_ptr(p, ii, jj);
-
   /* Lastly, we update the counter */
   if (*oldcon != *newcon) {
     if (*oldcon > 0) {
-      *intab_ptr(p, 1, *oldcon) -= 1;
+      t->counts[*oldcon] -= 1;
     }
-    *intab_ptr(p, 1, *newcon) += 1;
+    t->counts[*newcon] += 1;
   }
 
   *output_done_ptr(p, ii, jj) = 1;
@@ -297,15 +230,67 @@ update_context_image(struct driz_param_t* p, const integer_t ii, const integer_t
   return 0;
 }
 
-inline_macro static int
+/***************************************************************************
+ KERNEL VARIANTS
+
+ Each kernel is compiled once for every combination of the DROP_* flags,
+ which fix how a drop updates the output, and dobox picks the variant to
+ use once per call.  That takes the tests of the weights, the context
+ and the accumulate mode out of the loops over the hits.  DROP_GENERIC
+ makes those tests at run time instead; it covers the rarer set-ups
+ (a context table, compensated sums, removing an input) without more
+ variants.
+*/
+
+#define DROP_WEIGHTS 0x1    /* there is an input weight image */
+#define DROP_CONTEXT 0x2    /* there is a bitmask context image */
+#define DROP_ACCUMULATE 0x4 /* p->accumulate, without compensation */
+#define DROP_GENERIC 0x8    /* look at p for all of the above */
+#define DROP_NVARIANTS 9
+
+static integer_t
+drop_variant(const struct driz_param_t* p) {
+  if (p->output_done != NULL || p->output_compensation != NULL ||
+      p->remove) {
+    return DROP_GENERIC;
+  }
+
+  return (p->weights ? DROP_WEIGHTS : 0) |
+    (p->output_context ? DROP_CONTEXT : 0) |
+    (p->accumulate ? DROP_ACCUMULATE : 0);
+}
+
+static force_inline_macro bool_t
+drop_has_weights(const struct driz_param_t* p, const integer_t drop) {
+  return (drop & DROP_GENERIC) ?
+    (bool_t)(p->weights != NULL) : (bool_t)((drop & DROP_WEIGHTS) != 0);
+}
+
+static force_inline_macro bool_t
+drop_accumulates(const struct driz_param_t* p, const integer_t drop) {
+  return (drop & DROP_GENERIC) ?
+    p->accumulate : (bool_t)((drop & DROP_ACCUMULATE) != 0);
+}
+
+static force_inline_macro int
 update_context(struct driz_param_t* p, const integer_t ii, const integer_t jj,
                const double dow,
                /* Input/output parameters */
                integer_t* oldcon,
                /* Output parameters */
-               integer_t* newcon, struct driz_error_t* error) {
+               integer_t* newcon, struct driz_error_t* error,
+               const integer_t drop) {
+  if (!(drop & DROP_GENERIC)) {
+    if ((drop & DROP_CONTEXT) && dow > 0.0) {
+      *output_context_ptr(p, ii, jj) |= p->bv;
+    }
+    return 0;
+  }
+
   if (p->output_context && dow > 0.0) {
-    if (p->output_done == NULL) {
+    if (p->remove) {
+      *output_context_ptr(p, ii, jj) &= ~p->bv;
+    } else if (p->output_done == NULL) {
       *output_context_ptr(p, ii, jj) |= p->bv;
     } else {
       if (*output_done_ptr(p, ii, jj) == 0) {
@@ -319,165 +304,138 @@ update_context(struct driz_param_t* p, const integer_t ii, const integer_t jj,
   return 0;
 }
 
-inline_macro static void
-update_data(struct driz_param_t* p, const integer_t ii, const integer_t jj,
-            const float d, const float vc, const float dow) {
-  const double vc_plus_dow = vc + dow;
+/**
+Is an output pixel left without any input in its bitmask context, in
+any of the planes?  The plane of the current input is the one
+p->output_context points to.
+*/
+static bool_t
+context_is_empty(struct driz_param_t* p, const integer_t ii, const integer_t jj) {
+  const integer_t* con = output_context_ptr(p, ii, jj);
+  const size_t plane = (size_t)p->onx * (size_t)p->ony;
+  integer_t k, np;
 
-  /* Just a simple calculation without logical tests */
-  if (vc == 0.0) {
-    *output_data_ptr(p, ii, jj) = d;
-  } else {
-    if (vc_plus_dow != 0.0) {
-      *output_data_ptr(p, ii, jj) =
-        (*output_data_ptr(p, ii, jj) * vc + dow * d) / (vc_plus_dow);
+  if (p->context_planes == 0) {
+    return (bool_t)(*con == 0);
+  }
+
+  /* Back to the first plane */
+  np = (p->uuid - 1) / 32;
+  con -= (size_t)np * plane;
+  for (k = 0; k < p->context_planes; ++k) {
+    if (con[(size_t)k * plane] != 0) {
+      return FALSE;
     }
   }
 
-  *output_counts_ptr(p, ii, jj) = vc_plus_dow;
+  return TRUE;
 }
 
 /**
-To calculate area under a line segment within unit square at origin.
-This is used by BOXER.
-
-NOTE: This is the single most frequently called function.  Ripe
-for optimization.
+Take a drop out of the weighted sums of an output pixel.  A pixel that
+only this input reached is cleared to an empty one: that is, once no
+input is left in its context or, as the negative lobes of the Lanczos
+kernels may leave no mark in it, once the compensated weight falls to
+within its rounding of nothing.
 */
-static inline_macro double
-sgarea(const double x1, const double y1, const double x2, const double y2) {
-  double m, c, dx, dy, xlo, xhi, ylo, yhi, xtop;
-  int negdx;
-
-  dy = y2 - y1;
+static void
+remove_drop(struct driz_param_t* p, const integer_t ii, const integer_t jj,
+            const float d, const float vc, const float dow) {
+  double before, left;
+  bool_t empty;
 
-  dx = x2 - x1;
-  /* Trap vertical line */
-  if (dx == 0.0)
-    return 0.0;
+  if (p->output_compensation) {
+    before = (double)vc + *output_compensation_ptr(p, 1, ii, jj);
+    if (before == 0.0) {
+      return;
+    }
 
-  negdx = (int)(dx < 0.0);
-  if (negdx) {
-    xlo = x2;
-    xhi = x1;
+    compensated_add(output_data_ptr(p, ii, jj),
+                    output_compensation_ptr(p, 0, ii, jj), -dow * d);
+    compensated_add(output_counts_ptr(p, ii, jj),
+                    output_compensation_ptr(p, 1, ii, jj), -dow);
+    left = (double)*output_counts_ptr(p, ii, jj) +
+      *output_compensation_ptr(p, 1, ii, jj);
   } else {
-    xlo = x1;
-    xhi = x2;
-  }
-
-  /* And determine the bounds ignoring y for now */
-  if (xlo >= 1.0 || xhi <= 0.0)
-    return 0.0;
-
-  xlo = MAX(xlo, 0.0);
-  xhi = MIN(xhi, 1.0);
-
-  /* Now look at y */
-  m = dy / dx;
-  assert(m != 0.0);
-  c = y1 - m * x1;
-  ylo = m * xlo + c;
-  yhi = m * xhi + c;
-
-  /* Trap segment entirely below axis */
-  if (ylo <= 0.0 && yhi <= 0.0)
-    return 0.0;
+    before = vc;
+    if (before == 0.0) {
+      return;
+    }
 
-  /* Adjust bounds if segment crosses axis (to exclude anything below
-     axis) */
-  if (ylo < 0.0) {
-    ylo = 0.0;
-    xlo = -c / m;
+    *output_data_ptr(p, ii, jj) -= dow * d;
+    left = (double)vc - dow;
+    *output_counts_ptr(p, ii, jj) = (float)left;
   }
 
-  if (yhi < 0.0) {
-    yhi = 0.0;
-    xhi = -c / m;
+  if (p->kernel == kernel_lanczos2 || p->kernel == kernel_lanczos3) {
+    /* dobox only allows this with compensated sums, which round to
+       about FLT_EPSILON squared of the largest weights summed, times
+       the number of drops */
+    if (fabs(before) > p->remove_scale) {
+      p->remove_scale = fabs(before);
+    }
+    empty = (bool_t)(fabs(left) <=
+                     1024.0 * FLT_EPSILON * FLT_EPSILON * p->remove_scale);
+  } else {
+    empty = context_is_empty(p, ii, jj);
   }
 
-  /* There are four possibilities: both y below 1, both y above 1 and
-     one of each. */
-  if (ylo >= 1.0 && yhi >= 1.0) {
-    /* Line segment is entirely above square */
-    if (negdx) {
-      return xlo - xhi;
-    } else {
-      return xhi - xlo;
+  if (empty) {
+    *output_data_ptr(p, ii, jj) = 0.0;
+    *output_counts_ptr(p, ii, jj) = 0.0;
+    if (p->output_compensation) {
+      *output_compensation_ptr(p, 0, ii, jj) = 0.0;
+      *output_compensation_ptr(p, 1, ii, jj) = 0.0;
     }
   }
+}
 
-  if (ylo <= 1.0) {
-    if (yhi <= 1.0) {
-      /* Segment is entirely within square */
-      if (negdx) {
-        return 0.5 * (xlo - xhi) * (yhi + ylo);
-      } else {
-        return 0.5 * (xhi - xlo) * (yhi + ylo);
-      }
-    }
+static force_inline_macro void
+update_data(struct driz_param_t* p, const integer_t ii, const integer_t jj,
+            const float d, const float vc, const float dow,
+            const integer_t drop) {
+  const double vc_plus_dow = vc + dow;
 
-    /* Otherwise, it must cross the top of the square */
-    xtop = (1.0 - c) / m;
+  if (drop_accumulates(p, drop)) {
+    if ((drop & DROP_GENERIC) && p->remove) {
+      remove_drop(p, ii, jj, d, vc, dow);
+      return;
+    }
 
-    if (negdx) {
-      return -(0.5 * (xtop - xlo) * (1.0 + ylo) + xhi - xtop);
+    /* Weighted sums, normalised once at the end by normalize_output.
+       An empty pixel may still hold the fill value. */
+    if ((drop & DROP_GENERIC) && p->output_compensation) {
+      /* The weight may pass through zero while its error term does not */
+      if (vc == 0.0 && *output_compensation_ptr(p, 1, ii, jj) == 0.0) {
+        *output_data_ptr(p, ii, jj) = 0.0;
+        *output_compensation_ptr(p, 0, ii, jj) = 0.0;
+        *output_compensation_ptr(p, 1, ii, jj) = 0.0;
+      }
+      compensated_add(output_data_ptr(p, ii, jj),
+                      output_compensation_ptr(p, 0, ii, jj), dow * d);
+      compensated_add(output_counts_ptr(p, ii, jj),
+                      output_compensation_ptr(p, 1, ii, jj), dow);
+    } else if (vc == 0.0) {
+      *output_data_ptr(p, ii, jj) = dow * d;
+      *output_counts_ptr(p, ii, jj) = vc_plus_dow;
     } else {
-      return 0.5 * (xtop - xlo) * (1.0 + ylo) + xhi - xtop;
+      *output_data_ptr(p, ii, jj) += dow * d;
+      *output_counts_ptr(p, ii, jj) = vc_plus_dow;
     }
+    return;
   }
 
-  xtop = (1.0 - c) / m;
-
-  if (negdx) {
-    return -(0.5 * (xhi - xtop) * (1.0 + yhi) + xtop - xlo);
+  /* Just a simple calculation without logical tests */
+  if (vc == 0.0) {
+    *output_data_ptr(p, ii, jj) = d;
   } else {
-    return 0.5 * (xhi - xtop) * (1.0 + yhi) + xtop - xlo;
-  }
-
-  /* Shouldn't ever get here */
-  assert(FALSE);
-  return 0.0;
-}
-
-/**
- compute area of box overlap
-
- Calculate the area common to input clockwise polygon x(n), y(n) with
- square (is, js) to (is+1, js+1).
- This version is for a quadrilateral.
-
- Used by do_square_kernel.
-*/
-static inline_macro double
-boxer(double is, double js,
-      const double x[4], const double y[4]) {
-  integer_t i;
-  double sum;
-  double px[4], py[4];
-
-  assert(x);
-  assert(y);
-
-  is -= 0.5;
-  js -= 0.5;
-  /* Set up coords relative to unit square at origin Note that the
-     +0.5s were added when this code was included in DRIZZLE */
-
-  for (i = 0; i < 4; ++i) {
-    px[i] = x[i] - is;
-    py[i] = y[i] - js;
-  }
-
-  /* For each line in the polygon (or at this stage, input
-     quadrilateral) calculate the area common to the unit square
-     (allow negative area for subsequent `vector' addition of
-     subareas). */
-  sum = 0.0;
-  for (i = 0; i < 4; ++i) {
-    sum += sgarea(px[i], py[i], px[(i+1) & 0x3], py[(i+1) & 0x3]);
+    if (vc_plus_dow != 0.0) {
+      *output_data_ptr(p, ii, jj) =
+        (*output_data_ptr(p, ii, jj) * vc + dow * d) / (vc_plus_dow);
+    }
   }
 
-  return sum;
+  *output_counts_ptr(p, ii, jj) = vc_plus_dow;
 }
 
 /**
@@ -516,14 +474,15 @@ typedef int (*kernel_handler_t)(struct driz_param_t*, const integer_t,
                                 integer_t*, integer_t*, integer_t*,
                                 struct driz_error_t*);
 
-static int
+static force_inline_macro int
 do_kernel_point(struct driz_param_t* p, const integer_t j,
                 const integer_t x1, const integer_t x2,
                 double* xo, double* yo,
                 /* Input/output parameters */
                 integer_t* oldcon, integer_t* newcon, integer_t* nmiss,
                 /* Output parameters */
-                struct driz_error_t* error) {
+                struct driz_error_t* error,
+                const integer_t drop) {
   integer_t i, ii, jj;
   float vc, d, dow;
   double dx, dy;
@@ -539,7 +498,7 @@ do_kernel_point(struct driz_param_t* p, const integer_t j,
 
     /* Check it is on the output image */
     if (ii >= 0 && ii < p->nsx &&
-        jj >= 0 && jj < p->nsy) {
+        jj >= p->row0 && jj < p->row1) {
       vc = *output_counts_ptr(p, ii, jj);
     /* Convert i,j 1-based pixel positions into 0-based
        indices for accessing data array. */
@@ -547,11 +506,11 @@ do_kernel_point(struct driz_param_t* p, const integer_t j,
     yarr = j-1;
 
       /* Allow for stretching because of scale change */
-      d = *data_ptr(p, xarr, yarr) * (float)p->scale2;
+      d = *data_ptr(p, xarr, yarr) * p->data_scale * (float)p->scale2;
 
       /* Scale the weighting mask by the scale factor.  Note that we
          DON'T scale by the Jacobian as it hasn't been calculated */
-      if (p->weights) {
+      if (drop_has_weights(p, drop)) {
         dow = *weights_ptr(p, xarr, yarr) * p->weight_scale;
       } else {
         dow = 1.0;
@@ -559,11 +518,11 @@ do_kernel_point(struct driz_param_t* p, const integer_t j,
 
       /* If we are creating of modifying the context image,
          we do so here. */
-      if (update_context(p, ii, jj, dow, oldcon, newcon, error)) {
+      if (update_context(p, ii, jj, dow, oldcon, newcon, error, drop)) {
         return 1;
       }
 
-      update_data(p, ii, jj, d, vc, dow);
+      update_data(p, ii, jj, d, vc, dow, drop);
     } else {
 
       ++(*nmiss);
@@ -573,13 +532,14 @@ do_kernel_point(struct driz_param_t* p, const integer_t j,
   return 0;
 }
 
-static int
+static force_inline_macro int
 do_kernel_tophat(struct driz_param_t* p, const integer_t j,
                  const integer_t x1, const integer_t x2,
                  double* xo, double* yo,
                  /* Input/output parameters */
                  integer_t* oldcon, integer_t* newcon, integer_t* nmiss,
-                 struct driz_error_t* error) {
+                 struct driz_error_t* error,
+                 const integer_t drop) {
   integer_t i, ii, jj, nhit, nxi, nxa, nyi, nya;
   float vc, d, dow;
   double xx, yy, xxi, xxa, yyi, yya, dx, dy, ddx, ddy, r2;
@@ -610,11 +570,11 @@ do_kernel_tophat(struct driz_param_t* p, const integer_t j,
     yarr = j-1;
 
     /* Allow for stretching because of scale change */
-    d = *data_ptr(p, xarr, yarr) * (float)p->scale2;
+    d = *data_ptr(p, xarr, yarr) * p->data_scale * (float)p->scale2;
 
     /* Scale the weighting mask by the scale factor and inversely by
        the Jacobian to ensure conservation of weight in the output */
-    if (p->weights) {
+    if (drop_has_weights(p, drop)) {
       dow = *weights_ptr(p, xarr, yarr) * p->weight_scale;
     } else {
       dow = 1.0;
@@ -640,11 +600,11 @@ do_kernel_tophat(struct driz_param_t* p, const integer_t j,
 
           /* If we are create or modifying the context image,
              we do so here. */
-          if (update_context(p, ii, jj, dow, oldcon, newcon, error)) {
+          if (update_context(p, ii, jj, dow, oldcon, newcon, error, drop)) {
             return 1;
           }
 
-          update_data(p, ii, jj, d, vc, dow);
+          update_data(p, ii, jj, d, vc, dow, drop);
         }
       }
     }
@@ -656,13 +616,14 @@ do_kernel_tophat(struct driz_param_t* p, const integer_t j,
   return 0;
 }
 
-static int
+static force_inline_macro int
 do_kernel_gaussian(struct driz_param_t* p, const integer_t j,
                    const integer_t x1, const integer_t x2,
                    double* xo, double* yo,
                    /* Input/output parameters */
                    integer_t* oldcon, integer_t* newcon, integer_t* nmiss,
-                   struct driz_error_t* error) {
+                   struct driz_error_t* error,
+                   const integer_t drop) {
   integer_t i, ii, jj, nxi, nxa, nyi, nya, nhit;
   float vc, d, dow;
   double xx, yy, xxi, xxa, yyi, yya, w, dx, dy, ddx, ddy, r2, dover;
@@ -693,11 +654,11 @@ do_kernel_gaussian(struct driz_param_t* p, const integer_t j,
 
 
     /* Allow for stretching because of scale change */
-    d = *data_ptr(p, xarr, yarr) * (float)p->scale2;
+    d = *data_ptr(p, xarr, yarr) * p->data_scale * (float)p->scale2;
 
     /* Scale the weighting mask by the scale factor and inversely by
        the Jacobian to ensure conservation of weight in the output */
-    if (p->weights) {
+    if (drop_has_weights(p, drop)) {
       w = *weights_ptr(p, xarr, yarr) * p->weight_scale;
     } else {
       w = 1.0;
@@ -723,11 +684,11 @@ do_kernel_gaussian(struct driz_param_t* p, const integer_t j,
 
         /* If we are create or modifying the context image, we do so
            here. */
-        if (update_context(p, ii, jj, dow, oldcon, newcon, error)) {
+        if (update_context(p, ii, jj, dow, oldcon, newcon, error, drop)) {
           return 1;
         }
 
-        update_data(p, ii, jj, d, vc, dow);
+        update_data(p, ii, jj, d, vc, dow, drop);
       }
     }
 
@@ -738,18 +699,129 @@ do_kernel_gaussian(struct driz_param_t* p, const integer_t j,
   return 0;
 }
 
-static int
+/**
+The tabulated Gaussian factor exp(-x*x*efac), interpolated linearly.
+*/
+static inline_macro double
+gaussian_factor(const struct driz_param_t* p, const double x) {
+  const double t = fabs(x) * p->gaussian.sdp;
+  const size_t k = (size_t)t;
+
+  assert(k + 1 < p->gaussian.nlut);
+
+  return p->gaussian.lut[k] +
+    (t - (double)k) * (p->gaussian.lut[k+1] - p->gaussian.lut[k]);
+}
+
+/**
+The Gaussian kernel evaluated as the product of an x and a y factor,
+each looked up once per column or row of the footprint rather than
+computing exp() for every output pixel.  Used when
+p->gaussian.tolerance is above 0.
+*/
+static force_inline_macro int
+do_kernel_gaussian_lut(struct driz_param_t* p, const integer_t j,
+                       const integer_t x1, const integer_t x2,
+                       double* xo, double* yo,
+                       /* Input/output parameters */
+                       integer_t* oldcon, integer_t* newcon, integer_t* nmiss,
+                       struct driz_error_t* error,
+                       const integer_t drop) {
+  integer_t i, ii, jj, nxi, nxa, nyi, nya, nhit;
+  float vc, d, dow;
+  double xx, yy, xxi, xxa, yyi, yya, w, dx, dy, gy, dover;
+  /* The x factors of the footprint of one input pixel */
+  double* gx = p->gaussian.x;
+  integer_t xarr,yarr;
+
+  assert(gx);
+
+  dx = (double)(p->xmin);
+  dy = (double)(p->ymin);
+
+  for (i = x1; i <= x2; ++i) {
+    xx = *mapping_ptr(p, xo, i) - dx;
+    yy = *mapping_ptr(p, yo, i) - dy;
+
+    xxi = xx - p->pfo;
+    xxa = xx + p->pfo;
+    yyi = yy - p->pfo;
+    yya = yy + p->pfo;
+
+    nxi = MAX(fortran_round(xxi), 0);
+    nxa = MIN(fortran_round(xxa), p->nsx - 1);
+    nyi = MAX(fortran_round(yyi), 0);
+    nya = MIN(fortran_round(yya), p->nsy - 1);
+
+    nhit = 0;
+    /* Convert i,j 1-based pixel positions into 0-based
+       indices for accessing data array. */
+    xarr = i-1;
+    yarr = j-1;
+
+    /* Allow for stretching because of scale change */
+    d = *data_ptr(p, xarr, yarr) * p->data_scale * (float)p->scale2;
+
+    /* Scale the weighting mask by the scale factor and inversely by
+       the Jacobian to ensure conservation of weight in the output */
+    if (drop_has_weights(p, drop)) {
+      w = *weights_ptr(p, xarr, yarr) * p->weight_scale;
+    } else {
+      w = 1.0;
+    }
+
+    for (ii = nxi; ii <= nxa; ++ii) {
+      gx[ii - nxi] = gaussian_factor(p, xx - (double)ii);
+    }
+
+    /* Loop over output pixels which could be affected */
+    for (jj = nyi; jj <= nya; ++jj) {
+      gy = p->gaussian.es * gaussian_factor(p, yy - (double)jj);
+      for (ii = nxi; ii <= nxa; ++ii) {
+        /* Weight is the product of the x and y factors */
+        dover = gy * gx[ii - nxi];
+
+        /* Count the hits */
+        ++nhit;
+
+        vc = *output_counts_ptr(p, ii, jj);
+        dow = (float)dover * w;
+
+        /* If we are create or modifying the context image, we do so
+           here. */
+        if (update_context(p, ii, jj, dow, oldcon, newcon, error, drop)) {
+          return 1;
+        }
+
+        update_data(p, ii, jj, d, vc, dow, drop);
+      }
+    }
+
+    /* Count cases where the pixel is off the output image */
+    if (nhit == 0) ++(*nmiss);
+  }
+
+  return 0;
+}
+
+static force_inline_macro int
 do_kernel_lanczos(struct driz_param_t* p, const integer_t j,
                   const integer_t x1, const integer_t x2,
                   double* xo, double *yo,
                   /* Input/output parameters */
                   integer_t* oldcon, integer_t* newcon, integer_t* nmiss,
-                  struct driz_error_t* error) {
+                  struct driz_error_t* error,
+                  const integer_t drop) {
   integer_t i, ii, jj, nxi, nxa, nyi, nya, nhit, ix, iy;
-  float vc, d, dow;
+  float vc, d, dow, ly;
   double xx, yy, xxi, xxa, yyi, yya, w, dx, dy, dover;
+  /* The Lanczos function values in X over the footprint of one input
+     pixel, the same for each of its rows */
+  float* lx = p->lanczos.x;
   integer_t xarr,yarr;
 
+  assert(lx);
+
   dx = (double)(p->xmin);
   dy = (double)(p->ymin);
 
@@ -775,25 +847,31 @@ do_kernel_lanczos(struct driz_param_t* p, const integer_t j,
 
 
     /* Allow for stretching because of scale change */
-    d = *data_ptr(p, xarr, yarr) * (float)p->scale2;
+    d = *data_ptr(p, xarr, yarr) * p->data_scale * (float)p->scale2;
 
     /* Scale the weighting mask by the scale factor and inversely by
        the Jacobian to ensure conservation of weight in the output */
-    if (p->weights) {
+    if (drop_has_weights(p, drop)) {
       w = *weights_ptr(p, xarr, yarr) * p->weight_scale;
     } else {
       w = 1.0;
     }
 
+    /* X offsets */
+    for (ii = nxi; ii <= nxa; ++ii) {
+      ix = fortran_round(fabs(xx - (double)ii) * p->lanczos.sdp) + 1;
+      lx[ii - nxi] = p->lanczos.lut[ix];
+    }
+
     /* Loop over output pixels which could be affected */
     for (jj = nyi; jj <= nya; ++jj) {
-      for (ii = nxi; ii <= nxa; ++ii) {
-        /* X and Y offsets */
-        ix = fortran_round(fabs(xx - (double)ii) * p->lanczos.sdp) + 1;
-        iy = fortran_round(fabs(yy - (double)jj) * p->lanczos.sdp) + 1;
+      /* Y offset */
+      iy = fortran_round(fabs(yy - (double)jj) * p->lanczos.sdp) + 1;
+      ly = p->lanczos.lut[iy];
 
+      for (ii = nxi; ii <= nxa; ++ii) {
         /* Weight is product of Lanczos function values in X and Y */
-        dover = p->lanczos.lut[ix] * p->lanczos.lut[iy];
+        dover = lx[ii - nxi] * ly;
 
         /* Count the hits */
         ++nhit;
@@ -805,11 +883,11 @@ do_kernel_lanczos(struct driz_param_t* p, const integer_t j,
 
         /* If we are create or modifying the context image, we do so
            here. */
-        if (update_context(p, ii, jj, dow, oldcon, newcon, error)) {
+        if (update_context(p, ii, jj, dow, oldcon, newcon, error, drop)) {
           return 1;
         }
 
-        update_data(p, ii, jj, d, vc, dow);
+        update_data(p, ii, jj, d, vc, dow, drop);
       }
     }
 
@@ -820,13 +898,14 @@ do_kernel_lanczos(struct driz_param_t* p, const integer_t j,
   return 0;
 }
 
-static int
+static force_inline_macro int
 do_kernel_turbo(struct driz_param_t* p, const integer_t j,
                 const integer_t x1, const integer_t x2,
                 double* xo, double *yo,
                 /* Input/output parameters */
                 integer_t* oldcon, integer_t* newcon, integer_t* nmiss,
-                struct driz_error_t* error) {
+                struct driz_error_t* error,
+                const integer_t drop) {
   integer_t i, ii, jj, nxi, nxa, nyi, nya, nhit, iis, iie, jjs, jje;
   float vc, d, dow;
   double xxi, xxa, yyi, yya, w, dx, dy, dover,xoi,yoi;
@@ -852,8 +931,8 @@ do_kernel_turbo(struct driz_param_t* p, const integer_t j,
     nya = fortran_round(yya);
     iis = MAX(nxi, 0);  /* Needed to be set to 0 to avoid edge effects */
     iie = MIN(nxa, p->nsx - 1);
-    jjs = MAX(nyi, 0);  /* Needed to be set to 0 to avoid edge effects */
-    jje = MIN(nya, p->nsy - 1);
+    jjs = MAX(nyi, p->row0);  /* Needed to be set to 0 to avoid edge effects */
+    jje = MIN(nya, p->row1 - 1);
 
     nhit = 0;
 
@@ -863,11 +942,11 @@ do_kernel_turbo(struct driz_param_t* p, const integer_t j,
     yarr = j-1;
 
     /* Allow for stretching because of scale change */
-    d = *data_ptr(p, xarr, yarr) * (float)p->scale2;
+    d = *data_ptr(p, xarr, yarr) * p->data_scale * (float)p->scale2;
 
     /* Scale the weighting mask by the scale factor and inversely by
        the Jacobian to ensure conservation of weight in the output. */
-    if (p->weights) {
+    if (drop_has_weights(p, drop)) {
       w = *weights_ptr(p, xarr, yarr) * p->weight_scale;
     } else {
       w = 1.0;
@@ -893,11 +972,11 @@ do_kernel_turbo(struct driz_param_t* p, const integer_t j,
 
           /* If we are create or modifying the context image,
              we do so here. */
-          if (update_context(p, ii, jj, dow, oldcon, newcon, error)) {
+          if (update_context(p, ii, jj, dow, oldcon, newcon, error, drop)) {
             return 1;
           }
 
-          update_data(p, ii, jj, d, vc, dow);
+          update_data(p, ii, jj, d, vc, dow, drop);
         }
       }
     }
@@ -909,141 +988,1770 @@ do_kernel_turbo(struct driz_param_t* p, const integer_t j,
   return 0;
 }
 
+/**
+Transform the corners of the input pixels x1..x2 of line y when they
+sit exactly on the pixel edges (pixfrac = 1 with unit x steps), so
+that neighbouring pixels, and neighbouring lines, share them.
+
+Only the x1 - 1/2, ..., x2 + 1/2 edges along the top of the line are
+transformed.  The bottom edges are the top edges of the previous line,
+which are still in the other pair of planes of xo, yo, provided that
+line was drizzled over at least x1..x2.  The edge between pixels i
+and i+1 is stored at index i of plane \a top, or of plane \a bottom.
+*/
 static int
-do_kernel_square(struct driz_param_t* p,
-                 const integer_t j, double y,
+map_square_edges(struct driz_param_t* p, const double y,
                  const integer_t x1, const integer_t x2,
                  const integer_t last_x1, const integer_t last_x2,
+                 const integer_t top, const integer_t bottom,
                  /* Input/output parameters */
                  double* xi, double* yi,
                  double* xtmp, double* ytmp,
                  double* xo, double* yo,
-                 integer_t* oldcon, integer_t* newcon, integer_t* nmiss,
                  struct driz_error_t* error) {
-  integer_t i, nhit, ii, jj, min_ii, max_ii, min_jj, max_jj, n;
-  float vc, d, dow;
-  double dh, jaco, tem, dover, dx, dy, w;
-  double xout[4], yout[4];
+  integer_t n = x2 - x1 + 2;
+
+  *mapping_4_ptr(p, xi, x1-1, 0) = (double)x1 - 0.5;
+  *mapping_4_ptr(p, yi, x1-1, 0) = y + 0.5;
+  *mapping_4_ptr(p, yi, x1, 0) = 0.5;
+  if (map_value(p, TRUE, n,
+                mapping_4_ptr(p, xi, x1-1, 0), mapping_4_ptr(p, yi, x1-1, 0),
+                xtmp, ytmp,
+                mapping_4_ptr(p, xo, x1-1, top), mapping_4_ptr(p, yo, x1-1, top),
+                error)) {
+    return 1;
+  }
 
-  /* TODO: These are constant across calls -- perhaps cache??? */
-  dh = 0.5 * p->pixel_fraction;
-  dx = (double)(p->xmin) - 1;
-  dy = (double)(p->ymin) - 1;
-  n = x2 - x1 + 1;
+  if (last_x1 <= x1 && x2 <= last_x2) {
+    return 0;
+  }
 
-  /* Next the "classic" drizzle square kernel...  this is different
-     because we have to transform all four corners of the shrunken
-     pixel */
-  /* Set the start corner positions */
+  *mapping_4_ptr(p, yi, x1-1, 0) = y - 0.5;
+  *mapping_4_ptr(p, yi, x1, 0) = -0.5;
+  if (map_value(p, TRUE, n,
+                mapping_4_ptr(p, xi, x1-1, 0), mapping_4_ptr(p, yi, x1-1, 0),
+                xtmp, ytmp,
+                mapping_4_ptr(p, xo, x1-1, bottom),
+                mapping_4_ptr(p, yo, x1-1, bottom),
+                error)) {
+    return 1;
+  }
 
-  *mapping_4_ptr(p, xi, x1, 0) = (double)x1 - dh;
-  *mapping_4_ptr(p, xi, x1, 1) = (double)x1 + dh;
-  *mapping_4_ptr(p, xi, x1, 2) = (double)x1 + dh;
-  *mapping_4_ptr(p, xi, x1, 3) = (double)x1 - dh;
+  return 0;
+}
+
+/* Output pixels handed to boxer_row() at a time */
+#define SQUARE_ROW_CHUNK 32
+/* Bounding boxes at least this wide are trimmed row by row */
+#define SQUARE_ROW_TRIM 8
+
+/**
+Transform the corners of the input pixels x1..x2 of line j (at \a y)
+onto the output, for get_square_corners to pick up.
+*/
+static int
+map_square_corners(struct driz_param_t* p,
+                   const integer_t j, const double y,
+                   const integer_t x1, const integer_t x2,
+                   const integer_t last_x1, const integer_t last_x2,
+                   const bool_t shared_edges,
+                   /* Input/output parameters */
+                   double* xi, double* yi,
+                   double* xtmp, double* ytmp,
+                   double* xo, double* yo,
+                   /* Output parameters */
+                   integer_t* top, integer_t* bottom,
+                   struct driz_error_t* error) {
+  integer_t i, n;
+  double dh;
+
+  dh = 0.5 * p->pixel_fraction;
+  n = x2 - x1 + 1;
+
+  if (shared_edges) {
+    /* Alternate between planes 0 and 2 line by line, so that the top
+       edges of this line become the bottom edges of the next */
+    *top = 2 * (j & 1);
+    *bottom = 2 - *top;
+    return map_square_edges(p, y, x1, x2, last_x1, last_x2, *top, *bottom,
+                            xi, yi, xtmp, ytmp, xo, yo, error);
+  }
+
+  *top = *bottom = 0;
+
+  *mapping_4_ptr(p, xi, x1, 0) = (double)x1 - dh;
+  *mapping_4_ptr(p, xi, x1, 1) = (double)x1 + dh;
+  *mapping_4_ptr(p, xi, x1, 2) = (double)x1 + dh;
+  *mapping_4_ptr(p, xi, x1, 3) = (double)x1 - dh;
 
   *mapping_4_ptr(p, yi, x1, 0) = y + dh;
   *mapping_4_ptr(p, yi, x1, 1) = y + dh;
   *mapping_4_ptr(p, yi, x1, 2) = y - dh;
   *mapping_4_ptr(p, yi, x1, 3) = y - dh;
 
-  *mapping_4_ptr(p, yi, x1+1, 0) = dh;
-  *mapping_4_ptr(p, yi, x1+1, 1) = dh;
-  *mapping_4_ptr(p, yi, x1+1, 2) = -dh;
-  *mapping_4_ptr(p, yi, x1+1, 3) = -dh;
+  *mapping_4_ptr(p, yi, x1+1, 0) = dh;
+  *mapping_4_ptr(p, yi, x1+1, 1) = dh;
+  *mapping_4_ptr(p, yi, x1+1, 2) = -dh;
+  *mapping_4_ptr(p, yi, x1+1, 3) = -dh;
+
+  /* Transform onto the output grid */
+  for (i = 0; i < 4; ++i) {
+    if (map_value(p, TRUE, n,
+                  mapping_4_ptr(p, xi, x1, i), mapping_4_ptr(p, yi, x1, i),
+                  xtmp, ytmp,
+                  mapping_4_ptr(p, xo, x1, i), mapping_4_ptr(p, yo, x1, i),
+                  error)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+Fetch the output corners of input pixel i from the planes filled by
+map_square_corners, relative to the output subset.
+*/
+static inline_macro void
+get_square_corners(struct driz_param_t* p, const integer_t i,
+                   const bool_t shared_edges,
+                   const integer_t top, const integer_t bottom,
+                   double* xo, double* yo,
+                   /* Output parameters */
+                   double xout[4], double yout[4]) {
+  integer_t k;
+  double dx, dy;
+
+  dx = (double)(p->xmin) - 1;
+  dy = (double)(p->ymin) - 1;
+
+  if (shared_edges) {
+    xout[0] = *mapping_4_ptr(p, xo, i-1, top);
+    yout[0] = *mapping_4_ptr(p, yo, i-1, top);
+    xout[1] = *mapping_4_ptr(p, xo, i, top);
+    yout[1] = *mapping_4_ptr(p, yo, i, top);
+    xout[2] = *mapping_4_ptr(p, xo, i, bottom);
+    yout[2] = *mapping_4_ptr(p, yo, i, bottom);
+    xout[3] = *mapping_4_ptr(p, xo, i-1, bottom);
+    yout[3] = *mapping_4_ptr(p, yo, i-1, bottom);
+  } else {
+    for (k = 0; k < 4; ++k) {
+      xout[k] = *mapping_4_ptr(p, xo, i, k);
+      yout[k] = *mapping_4_ptr(p, yo, i, k);
+    }
+  }
+
+  for (k = 0; k < 4; ++k) {
+    /* The offset by 1 here is needed to match the alignment in the
+       output frame generated by the other kernels (such as turbo).
+    */
+    xout[k] = xout[k] - dx - 1;
+    yout[k] = yout[k] - dy - 1;
+  }
+}
+
+/**
+Drop input pixel (i, j), whose corners on the output subset are
+\a xout, \a yout, onto the output using the "classic" drizzle square
+kernel.  The number of output pixels it overlaps is returned in
+\a nhit.
+*/
+static force_inline_macro int
+drop_square(struct driz_param_t* p, const integer_t i, const integer_t j,
+            double xout[4], double yout[4],
+            /* Input/output parameters */
+            integer_t* oldcon, integer_t* newcon,
+            /* Output parameters */
+            integer_t* nhit, struct driz_error_t* error,
+            const integer_t drop) {
+  integer_t ii, jj, min_ii, max_ii, min_jj, max_jj, ii0, nii;
+  integer_t row_min_ii, row_max_ii;
+  float vc, d, dow;
+  double jaco, tem, dover, w, row_xmin, row_xmax;
+  double dover_row[SQUARE_ROW_CHUNK];
+  struct boxer_quad_t quad;
+
+  /* Work out the area of the quadrilateral on the output grid.
+     Note that this expression expects the points to be in clockwise
+     order */
+  jaco = 0.5f * ((xout[1] - xout[3]) * (yout[0] - yout[2]) -
+                 (xout[0] - xout[2]) * (yout[1] - yout[3]));
+  if (jaco < 0.0) {
+    jaco *= -1.0;
+    /* Swap */
+    tem = xout[1]; xout[1] = xout[3]; xout[3] = tem;
+    tem = yout[1]; yout[1] = yout[3]; yout[3] = tem;
+  }
+  *nhit = 0;
+
+  /* Allow for stretching because of scale change */
+  d = *data_ptr(p, i-1, j) * p->data_scale * (float)p->scale2;
+
+  /* Scale the weighting mask by the scale factor and inversely by
+     the Jacobian to ensure conservation of weight in the output */
+  if (drop_has_weights(p, drop)) {
+    w = *weights_ptr(p, i-1, j) * p->weight_scale;
+  } else {
+    w = 1.0;
+  }
+
+  /* Loop over output pixels which could be affected */
+  min_jj = MAX(fortran_round(min_doubles(yout, 4)), p->row0);
+  max_jj = MIN(fortran_round(max_doubles(yout, 4)), p->row1 - 1);
+  min_ii = MAX(fortran_round(min_doubles(xout, 4)), p->col0);
+  max_ii = MIN(fortran_round(max_doubles(xout, 4)), p->col1 - 1);
+
+  boxer_init(xout, yout, &quad);
+
+  for (jj = min_jj; jj <= max_jj; ++jj) {
+    /* Only visit the part of the row the quadrilateral crosses:
+       with rotated frames the bounding box can be twice as big.
+       A few pixels either way cost less to compute than to trim. */
+    if (!boxer_row_init(&quad, (double)jj, &row_xmin, &row_xmax)) {
+      continue;
+    }
+    row_min_ii = min_ii;
+    row_max_ii = max_ii;
+    if (max_ii - min_ii >= SQUARE_ROW_TRIM) {
+      row_min_ii = MAX(fortran_round(row_xmin), min_ii);
+      row_max_ii = MIN(fortran_round(row_xmax), max_ii);
+    }
+
+    for (ii0 = row_min_ii; ii0 <= row_max_ii; ii0 += SQUARE_ROW_CHUNK) {
+      nii = MIN(row_max_ii - ii0 + 1, SQUARE_ROW_CHUNK);
+
+      /* Calculate the overlap with a whole run of the row at once */
+      boxer_row(&quad, ii0, nii, dover_row);
+
+      for (ii = ii0; ii < ii0 + nii; ++ii) {
+        dover = dover_row[ii - ii0];
+
+        if (dover > 0.0) {
+          /* Re-normalise the area overlap using the Jacobian */
+          dover /= jaco;
+
+          /* Count the hits */
+          ++(*nhit);
+
+          vc = *output_counts_ptr(p, ii, jj);
+          dow = (float)(dover * w);
+
+          /* If we are creating or modifying the context image we do
+             so here */
+          if (update_context(p, ii, jj, dow, oldcon, newcon, error, drop)) {
+            return 1;
+          }
+
+          update_data(p, ii, jj, d, vc, dow, drop);
+        }
+      }
+    }
+  }
+
+  return 0;
+}
+
+typedef int (*drop_square_t)(struct driz_param_t*,
+                             const integer_t, const integer_t,
+                             double*, double*,
+                             integer_t*, integer_t*,
+                             integer_t*, struct driz_error_t*);
+
+/* As KERNEL_VARIANTS, for drop_square */
+#define DROP_SQUARE_VARIANT(drop)                                       \
+  static int                                                            \
+  drop_square_##drop(struct driz_param_t* p,                            \
+                     const integer_t i, const integer_t j,              \
+                     double xout[4], double yout[4],                    \
+                     integer_t* oldcon, integer_t* newcon,              \
+                     integer_t* nhit, struct driz_error_t* error) {     \
+    return drop_square(p, i, j, xout, yout, oldcon, newcon, nhit, error, drop); \
+  }
+
+DROP_SQUARE_VARIANT(0) DROP_SQUARE_VARIANT(1)
+DROP_SQUARE_VARIANT(2) DROP_SQUARE_VARIANT(3)
+DROP_SQUARE_VARIANT(4) DROP_SQUARE_VARIANT(5)
+DROP_SQUARE_VARIANT(6) DROP_SQUARE_VARIANT(7)
+DROP_SQUARE_VARIANT(8)
+
+static const drop_square_t
+drop_square_variants[DROP_NVARIANTS] = {
+  drop_square_0, drop_square_1, drop_square_2, drop_square_3,
+  drop_square_4, drop_square_5, drop_square_6, drop_square_7, drop_square_8
+};
+
+static int
+do_kernel_square(struct driz_param_t* p,
+                 const integer_t j, double y,
+                 const integer_t x1, const integer_t x2,
+                 const integer_t last_x1, const integer_t last_x2,
+                 /* Input/output parameters */
+                 double* xi, double* yi,
+                 double* xtmp, double* ytmp,
+                 double* xo, double* yo,
+                 integer_t* oldcon, integer_t* newcon, integer_t* nmiss,
+                 struct driz_error_t* error) {
+  const drop_square_t drop_handler = drop_square_variants[drop_variant(p)];
+  integer_t i, nhit, top, bottom;
+  double xout[4], yout[4];
+  bool_t shared_edges;
+
+  /* TODO: These are constant across calls -- perhaps cache??? */
+  shared_edges = (bool_t)(p->pixel_fraction == 1.0 && p->x_scale == 1.0);
+
+  /* Next the "classic" drizzle square kernel...  this is different
+     because we have to transform all four corners of the shrunken
+     pixel */
+  if (map_square_corners(p, j, y, x1, x2, last_x1, last_x2, shared_edges,
+                         xi, yi, xtmp, ytmp, xo, yo, &top, &bottom, error)) {
+    return 1;
+  }
+
+  for (i = x1; i <= x2; ++i) {
+    get_square_corners(p, i, shared_edges, top, bottom, xo, yo, xout, yout);
+
+    if (drop_handler(p, i, j, xout, yout, oldcon, newcon, &nhit, error)) {
+      return 1;
+    }
+
+    /* Count cases where the pixel is off the output image */
+    if (nhit == 0) ++(*nmiss);
+  }
+
+  return 0;
+}
+
+/* One function per DROP_* combination (the last one DROP_GENERIC) for
+   each kernel, and a table of them indexed by drop_variant */
+#define KERNEL_VARIANT(kernel, drop)                                    \
+  static int                                                            \
+  kernel##_##drop(struct driz_param_t* p, const integer_t j,            \
+                  const integer_t x1, const integer_t x2,               \
+                  double* xo, double* yo,                               \
+                  integer_t* oldcon, integer_t* newcon, integer_t* nmiss, \
+                  struct driz_error_t* error) {                         \
+    return kernel(p, j, x1, x2, xo, yo, oldcon, newcon, nmiss, error, drop); \
+  }
+
+#define KERNEL_VARIANTS(kernel)                                         \
+  KERNEL_VARIANT(kernel, 0) KERNEL_VARIANT(kernel, 1)                   \
+  KERNEL_VARIANT(kernel, 2) KERNEL_VARIANT(kernel, 3)                   \
+  KERNEL_VARIANT(kernel, 4) KERNEL_VARIANT(kernel, 5)                   \
+  KERNEL_VARIANT(kernel, 6) KERNEL_VARIANT(kernel, 7)                   \
+  KERNEL_VARIANT(kernel, 8)                                             \
+  static const kernel_handler_t                                         \
+  kernel##_variants[DROP_NVARIANTS] = {                                 \
+    kernel##_0, kernel##_1, kernel##_2, kernel##_3,                     \
+    kernel##_4, kernel##_5, kernel##_6, kernel##_7, kernel##_8          \
+  };
+
+KERNEL_VARIANTS(do_kernel_point)
+KERNEL_VARIANTS(do_kernel_tophat)
+KERNEL_VARIANTS(do_kernel_gaussian)
+KERNEL_VARIANTS(do_kernel_gaussian_lut)
+KERNEL_VARIANTS(do_kernel_lanczos)
+KERNEL_VARIANTS(do_kernel_turbo)
+
+static const kernel_handler_t*
+kernel_handler_map[] = {
+  NULL,
+  do_kernel_gaussian_variants,
+  do_kernel_point_variants,
+  do_kernel_tophat_variants,
+  do_kernel_turbo_variants,
+  do_kernel_lanczos_variants,
+  do_kernel_lanczos_variants
+};
+
+/***************************************************************************
+ TILED TRAVERSAL
+
+ With the square kernel, each input line scatters its flux along a
+ stripe of the output, and when the input is rotated with respect to
+ the output that stripe cuts across many more output lines than there
+ are output pixels it covers.  On large outputs successive lines then
+ find little of the stripe still in cache.
+
+ When p->tile_size is set, the corners of a block of input lines are
+ transformed first, and the pixels of the block are then dropped tile
+ by tile, visiting the tiles in Morton (Z) order.  The output data,
+ counts and context of a tile stay in cache while all of the block's
+ pixels on it are dropped.
+
+ A pixel is dropped on each tile that its drop can reach, clipped to
+ the tile, and the pixels on a tile are dropped in input order.  The
+ drops onto any one output pixel thus come in the same order as line
+ by line, and the output is identical to it.
+*/
+
+/* Input pixels transformed and sorted at a time */
+#define TILED_BLOCK_PIXELS 65536
+
+/**
+Interleave the bits of \a x and \a y (both below 2^16), giving the
+Morton key of the tile (x, y).
+*/
+static inline_macro unsigned int
+morton_key(unsigned int x, unsigned int y) {
+  x &= 0xffff;
+  x = (x | (x << 8)) & 0x00ff00ff;
+  x = (x | (x << 4)) & 0x0f0f0f0f;
+  x = (x | (x << 2)) & 0x33333333;
+  x = (x | (x << 1)) & 0x55555555;
+
+  y &= 0xffff;
+  y = (y | (y << 8)) & 0x00ff00ff;
+  y = (y | (y << 4)) & 0x0f0f0f0f;
+  y = (y | (y << 2)) & 0x33333333;
+  y = (y | (y << 1)) & 0x55555555;
+
+  return x | (y << 1);
+}
+
+/**
+Find the tiles [*t0, *t1] along one axis that a square drop with
+corners \a v (x or y) can reach on an output of \a size pixels.  The
+output pixels are rounded as \a drop_square rounds them; *t0 > *t1 when
+the drop misses the output, or could not be transformed.
+*/
+static inline_macro void
+drop_tiles(const double v[4], const integer_t size, const integer_t tile,
+           /* Output parameters */
+           integer_t* t0, integer_t* t1) {
+  double lo = min_doubles(v, 4);
+  double hi = max_doubles(v, 4);
+  integer_t i0, i1;
+
+  lo = CLAMP(lo, -1.0, (double)size);
+  hi = CLAMP(hi, -1.0, (double)size);
+  i0 = MAX(fortran_round(lo), 0);
+  i1 = MIN(fortran_round(hi), size - 1);
+  if (i0 > i1) {
+    *t0 = 0;
+    *t1 = -1;
+  } else {
+    *t0 = i0 / tile;
+    *t1 = i1 / tile;
+  }
+}
+
+/**
+Drizzle the input lines [j0, j1) with the square kernel, dropping the
+pixels of each block of lines tile by tile.  The result is the same as
+that of \a dobox_rows.
+*/
+static int
+dobox_rows_tiled(struct driz_param_t* p, const integer_t ystart,
+                 const integer_t j0, const integer_t j1,
+                 const integer_t* given_x1, const integer_t* given_x2,
+                 /* Output parameters */
+                 integer_t* nmiss, integer_t* nskip,
+                 struct driz_error_t* error) {
+  /* Keep the tile numbers within the 16 bits morton_key takes */
+  const integer_t tile = MAX(p->tile_size, MAX(p->nsx, p->nsy) / 0xffff + 1);
+  const integer_t block_lines = MAX(TILED_BLOCK_PIXELS / p->dnx, 1);
+  const drop_square_t drop_handler = drop_square_variants[drop_variant(p)];
+  const size_t block_pixels = (size_t)block_lines * (size_t)p->dnx;
+  const integer_t row0 = p->row0;
+  const integer_t row1 = p->row1;
+  const integer_t col0 = p->col0;
+  const integer_t col1 = p->col1;
+  integer_t j, jb, i, k, n, x1, x2, last_x1, last_x2, top, bottom, nhit;
+  integer_t tx, ty, tx0, tx1, ty0, ty1, e, nentries;
+  double y;
+  integer_t oldcon, newcon;
+  bool_t shared_edges;
+  unsigned int nkeys, key;
+  size_t new_buffer_size, max_keys = 0, max_entries = 0;
+  double* xi = NULL;
+  double* yi = NULL;
+  double* xtmp = NULL;
+  double* ytmp = NULL;
+  double* xo = NULL;
+  double* yo = NULL;
+  /* Per pixel of the block: its output corners, line, column, the
+     tiles its drop can reach and whether it hit anything */
+  double* corners = NULL;
+  integer_t* pixel_j = NULL;
+  integer_t* pixel_i = NULL;
+  integer_t* pixel_tx0 = NULL;
+  integer_t* pixel_tx1 = NULL;
+  integer_t* pixel_ty0 = NULL;
+  integer_t* pixel_ty1 = NULL;
+  unsigned char* pixel_hit = NULL;
+  /* Per drop onto a tile, sorted by tile: the pixel and the tile */
+  integer_t* entry_pixel = NULL;
+  integer_t* entry_tx = NULL;
+  integer_t* entry_ty = NULL;
+  integer_t* first = NULL;
+  integer_t* span_x1 = NULL;
+  integer_t* span_x2 = NULL;
+  const integer_t* line_x1;
+  const integer_t* line_x2;
+
+  assert(p);
+  assert(p->kernel == kernel_square);
+  assert(p->tile_size > 0);
+  assert(nmiss);
+  assert(nskip);
+  assert(error);
+
+  oldcon = -1;
+  shared_edges = (bool_t)(p->pixel_fraction == 1.0 && p->x_scale == 1.0);
+
+  new_buffer_size = (size_t)p->dnx * 4;
+  xi = malloc(new_buffer_size * sizeof(double));
+  yi = malloc(new_buffer_size * sizeof(double));
+  xtmp = malloc(new_buffer_size * sizeof(double));
+  ytmp = malloc(new_buffer_size * sizeof(double));
+  xo = malloc((new_buffer_size + 1) * sizeof(double));
+  yo = malloc((new_buffer_size + 1) * sizeof(double));
+  corners = malloc(block_pixels * 8 * sizeof(double));
+  pixel_j = malloc(block_pixels * sizeof(integer_t));
+  pixel_i = malloc(block_pixels * sizeof(integer_t));
+  pixel_tx0 = malloc(block_pixels * sizeof(integer_t));
+  pixel_tx1 = malloc(block_pixels * sizeof(integer_t));
+  pixel_ty0 = malloc(block_pixels * sizeof(integer_t));
+  pixel_ty1 = malloc(block_pixels * sizeof(integer_t));
+  pixel_hit = malloc(block_pixels);
+  if (given_x1 == NULL) {
+    span_x1 = malloc((size_t)(j1 - j0) * sizeof(integer_t));
+    span_x2 = malloc((size_t)(j1 - j0) * sizeof(integer_t));
+  }
+  if (xi == NULL || yi == NULL || xtmp == NULL || ytmp == NULL ||
+      xo == NULL || yo == NULL || corners == NULL ||
+      pixel_j == NULL || pixel_i == NULL ||
+      pixel_tx0 == NULL || pixel_tx1 == NULL ||
+      pixel_ty0 == NULL || pixel_ty1 == NULL || pixel_hit == NULL ||
+      (given_x1 == NULL && (span_x1 == NULL || span_x2 == NULL))) {
+    driz_error_set_message(error, "Out of memory");
+    goto dobox_rows_tiled_exit_;
+  }
+
+  if (given_x1 != NULL) {
+    line_x1 = given_x1;
+    line_x2 = given_x2;
+  } else {
+    /* Check the overlap of each line with the output */
+    if (line_spans(p, ystart, j0, j1, 5, span_x1, span_x2, error)) {
+      goto dobox_rows_tiled_exit_;
+    }
+    line_x1 = span_x1;
+    line_x2 = span_x2;
+  }
+
+  last_x1 = p->dnx;
+  last_x2 = 0;
+  y = (double)(ystart + j0);
+  for (jb = j0; jb < j1; jb += block_lines) {
+    /* Transform the corners of every pixel of the block, noting the
+       output tiles each one can reach */
+    n = 0;
+    tx0 = p->nsx;
+    ty0 = p->nsy;
+    tx1 = ty1 = -1;
+    for (j = jb; j < MIN(jb + block_lines, j1); ++j) {
+      y += 1.0;
+      x1 = line_x1[j - j0];
+      x2 = line_x2[j - j0];
+
+      if (x1 > x2) {
+        /* If we are skipping a line, count it */
+        ++(*nskip);
+        *nmiss += p->dnx;
+        last_x1 = p->dnx;
+        last_x2 = 0;
+        continue;
+      }
+
+      assert(x1 > 0 && x1 <= p->dnx);
+      assert(x2 > 0 && x2 <= p->dnx);
+
+      /* We know there may be some misses */
+      *nmiss += p->dnx - (x2 - x1 + 1);
+
+      if (map_square_corners(p, j, y, x1, x2, last_x1, last_x2,
+                             shared_edges, xi, yi, xtmp, ytmp, xo, yo,
+                             &top, &bottom, error)) {
+        goto dobox_rows_tiled_exit_;
+      }
+      last_x1 = x1;
+      last_x2 = x2;
+
+      for (i = x1; i <= x2; ++i, ++n) {
+        get_square_corners(p, i, shared_edges, top, bottom, xo, yo,
+                           corners + 8*n, corners + 8*n + 4);
+        pixel_j[n] = j;
+        pixel_i[n] = i;
+
+        drop_tiles(corners + 8*n, p->nsx, tile,
+                   &pixel_tx0[n], &pixel_tx1[n]);
+        drop_tiles(corners + 8*n + 4, p->nsy, tile,
+                   &pixel_ty0[n], &pixel_ty1[n]);
+        if (pixel_ty0[n] > pixel_ty1[n]) {
+          /* Reaches no tile */
+          pixel_tx1[n] = pixel_tx0[n] - 1;
+        }
+        if (pixel_tx0[n] > pixel_tx1[n]) {
+          continue;
+        }
+        tx0 = MIN(tx0, pixel_tx0[n]);
+        tx1 = MAX(tx1, pixel_tx1[n]);
+        ty0 = MIN(ty0, pixel_ty0[n]);
+        ty1 = MAX(ty1, pixel_ty1[n]);
+      }
+    }
+
+    if (n == 0) {
+      continue;
+    }
+    memset(pixel_hit, 0, (size_t)n);
+
+    if (tx0 <= tx1) {
+      /* Counting sort of the drops by the Morton key of their tile,
+         relative to the tiles the block covers.  The drops on the same
+         tile keep their input order. */
+      nkeys = morton_key((unsigned int)(tx1 - tx0),
+                         (unsigned int)(ty1 - ty0)) + 1;
+      if (nkeys + 1 > max_keys) {
+        free(first);
+        max_keys = nkeys + 1;
+        first = malloc(max_keys * sizeof(integer_t));
+        if (first == NULL) {
+          driz_error_set_message(error, "Out of memory");
+          goto dobox_rows_tiled_exit_;
+        }
+      }
+      for (key = 0; key <= nkeys; ++key) {
+        first[key] = 0;
+      }
+      for (k = 0; k < n; ++k) {
+        for (ty = pixel_ty0[k]; ty <= pixel_ty1[k]; ++ty) {
+          for (tx = pixel_tx0[k]; tx <= pixel_tx1[k]; ++tx) {
+            ++first[morton_key((unsigned int)(tx - tx0),
+                               (unsigned int)(ty - ty0)) + 1];
+          }
+        }
+      }
+      for (key = 0; key < nkeys; ++key) {
+        first[key + 1] += first[key];
+      }
+      nentries = first[nkeys];
+      if ((size_t)nentries > max_entries) {
+        free(entry_pixel);
+        free(entry_tx);
+        free(entry_ty);
+        max_entries = (size_t)nentries;
+        entry_pixel = malloc(max_entries * sizeof(integer_t));
+        entry_tx = malloc(max_entries * sizeof(integer_t));
+        entry_ty = malloc(max_entries * sizeof(integer_t));
+        if (entry_pixel == NULL || entry_tx == NULL || entry_ty == NULL) {
+          driz_error_set_message(error, "Out of memory");
+          goto dobox_rows_tiled_exit_;
+        }
+      }
+      for (k = 0; k < n; ++k) {
+        for (ty = pixel_ty0[k]; ty <= pixel_ty1[k]; ++ty) {
+          for (tx = pixel_tx0[k]; tx <= pixel_tx1[k]; ++tx) {
+            e = first[morton_key((unsigned int)(tx - tx0),
+                                 (unsigned int)(ty - ty0))]++;
+            entry_pixel[e] = k;
+            entry_tx[e] = tx;
+            entry_ty[e] = ty;
+          }
+        }
+      }
+
+      /* Drop each pixel clipped to each of its tiles */
+      for (e = 0; e < nentries; ++e) {
+        p->col0 = MAX(entry_tx[e] * tile, col0);
+        p->col1 = MIN((entry_tx[e] + 1) * tile, col1);
+        p->row0 = MAX(entry_ty[e] * tile, row0);
+        p->row1 = MIN((entry_ty[e] + 1) * tile, row1);
+
+        i = entry_pixel[e];
+        if (drop_handler(p, pixel_i[i], pixel_j[i],
+                         corners + 8*i, corners + 8*i + 4,
+                         &oldcon, &newcon, &nhit, error)) {
+          goto dobox_rows_tiled_exit_;
+        }
+        if (nhit != 0) pixel_hit[i] = 1;
+      }
+      p->col0 = col0;
+      p->col1 = col1;
+      p->row0 = row0;
+      p->row1 = row1;
+    }
+
+    /* Count cases where the pixel is off the output image */
+    for (k = 0; k < n; ++k) {
+      if (!pixel_hit[k]) ++(*nmiss);
+    }
+  }
+
+ dobox_rows_tiled_exit_:
+  p->col0 = col0;
+  p->col1 = col1;
+  p->row0 = row0;
+  p->row1 = row1;
+  free(xi); xi = NULL;
+  free(yi); yi = NULL;
+  free(xo); xo = NULL;
+  free(yo); yo = NULL;
+  free(xtmp); xtmp = NULL;
+  free(ytmp); ytmp = NULL;
+  free(corners); corners = NULL;
+  free(pixel_j); pixel_j = NULL;
+  free(pixel_i); pixel_i = NULL;
+  free(pixel_tx0); pixel_tx0 = NULL;
+  free(pixel_tx1); pixel_tx1 = NULL;
+  free(pixel_ty0); pixel_ty0 = NULL;
+  free(pixel_ty1); pixel_ty1 = NULL;
+  free(pixel_hit); pixel_hit = NULL;
+  free(entry_pixel); entry_pixel = NULL;
+  free(entry_tx); entry_tx = NULL;
+  free(entry_ty); entry_ty = NULL;
+  free(first); first = NULL;
+  free(span_x1); span_x1 = NULL;
+  free(span_x2); span_x2 = NULL;
+
+  return driz_error_is_set(error);
+}
+
+/**
+Get \a size bytes of line buffers: those of p->workspace, grown as
+needed, when there is one, otherwise a block of their own returned
+also in \a owned for the caller to free.
+*/
+static void*
+get_line_buffers(struct driz_param_t* p, const size_t size,
+                 /* Output parameters */
+                 void** owned, struct driz_error_t* error) {
+  struct dobox_workspace_t* w = p->workspace;
+
+  *owned = NULL;
+  if (w == NULL) {
+    if ((*owned = malloc(size)) == NULL) {
+      driz_error_set_message(error, "Out of memory");
+    }
+    return *owned;
+  }
+
+  if (w->lines_size < size) {
+    free(w->lines);
+    w->lines_size = 0;
+    if ((w->lines = malloc(size)) == NULL) {
+      driz_error_set_message(error, "Out of memory");
+      return NULL;
+    }
+    w->lines_size = size;
+  }
+
+  return w->lines;
+}
+
+/**
+Drizzle the input lines [j0, j1) onto the output subset described by
+\a p.  All of the kernel set-up (pfo, lookup tables etc.) must already
+have been done by \a dobox.
+
+\a given_x1 and \a given_x2, when not NULL, are the spans of the lines
+from \a line_spans, worked out by the caller; otherwise they are worked
+out here.
+*/
+static int
+dobox_rows(struct driz_param_t* p, const integer_t ystart,
+           const integer_t j0, const integer_t j1,
+           const integer_t* given_x1, const integer_t* given_x2,
+           kernel_handler_t kernel_handler,
+           /* Output parameters */
+           integer_t* nmiss, integer_t* nskip, struct driz_error_t* error) {
+  integer_t j, x1, x2, last_x1, last_x2;
+  double y, dh;
+  integer_t oldcon, newcon;
+  integer_t* span_x1 = NULL;
+  integer_t* span_x2 = NULL;
+  const integer_t* line_x1;
+  const integer_t* line_x2;
+  double* xi = NULL;
+  double* yi = NULL;
+  double* xtmp = NULL;
+  double* ytmp = NULL;
+  double* xo = NULL;
+  double* yo = NULL;
+  void* memory = NULL;
+  void* owned = NULL;
+  double* footprint = NULL;
+  size_t new_buffer_size;
+  size_t footprint_size;
+
+  assert(p);
+  assert(nmiss);
+  assert(nskip);
+  assert(error);
+
+  if (p->kernel == kernel_square && p->tile_size > 0) {
+    return dobox_rows_tiled(p, ystart, j0, j1, given_x1, given_x2,
+                            nmiss, nskip, error);
+  }
+
+  /* Some initial settings - note that the reference pixel position is
+     determined by the value of ALIGN */
+  oldcon = -1;
+
+  /* Before we start we can fill the X arrays as they don't change
+     with Y */
+  new_buffer_size = (size_t)((p->kernel == kernel_square) ? p->dnx*4 : p->dnx);
+
+  /* The separable kernels keep the x factors of a drop, across its
+     footprint */
+  footprint_size = (p->kernel == kernel_gaussian ||
+                    p->kernel == kernel_lanczos2 ||
+                    p->kernel == kernel_lanczos3) ?
+    (size_t)(2.0 * p->pfo) + 3 : 0;
+
+  /* One block for the lot: xi, yi, xtmp, ytmp, xo and yo (the last
+     two one longer), the x factors, then the span of each line */
+  memory = get_line_buffers(
+      p, (6 * new_buffer_size + 2 + footprint_size) * sizeof(double) +
+      (given_x1 ? 0 : 2 * (size_t)(j1 - j0) * sizeof(integer_t)),
+      &owned, error);
+  if (memory == NULL) {
+    goto dobox_rows_exit_;
+  }
+  xi = (double*)memory;
+  yi = xi + new_buffer_size;
+  xtmp = yi + new_buffer_size;
+  ytmp = xtmp + new_buffer_size;
+  xo = ytmp + new_buffer_size;
+  yo = xo + new_buffer_size + 1;
+  footprint = yo + new_buffer_size + 1;
+  span_x1 = (integer_t*)(footprint + footprint_size);
+  span_x2 = span_x1 + (j1 - j0);
+  p->gaussian.x = footprint;
+  p->lanczos.x = (float*)footprint;
+
+  if (given_x1 != NULL) {
+    line_x1 = given_x1;
+    line_x2 = given_x2;
+  } else {
+    /* Check the overlap of each line with the output */
+    if (line_spans(p, ystart, j0, j1, 5, span_x1, span_x2, error)) {
+      goto dobox_rows_exit_;
+    }
+    line_x1 = span_x1;
+    line_x2 = span_x2;
+  }
+
+  if (p->kernel == kernel_square) {
+    dh = 0.5 * p->pixel_fraction;
+    *mapping_4_ptr(p, xi, 1, 0) = 1.0 - dh;
+    *mapping_4_ptr(p, xi, 1, 1) = 1.0 + dh;
+    *mapping_4_ptr(p, xi, 1, 2) = 1.0 + dh;
+    *mapping_4_ptr(p, xi, 1, 3) = 1.0 - dh;
+  } else {
+    *mapping_ptr(p, xi, 0) = 1.0;
+  }
+
+  /* This is the outer loop over all the lines in the input image */
+  last_x1 = p->dnx;
+  last_x2 = 0;
+  y = (double)(ystart + j0);
+  for (j = j0; j < j1; ++j) {
+    y += 1.0;
+    x1 = line_x1[j - j0];
+    x2 = line_x2[j - j0];
+
+    /* If the line falls completely off the output, then skip it */
+    if (x1 <= x2) {
+      assert(x1 > 0 && x1 <= p->dnx);
+      assert(x2 > 0 && x2 <= p->dnx);
+
+      /* We know there may be some misses */
+      *nmiss += p->dnx - (x2 - x1 + 1);
+
+      /* Don't read past the edge of the image
+      if (x2 == p->dnx) {
+          x2 -= 1;
+      }
+      */
+      /* At this point we can handle the different kernels separately.
+         First the cases where we just transform a single point rather
+         than four - every case except the "classic" square-pixel
+         kernel */
+      if (p->kernel != kernel_square) {
+        *mapping_ptr(p, xi, x1) = (double)x1;
+
+        *mapping_ptr(p, yi, x1) = y;
+        *mapping_ptr(p, yi, x1+1) = 0.0;
+
+
+        if (map_value(p, TRUE, x2 - x1 + 1,
+                      mapping_ptr(p, xi, x1), mapping_ptr(p, yi, x1),
+                      xtmp, ytmp,
+                      mapping_ptr(p, xo, x1), mapping_ptr(p, yo, x1), error)) {
+          goto dobox_rows_exit_;
+        }
+
+        if (kernel_handler(p, y, x1, x2, xo, yo,
+                           &oldcon, &newcon, nmiss, error)) {
+          goto dobox_rows_exit_;
+        }
+      } else {
+        if (do_kernel_square(p, j, y, x1, x2, last_x1, last_x2,
+                             xi, yi, xtmp, ytmp, xo, yo,
+                             &oldcon, &newcon, nmiss, error)) {
+          goto dobox_rows_exit_;
+        }
+      }
+      last_x1 = x1;
+      last_x2 = x2;
+    } else {
+      /* If we are skipping a line, count it */
+      ++(*nskip);
+      *nmiss += p->dnx;
+      last_x1 = p->dnx;
+      last_x2 = 0;
+    }
+  }
+
+ dobox_rows_exit_:
+  p->gaussian.x = NULL;
+  p->lanczos.x = NULL;
+  free(owned); owned = NULL;
+
+  return driz_error_is_set(error);
+}
+
+/***************************************************************************
+ MULTI-THREADED DRIZZLING
+
+ The input lines are split into one band per thread.  Each band is
+ drizzled into its own private output tile, which covers the part of
+ the output subset that the band can reach, and the tiles are then
+ merged into the output in band order, so the result does not depend on
+ how the threads were scheduled.  It does depend, to rounding, on the
+ number of threads, since that sets where the bands split; gather mode
+ does not.
+
+ The tiles of a rotated input each reach across much of the output, so
+ together they may be many times its size.  Above DOBOX_TILE_BUDGET
+ times the pixels of the output subset, the kernels that can be
+ gathered are, and the others are split into fewer bands, down to
+ drizzling line by line.  The merge is split over the threads by strips
+ of output rows, each merging all of the tiles, in band order, over its
+ own rows.
+*/
+
+/* Most pixels in all of the tiles together, per output subset pixel */
+#define DOBOX_TILE_BUDGET 2
+
+struct dobox_band_t {
+  /* Private copy of the parameters, with the output pointing at the
+     tile */
+  struct driz_param_t* p;
+  integer_t ystart;
+  integer_t j0;
+  integer_t j1;
+  /* Spans of the lines [j0, j1), from the whole input */
+  const integer_t* x1;
+  const integer_t* x2;
+  kernel_handler_t kernel_handler;
+
+  /* Extent of the tile within the output subset */
+  integer_t tx0;
+  integer_t tx1;
+  integer_t ty0;
+  integer_t ty1;
+
+  integer_t nmiss;
+  integer_t nskip;
+  struct driz_error_t error;
+};
+
+/**
+Find the part of the output subset that the input lines [j0, j1) can
+drop flux onto, as 0-based index ranges [ix0, ix1] x [iy0, iy1].
+
+The outline of the band (traced through the pixel edges) is
+transformed onto the output grid and its bounding box is padded by the
+kernel footprint.
+*/
+static int
+band_footprint(struct driz_param_t* p, const integer_t ystart,
+               const integer_t j0, const integer_t j1,
+               /* Output parameters */
+               integer_t* ix0, integer_t* ix1,
+               integer_t* iy0, integer_t* iy1,
+               struct driz_error_t* error) {
+  const integer_t nxe = p->dnx + 1;
+  const integer_t nye = j1 - j0 + 1;
+  const integer_t n = 2 * (nxe + nye);
+  double* memory = NULL;
+  double *xin, *yin, *xtmp, *ytmp, *xout, *yout;
+  double xlo, xhi, ylo, yhi, margin;
+  integer_t i, k;
+
+  memory = malloc((size_t)n * 6 * sizeof(double));
+  if (memory == NULL) {
+    driz_error_set_message(error, "Out of memory");
+    return 1;
+  }
+  xin = memory;
+  yin = xin + n;
+  xtmp = yin + n;
+  ytmp = xtmp + n;
+  xout = ytmp + n;
+  yout = xout + n;
+
+  /* Bottom and top edges, then left and right edges */
+  k = 0;
+  for (i = 0; i < nxe; ++i, ++k) {
+    xin[k] = (double)i + 0.5;
+    yin[k] = (double)(ystart + j0) + 0.5;
+    xin[k + nxe] = (double)i + 0.5;
+    yin[k + nxe] = (double)(ystart + j1) + 0.5;
+  }
+  k += nxe;
+  for (i = 0; i < nye; ++i, ++k) {
+    xin[k] = 0.5;
+    yin[k] = (double)(ystart + j0 + i) + 0.5;
+    xin[k + nye] = (double)p->dnx + 0.5;
+    yin[k + nye] = (double)(ystart + j0 + i) + 0.5;
+  }
+
+  if (map_value(p, FALSE, n, xin, yin, xtmp, ytmp, xout, yout, error)) {
+    free(memory);
+    return 1;
+  }
+
+  xlo = ylo = MAX_DOUBLE;
+  xhi = yhi = -MAX_DOUBLE;
+  for (i = 0; i < n; ++i) {
+    /* Points that could not be transformed are ignored */
+    if (xout[i] != xout[i] || yout[i] != yout[i])
+      continue;
+    xlo = MIN(xlo, xout[i]);
+    xhi = MAX(xhi, xout[i]);
+    ylo = MIN(ylo, yout[i]);
+    yhi = MAX(yhi, yout[i]);
+  }
+  free(memory);
+
+  if (xlo > xhi || ylo > yhi) {
+    /* Nothing could be transformed: fall back to the whole subset */
+    *ix0 = 0;
+    *ix1 = p->nsx - 1;
+    *iy0 = 0;
+    *iy1 = p->nsy - 1;
+    return 0;
+  }
+
+  /* Half the kernel footprint, plus rounding, on output */
+  margin = ceil(p->pfo) + 2.0;
+
+  xlo = CLAMP(floor(xlo - (double)p->xmin - margin), 0.0, (double)(p->nsx - 1));
+  xhi = CLAMP(ceil(xhi - (double)p->xmin + margin), xlo, (double)(p->nsx - 1));
+  ylo = CLAMP(floor(ylo - (double)p->ymin - margin), 0.0, (double)(p->nsy - 1));
+  yhi = CLAMP(ceil(yhi - (double)p->ymin + margin), ylo, (double)(p->nsy - 1));
+
+  *ix0 = (integer_t)xlo;
+  *ix1 = (integer_t)xhi;
+  *iy0 = (integer_t)ylo;
+  *iy1 = (integer_t)yhi;
+
+  return 0;
+}
+
+static void*
+dobox_band_thread(void* state) {
+  struct dobox_band_t* band = (struct dobox_band_t*)state;
+
+  (void)dobox_rows(band->p, band->ystart, band->j0, band->j1,
+                   band->x1, band->x2, band->kernel_handler, &band->nmiss, &band->nskip,
+                   &band->error);
+
+  return NULL;
+}
+
+/* The output rows [row0, row1) that one thread merges the tiles over */
+struct merge_strip_t {
+  struct driz_param_t* p;
+  struct dobox_band_t* bands;
+  integer_t nbands;
+  integer_t row0;
+  integer_t row1;
+};
+
+/**
+Merge the rows [row0, row1) of the output subset from one band's tile
+into the output.  The tile holds the weighted mean (or, with
+p->accumulate, the weighted sum) and total weight of just that band,
+which combine with the output exactly the way \a update_data combines
+single drops.
+*/
+static void
+merge_band_tile(struct driz_param_t* p, struct dobox_band_t* band,
+                const integer_t row0, const integer_t row1) {
+  struct driz_param_t* bp = band->p;
+  const integer_t jj1 = MIN(row1 - band->ty0, bp->nsy);
+  integer_t ii, jj, ci, cj;
+  float vc, tc, td;
+  double vc_plus_tc;
+
+  for (jj = MAX(row0 - band->ty0, 0); jj < jj1; ++jj) {
+    cj = jj + band->ty0;
+    for (ii = 0; ii < bp->nsx; ++ii) {
+      ci = ii + band->tx0;
+
+      if (bp->output_context) {
+        *output_context_ptr(p, ci, cj) |= *output_context_ptr(bp, ii, jj);
+      }
+
+      tc = *output_counts_ptr(bp, ii, jj);
+      td = *output_data_ptr(bp, ii, jj);
+      /* Untouched tile pixels are left alone.  Drops with zero weight
+         still set the value of an empty output pixel, as in
+         update_data. */
+      if (tc == 0.0 && td == 0.0 &&
+          (p->output_compensation == NULL ||
+           *output_compensation_ptr(bp, 1, ii, jj) == 0.0)) {
+        continue;
+      }
+
+      vc = *output_counts_ptr(p, ci, cj);
+      vc_plus_tc = vc + tc;
+
+      if (p->output_compensation) {
+        /* Add up the sums and their error terms separately */
+        if (vc == 0.0 && *output_compensation_ptr(p, 1, ci, cj) == 0.0) {
+          *output_data_ptr(p, ci, cj) = 0.0;
+          *output_compensation_ptr(p, 0, ci, cj) = 0.0;
+          *output_compensation_ptr(p, 1, ci, cj) = 0.0;
+        }
+        compensated_add(output_data_ptr(p, ci, cj),
+                        output_compensation_ptr(p, 0, ci, cj), td);
+        compensated_add(output_counts_ptr(p, ci, cj),
+                        output_compensation_ptr(p, 1, ci, cj), tc);
+        *output_compensation_ptr(p, 0, ci, cj) +=
+          *output_compensation_ptr(bp, 0, ii, jj);
+        *output_compensation_ptr(p, 1, ci, cj) +=
+          *output_compensation_ptr(bp, 1, ii, jj);
+        continue;
+      }
+
+      if (vc == 0.0) {
+        *output_data_ptr(p, ci, cj) = td;
+      } else if (p->accumulate) {
+        *output_data_ptr(p, ci, cj) += td;
+      } else if (vc_plus_tc != 0.0) {
+        *output_data_ptr(p, ci, cj) =
+          (*output_data_ptr(p, ci, cj) * vc + tc * td) / vc_plus_tc;
+      }
+
+      *output_counts_ptr(p, ci, cj) = vc_plus_tc;
+    }
+  }
+}
+
+static void*
+merge_strip_thread(void* state) {
+  struct merge_strip_t* strip = (struct merge_strip_t*)state;
+  integer_t i;
+
+  for (i = 0; i < strip->nbands; ++i) {
+    merge_band_tile(strip->p, &strip->bands[i], strip->row0, strip->row1);
+  }
+
+  return NULL;
+}
+
+static void
+free_dobox_bands(struct dobox_band_t* bands, const integer_t nbands) {
+  integer_t i;
+
+  if (bands == NULL)
+    return;
+
+  for (i = 0; i < nbands; ++i) {
+    if (bands[i].p != NULL) {
+      /* An interleaved tile is a single allocation */
+      free(bands[i].p->output_data);
+      if (bands[i].p->output_stride == 1) {
+        free(bands[i].p->output_counts);
+        free(bands[i].p->output_context);
+      }
+      free(bands[i].p->output_compensation);
+      free(bands[i].p);
+    }
+  }
+  free(bands);
+}
+
+static int
+dobox_gather(struct driz_param_t* p, const integer_t ystart,
+             kernel_handler_t kernel_handler,
+             /* Output parameters */
+             integer_t* nmiss, integer_t* nskip, struct driz_error_t* error);
+
+static int
+dobox_threaded(struct driz_param_t* p, const integer_t ystart,
+               kernel_handler_t kernel_handler,
+               /* Output parameters */
+               integer_t* nmiss, integer_t* nskip, struct driz_error_t* error) {
+  const size_t budget =
+    DOBOX_TILE_BUDGET * (size_t)p->nsx * (size_t)p->nsy;
+  integer_t nbands = MIN(p->nthreads, p->ny);
+  struct dobox_band_t* bands = NULL;
+  struct merge_strip_t* strips = NULL;
+  void** args = NULL;
+  integer_t* span_x1 = NULL;
+  integer_t* span_x2 = NULL;
+  struct driz_param_t* bp;
+  integer_t i, ix0, ix1, iy0, iy1;
+  size_t tile_size, total_size;
+
+  bands = calloc((size_t)nbands, sizeof(struct dobox_band_t));
+  strips = malloc((size_t)nbands * sizeof(struct merge_strip_t));
+  args = malloc((size_t)nbands * sizeof(void*));
+  span_x1 = malloc((size_t)p->ny * sizeof(integer_t));
+  span_x2 = malloc((size_t)p->ny * sizeof(integer_t));
+  if (bands == NULL || strips == NULL || args == NULL ||
+      span_x1 == NULL || span_x2 == NULL) {
+    driz_error_set_message(error, "Out of memory");
+    goto dobox_threaded_exit_;
+  }
+
+  /* The spans come from one grid over the whole input, so that the
+     lines skipped do not depend on how it is split into bands */
+  if (line_spans(p, ystart, 0, p->ny, 5, span_x1, span_x2, error)) {
+    goto dobox_threaded_exit_;
+  }
+
+  /* Find the tile of each band, with fewer bands while the tiles take
+     up more than the budget */
+  for (;;) {
+    total_size = 0;
+    for (i = 0; i < nbands; ++i) {
+      bands[i].j0 = (integer_t)(((size_t)p->ny * i) / nbands);
+      bands[i].j1 = (integer_t)(((size_t)p->ny * (i + 1)) / nbands);
+      if (band_footprint(p, ystart, bands[i].j0, bands[i].j1,
+                         &ix0, &ix1, &iy0, &iy1, error)) {
+        goto dobox_threaded_exit_;
+      }
+      bands[i].tx0 = ix0;
+      bands[i].tx1 = ix1;
+      bands[i].ty0 = iy0;
+      bands[i].ty1 = iy1;
+      total_size += (size_t)(ix1 - ix0 + 1) * (size_t)(iy1 - iy0 + 1);
+    }
+    if (total_size <= budget) {
+      break;
+    }
+
+    if (p->kernel == kernel_square || p->kernel == kernel_point ||
+        p->kernel == kernel_turbo) {
+      DRIZLOG("-%d band tiles of %lu pixels in all, gathering instead\n",
+              (int)nbands, (unsigned long)total_size);
+      (void)dobox_gather(p, ystart, kernel_handler, nmiss, nskip, error);
+      goto dobox_threaded_exit_;
+    }
+
+    nbands /= 2;
+    if (nbands == 1) {
+      DRIZLOG("-Band tiles of %lu pixels in all, drizzling line by line\n",
+              (unsigned long)total_size);
+      (void)dobox_rows(p, ystart, 0, p->ny, span_x1, span_x2,
+                       kernel_handler, nmiss, nskip, error);
+      goto dobox_threaded_exit_;
+    }
+  }
+
+  for (i = 0; i < nbands; ++i) {
+    bands[i].ystart = ystart;
+    bands[i].x1 = span_x1 + bands[i].j0;
+    bands[i].x2 = span_x2 + bands[i].j0;
+    bands[i].kernel_handler = kernel_handler;
+    driz_error_init(&bands[i].error);
+    args[i] = &bands[i];
+
+    if ((bands[i].p = malloc(sizeof(struct driz_param_t))) == NULL) {
+      driz_error_set_message(error, "Out of memory");
+      goto dobox_threaded_exit_;
+    }
+    bp = bands[i].p;
+    *bp = *p;
+
+    ix0 = bands[i].tx0;
+    ix1 = bands[i].tx1;
+    iy0 = bands[i].ty0;
+    iy1 = bands[i].ty1;
+    bp->xmin = p->xmin + ix0;
+    bp->xmax = p->xmin + ix1;
+    bp->ymin = p->ymin + iy0;
+    bp->ymax = p->ymin + iy1;
+    bp->nsx = bp->onx = ix1 - ix0 + 1;
+    bp->nsy = bp->ony = iy1 - iy0 + 1;
+    bp->row0 = 0;
+    bp->row1 = bp->nsy;
+    bp->col0 = 0;
+    bp->col1 = bp->nsx;
+    bp->output_data = NULL;
+    bp->output_counts = NULL;
+    bp->output_context = NULL;
+    bp->output_stride = 1;
+    bp->output_compensation = NULL;
+    bp->workspace = NULL;
+
+    tile_size = (size_t)bp->nsx * (size_t)bp->nsy;
+    if (p->output_compensation) {
+      bp->output_compensation = calloc(tile_size * 2, sizeof(float));
+      if (bp->output_compensation == NULL) {
+        driz_error_set_message(error, "Out of memory");
+        goto dobox_threaded_exit_;
+      }
+    }
+    if (p->output_stride == 3) {
+      /* Same layout as the output */
+      bp->output_data = calloc(tile_size * 3, sizeof(float));
+      if (bp->output_data == NULL) {
+        driz_error_set_message(error, "Out of memory");
+        goto dobox_threaded_exit_;
+      }
+      driz_param_set_interleaved_output(bp, bp->output_data);
+      continue;
+    }
+
+    bp->output_data = calloc(tile_size, sizeof(float));
+    bp->output_counts = calloc(tile_size, sizeof(float));
+    if (bp->output_data == NULL || bp->output_counts == NULL) {
+      driz_error_set_message(error, "Out of memory");
+      goto dobox_threaded_exit_;
+    }
+    if (p->output_context) {
+      bp->output_context = calloc(tile_size, sizeof(integer_t));
+      if (bp->output_context == NULL) {
+        driz_error_set_message(error, "Out of memory");
+        goto dobox_threaded_exit_;
+      }
+    }
+  }
+
+  driz_run_threads(nbands, &dobox_band_thread, args);
+
+  for (i = 0; i < nbands; ++i) {
+    if (driz_error_is_set(&bands[i].error)) {
+      driz_error_set_message(error, driz_error_get_message(&bands[i].error));
+      goto dobox_threaded_exit_;
+    }
+  }
+
+  /* Merge the tiles, a strip of output rows per thread */
+  for (i = 0; i < nbands; ++i) {
+    strips[i].p = p;
+    strips[i].bands = bands;
+    strips[i].nbands = nbands;
+    strips[i].row0 = (integer_t)(((size_t)p->nsy * i) / nbands);
+    strips[i].row1 = (integer_t)(((size_t)p->nsy * (i + 1)) / nbands);
+    args[i] = &strips[i];
+  }
+  driz_run_threads(nbands, &merge_strip_thread, args);
+
+  for (i = 0; i < nbands; ++i) {
+    *nmiss += bands[i].nmiss;
+    *nskip += bands[i].nskip;
+  }
+
+ dobox_threaded_exit_:
+  free_dobox_bands(bands, nbands);
+  free(strips);
+  free(args);
+  free(span_x1);
+  free(span_x2);
+
+  return driz_error_is_set(error);
+}
+
+/***************************************************************************
+ GATHER MODE
+
+ Rather than giving each thread a private tile to scatter its input
+ lines onto, the output subset can be split into strips of rows, with
+ each strip gathering the drops of every input pixel that reaches it.
+ Each output pixel is then written by exactly one thread, and nothing
+ has to be merged afterwards.
+
+ The drizzle mapping has no inverse to find those input pixels with, so
+ the pixels of a block of input lines are transformed first, on the
+ calling thread, and binned by the strips their footprint spans: the
+ rows of their corners for the square kernel, or of their centre
+ +/- pfo for the point and turbo kernels.  The threads then drop the
+ pixels of their strips in input order, clipped to the rows of the
+ strip, so the drops onto any one output pixel come in the same order
+ as line by line and the result is identical to it.
+*/
+
+/* Input pixels transformed and binned at a time */
+#define GATHER_BLOCK_PIXELS 262144
+/* Strips per thread, so that a few busy strips do not hold up the rest */
+#define GATHER_STRIPS_PER_THREAD 4
+
+/* A block of input pixels binned by output strip */
+struct gather_block_t {
+  kernel_handler_t kernel_handler;
+  drop_square_t drop_handler;
+  integer_t nstrips;
+  integer_t strip_rows;
+
+  /* The first line of the block, and the width of a line of xo, yo */
+  integer_t jb;
+  integer_t line_size;
+
+  /* Per pixel: its line, column and output corners (square kernel), or
+     its line of output centres in xo, yo (other kernels) */
+  integer_t* pixel_j;
+  integer_t* pixel_i;
+  double* corners; /* [8 per pixel] */
+  double* xo; /* [block lines][line_size] */
+  double* yo; /* [block lines][line_size] */
+
+  /* The pixels of strip s are entries[strip_first[s]] up to
+     entries[strip_first[s + 1]], in input order, and whether each of
+     them hit anything in that strip */
+  integer_t* strip_first; /* [nstrips + 1] */
+  integer_t* entries;
+  unsigned char* entry_hit;
+};
+
+struct gather_thread_t {
+  /* Private copy of the parameters, with the rows of the strip */
+  struct driz_param_t p;
+  const struct gather_block_t* block;
+  integer_t ystart;
+  /* Strips first_strip, first_strip + strip_step, ... */
+  integer_t first_strip;
+  integer_t strip_step;
+  struct driz_error_t error;
+};
+
+static void*
+gather_strips_thread(void* state) {
+  struct gather_thread_t* t = (struct gather_thread_t*)state;
+  const struct gather_block_t* b = t->block;
+  struct driz_param_t* p = &t->p;
+  integer_t s, e, k, j, i, nhit, nmiss, oldcon, newcon;
+  double xout[4], yout[4];
+  size_t line;
+
+  oldcon = -1;
+  for (s = t->first_strip; s < b->nstrips; s += t->strip_step) {
+    p->row0 = s * b->strip_rows;
+    p->row1 = MIN(p->row0 + b->strip_rows, p->nsy);
+
+    for (e = b->strip_first[s]; e < b->strip_first[s + 1]; ++e) {
+      k = b->entries[e];
+      j = b->pixel_j[k];
+      i = b->pixel_i[k];
+
+      if (b->drop_handler != NULL) {
+        /* drop_square may reorder the corners, and other strips use
+           them too */
+        memcpy(xout, b->corners + 8*k, 4 * sizeof(double));
+        memcpy(yout, b->corners + 8*k + 4, 4 * sizeof(double));
+        if (b->drop_handler(p, i, j, xout, yout,
+                            &oldcon, &newcon, &nhit, &t->error)) {
+          return NULL;
+        }
+      } else {
+        line = (size_t)(j - b->jb) * (size_t)b->line_size;
+        nmiss = 0;
+        if (b->kernel_handler(p, t->ystart + j + 1, i, i,
+                              b->xo + line, b->yo + line,
+                              &oldcon, &newcon, &nmiss, &t->error)) {
+          return NULL;
+        }
+        nhit = (nmiss == 0);
+      }
+
+      b->entry_hit[e] = (unsigned char)(nhit > 0);
+    }
+  }
+
+  return NULL;
+}
+
+/**
+Drizzle all of the input lines in gather mode, with the square, point
+or turbo kernel.  The result is the same as that of \a dobox_rows.
+*/
+static int
+dobox_gather(struct driz_param_t* p, const integer_t ystart,
+             kernel_handler_t kernel_handler,
+             /* Output parameters */
+             integer_t* nmiss, integer_t* nskip, struct driz_error_t* error) {
+  const bool_t square = (bool_t)(p->kernel == kernel_square);
+  const integer_t nthreads = MAX(p->nthreads, 1);
+  const integer_t block_lines = MIN(MAX(GATHER_BLOCK_PIXELS / p->dnx, 1), p->ny);
+  const size_t block_pixels = (size_t)block_lines * (size_t)p->dnx;
+  struct gather_block_t b;
+  struct gather_thread_t* threads = NULL;
+  void** args = NULL;
+  integer_t j, jb, i, k, n, s, e, x1, x2, last_x1, last_x2, top, bottom;
+  integer_t lo, hi, nentries;
+  double y, dh, yc, dy;
+  bool_t shared_edges;
+  size_t buffer_size, line, max_entries = 0;
+  double* xi = NULL;
+  double* yi = NULL;
+  double* xtmp = NULL;
+  double* ytmp = NULL;
+  double* xo = NULL;
+  double* yo = NULL;
+  integer_t* span_x1 = NULL;
+  integer_t* span_x2 = NULL;
+  /* Per pixel of the block: the strips it spans and whether it hit
+     anything in any of them */
+  integer_t* pixel_s0 = NULL;
+  integer_t* pixel_s1 = NULL;
+  unsigned char* pixel_hit = NULL;
+
+  assert(p);
+  assert(p->kernel == kernel_square || kernel_handler != NULL);
+  assert(p->output_done == NULL);
+  assert(nmiss);
+  assert(nskip);
+  assert(error);
+
+  memset(&b, 0, sizeof(b));
+  b.kernel_handler = kernel_handler;
+  b.drop_handler = square ? drop_square_variants[drop_variant(p)] : NULL;
+  b.nstrips = MIN(p->nsy, nthreads * GATHER_STRIPS_PER_THREAD);
+  b.strip_rows = (p->nsy + b.nstrips - 1) / b.nstrips;
+  b.nstrips = (p->nsy + b.strip_rows - 1) / b.strip_rows;
+  b.line_size = p->dnx + 1;
+  shared_edges = (bool_t)(p->pixel_fraction == 1.0 && p->x_scale == 1.0);
+  dy = (double)(p->ymin);
 
-  /* Transform onto the output grid */
-  for (i = 0; i < 4; ++i) {
-    if (map_value(p, TRUE, n,
-                  mapping_4_ptr(p, xi, x1, i), mapping_4_ptr(p, yi, x1, i),
-                  xtmp, ytmp,
-                  mapping_4_ptr(p, xo, x1, i), mapping_4_ptr(p, yo, x1, i),
-                  error)) {
-      return 1;
-    }
+  buffer_size = (size_t)(square ? p->dnx*4 : p->dnx);
+  xi = malloc(buffer_size * sizeof(double));
+  yi = malloc(buffer_size * sizeof(double));
+  xtmp = malloc(buffer_size * sizeof(double));
+  ytmp = malloc(buffer_size * sizeof(double));
+  if (square) {
+    xo = malloc((buffer_size + 1) * sizeof(double));
+    yo = malloc((buffer_size + 1) * sizeof(double));
+    b.corners = malloc(block_pixels * 8 * sizeof(double));
+  } else {
+    b.xo = malloc((size_t)block_lines * (size_t)b.line_size * sizeof(double));
+    b.yo = malloc((size_t)block_lines * (size_t)b.line_size * sizeof(double));
+  }
+  b.pixel_j = malloc(block_pixels * sizeof(integer_t));
+  b.pixel_i = malloc(block_pixels * sizeof(integer_t));
+  b.strip_first = malloc(((size_t)b.nstrips + 1) * sizeof(integer_t));
+  pixel_s0 = malloc(block_pixels * sizeof(integer_t));
+  pixel_s1 = malloc(block_pixels * sizeof(integer_t));
+  pixel_hit = malloc(block_pixels * sizeof(unsigned char));
+  span_x1 = malloc((size_t)p->ny * sizeof(integer_t));
+  span_x2 = malloc((size_t)p->ny * sizeof(integer_t));
+  threads = malloc((size_t)nthreads * sizeof(struct gather_thread_t));
+  args = malloc((size_t)nthreads * sizeof(void*));
+  if (xi == NULL || yi == NULL || xtmp == NULL || ytmp == NULL ||
+      (square && (xo == NULL || yo == NULL || b.corners == NULL)) ||
+      (!square && (b.xo == NULL || b.yo == NULL)) ||
+      b.pixel_j == NULL || b.pixel_i == NULL || b.strip_first == NULL ||
+      pixel_s0 == NULL || pixel_s1 == NULL || pixel_hit == NULL ||
+      span_x1 == NULL || span_x2 == NULL || threads == NULL || args == NULL) {
+    driz_error_set_message(error, "Out of memory");
+    goto dobox_gather_exit_;
   }
 
-  for (i = x1; i <= x2; ++i) {
-    /* Offset within the subset */
-    for (ii = 0; ii < 4; ++ii) {
-      /* The offset by 1 here is needed to match the alignment in the
-         output frame generated by the other kernels (such as turbo).
-      */
-      xout[ii] = *mapping_4_ptr(p, xo, i, ii) - dx - 1;
-      yout[ii] = *mapping_4_ptr(p, yo, i, ii) - dy - 1;
-    }
+  /* Check the overlap of each line with the output */
+  if (line_spans(p, ystart, 0, p->ny, 5, span_x1, span_x2, error)) {
+    goto dobox_gather_exit_;
+  }
 
-    /* Work out the area of the quadrilateral on the output grid.
-       Note that this expression expects the points to be in clockwise
-       order */
-    jaco = 0.5f * ((xout[1] - xout[3]) * (yout[0] - yout[2]) -
-                   (xout[0] - xout[2]) * (yout[1] - yout[3]));
-    if (jaco < 0.0) {
-      jaco *= -1.0;
-      /* Swap */
-      tem = xout[1]; xout[1] = xout[3]; xout[3] = tem;
-      tem = yout[1]; yout[1] = yout[3]; yout[3] = tem;
-    }
-    nhit = 0;
+  if (square) {
+    dh = 0.5 * p->pixel_fraction;
+    *mapping_4_ptr(p, xi, 1, 0) = 1.0 - dh;
+    *mapping_4_ptr(p, xi, 1, 1) = 1.0 + dh;
+    *mapping_4_ptr(p, xi, 1, 2) = 1.0 + dh;
+    *mapping_4_ptr(p, xi, 1, 3) = 1.0 - dh;
+  } else {
+    *mapping_ptr(p, xi, 0) = 1.0;
+  }
 
-    /* Allow for stretching because of scale change */
-    d = *data_ptr(p, i-1, j) * (float)p->scale2;
+  last_x1 = p->dnx;
+  last_x2 = 0;
+  y = (double)ystart;
+  for (jb = 0; jb < p->ny; jb += block_lines) {
+    /* Transform every pixel of the block and find the strips it
+       spans.  Pixels that fall wholly outside the subset are not
+       binned at all. */
+    b.jb = jb;
+    n = 0;
+    for (j = jb; j < MIN(jb + block_lines, p->ny); ++j) {
+      y += 1.0;
+      x1 = span_x1[j];
+      x2 = span_x2[j];
+
+      if (x1 > x2) {
+        /* If we are skipping a line, count it */
+        ++(*nskip);
+        *nmiss += p->dnx;
+        last_x1 = p->dnx;
+        last_x2 = 0;
+        continue;
+      }
 
-    /* Scale the weighting mask by the scale factor and inversely by
-       the Jacobian to ensure conservation of weight in the output */
-    if (p->weights) {
-      w = *weights_ptr(p, i-1, j) * p->weight_scale;
-    } else {
-      w = 1.0;
-    }
+      assert(x1 > 0 && x1 <= p->dnx);
+      assert(x2 > 0 && x2 <= p->dnx);
 
-    /* Loop over output pixels which could be affected */
-    min_jj = MAX(fortran_round(min_doubles(yout, 4)), 0);
-    max_jj = MIN(fortran_round(max_doubles(yout, 4)), p->nsy - 1);
-    min_ii = MAX(fortran_round(min_doubles(xout, 4)), 0);
-    max_ii = MIN(fortran_round(max_doubles(xout, 4)), p->nsx - 1);
+      /* We know there may be some misses */
+      *nmiss += p->dnx - (x2 - x1 + 1);
 
-    for (jj = min_jj; jj <= max_jj; ++jj) {
-      for (ii = min_ii; ii <= max_ii; ++ii) {
-        /* Call boxer to calculate overlap */
-        dover = boxer((double)ii, (double)jj, xout, yout);
+      line = (size_t)(j - jb) * (size_t)b.line_size;
+      if (square) {
+        if (map_square_corners(p, j, y, x1, x2, last_x1, last_x2,
+                               shared_edges, xi, yi, xtmp, ytmp, xo, yo,
+                               &top, &bottom, error)) {
+          goto dobox_gather_exit_;
+        }
+      } else {
+        *mapping_ptr(p, xi, x1) = (double)x1;
+        *mapping_ptr(p, yi, x1) = y;
+        *mapping_ptr(p, yi, x1+1) = 0.0;
+        if (map_value(p, TRUE, x2 - x1 + 1,
+                      mapping_ptr(p, xi, x1), mapping_ptr(p, yi, x1),
+                      xtmp, ytmp,
+                      mapping_ptr(p, b.xo + line, x1),
+                      mapping_ptr(p, b.yo + line, x1), error)) {
+          goto dobox_gather_exit_;
+        }
+      }
+      last_x1 = x1;
+      last_x2 = x2;
 
-        if (dover > 0.0) {
-          /* Re-normalise the area overlap using the Jacobian */
-          dover /= jaco;
+      for (i = x1; i <= x2; ++i) {
+        /* The same bounds as the kernels use */
+        if (square) {
+          get_square_corners(p, i, shared_edges, top, bottom, xo, yo,
+                             b.corners + 8*n, b.corners + 8*n + 4);
+          lo = fortran_round(min_doubles(b.corners + 8*n + 4, 4));
+          hi = fortran_round(max_doubles(b.corners + 8*n + 4, 4));
+        } else {
+          yc = *mapping_ptr(p, b.yo + line, i) - dy;
+          lo = fortran_round(yc - p->pfo);
+          hi = fortran_round(yc + p->pfo);
+        }
 
-          /* Count the hits */
-          ++nhit;
+        if (lo > hi || hi < 0 || lo >= p->nsy) {
+          /* Count cases where the pixel is off the output image */
+          ++(*nmiss);
+          continue;
+        }
 
-          vc = *output_counts_ptr(p, ii, jj);
-          dow = (float)(dover * w);
+        b.pixel_j[n] = j;
+        b.pixel_i[n] = i;
+        pixel_s0[n] = MAX(lo, 0) / b.strip_rows;
+        pixel_s1[n] = MIN(hi, p->nsy - 1) / b.strip_rows;
+        ++n;
+      }
+    }
 
-          /* If we are creating or modifying the context image we do
-             so here */
-          if (update_context(p, ii, jj, dow, oldcon, newcon, error)) {
-            return 1;
-          }
+    if (n == 0) {
+      continue;
+    }
 
-          update_data(p, ii, jj, d, vc, dow);
-        }
+    /* Counting sort of the (pixel, strip) pairs by strip, keeping the
+       pixels of each strip in input order */
+    for (s = 0; s <= b.nstrips; ++s) {
+      b.strip_first[s] = 0;
+    }
+    for (k = 0; k < n; ++k) {
+      for (s = pixel_s0[k]; s <= pixel_s1[k]; ++s) {
+        ++b.strip_first[s + 1];
       }
     }
-    /* Count cases where the pixel is off the output image */
-    if (nhit == 0) ++(*nmiss);
+    for (s = 0; s < b.nstrips; ++s) {
+      b.strip_first[s + 1] += b.strip_first[s];
+    }
+    nentries = b.strip_first[b.nstrips];
+    if ((size_t)nentries > max_entries) {
+      free(b.entries);
+      free(b.entry_hit);
+      max_entries = (size_t)nentries;
+      b.entries = malloc(max_entries * sizeof(integer_t));
+      b.entry_hit = malloc(max_entries * sizeof(unsigned char));
+      if (b.entries == NULL || b.entry_hit == NULL) {
+        driz_error_set_message(error, "Out of memory");
+        goto dobox_gather_exit_;
+      }
+    }
+    for (k = 0; k < n; ++k) {
+      for (s = pixel_s0[k]; s <= pixel_s1[k]; ++s) {
+        b.entries[b.strip_first[s]++] = k;
+      }
+    }
+    for (s = b.nstrips; s > 0; --s) {
+      b.strip_first[s] = b.strip_first[s - 1];
+    }
+    b.strip_first[0] = 0;
+
+    /* Drop the strips, each on one thread */
+    for (i = 0; i < nthreads; ++i) {
+      threads[i].p = *p;
+      threads[i].p.workspace = NULL;
+      threads[i].block = &b;
+      threads[i].ystart = ystart;
+      threads[i].first_strip = i;
+      threads[i].strip_step = nthreads;
+      driz_error_init(&threads[i].error);
+      args[i] = &threads[i];
+    }
+    driz_run_threads(nthreads, &gather_strips_thread, args);
+
+    for (i = 0; i < nthreads; ++i) {
+      if (driz_error_is_set(&threads[i].error)) {
+        driz_error_set_message(error, driz_error_get_message(&threads[i].error));
+        goto dobox_gather_exit_;
+      }
+    }
+
+    /* Count the pixels that hit nothing in any of their strips */
+    memset(pixel_hit, 0, (size_t)n);
+    for (e = 0; e < nentries; ++e) {
+      pixel_hit[b.entries[e]] |= b.entry_hit[e];
+    }
+    for (k = 0; k < n; ++k) {
+      if (!pixel_hit[k]) ++(*nmiss);
+    }
   }
 
-  return 0;
-}
+ dobox_gather_exit_:
+  free(xi); xi = NULL;
+  free(yi); yi = NULL;
+  free(xtmp); xtmp = NULL;
+  free(ytmp); ytmp = NULL;
+  free(xo); xo = NULL;
+  free(yo); yo = NULL;
+  free(b.corners); b.corners = NULL;
+  free(b.xo); b.xo = NULL;
+  free(b.yo); b.yo = NULL;
+  free(b.pixel_j); b.pixel_j = NULL;
+  free(b.pixel_i); b.pixel_i = NULL;
+  free(b.strip_first); b.strip_first = NULL;
+  free(b.entries); b.entries = NULL;
+  free(b.entry_hit); b.entry_hit = NULL;
+  free(pixel_s0); pixel_s0 = NULL;
+  free(pixel_s1); pixel_s1 = NULL;
+  free(pixel_hit); pixel_hit = NULL;
+  free(span_x1); span_x1 = NULL;
+  free(span_x2); span_x2 = NULL;
+  free(threads); threads = NULL;
+  free(args); args = NULL;
 
-static kernel_handler_t
-kernel_handler_map[] = {
-  NULL,
-  do_kernel_gaussian,
-  do_kernel_point,
-  do_kernel_tophat,
-  do_kernel_turbo,
-  do_kernel_lanczos,
-  do_kernel_lanczos
-};
+  return driz_error_is_set(error);
+}
 
 /**
 This module does the actual mapping of input flux to output images
@@ -1057,6 +2765,10 @@ output is covered, or not.
 
 In V1.6 this was simplified to use the DRIVAL routine and also to
 include some limited multi-kernel support.
+
+When p->nthreads is above 1 the input lines are drizzled in parallel
+bands, see MULTI-THREADED DRIZZLING above, or with p->gather in
+parallel output strips, see GATHER MODE.
 */
 int
 dobox(struct driz_param_t* p, const integer_t ystart,
@@ -1065,22 +2777,13 @@ dobox(struct driz_param_t* p, const integer_t ystart,
   const double nsig = 2.5;
   const size_t nlut = 512;
   const float del = 0.01;
-  integer_t j, x1, x2, last_x1, last_x2;
-  double y, dh, ofrac;
   kernel_handler_t kernel_handler = NULL;
-  integer_t oldcon, newcon;
   integer_t np;
-  double* xi = NULL;
-  double* yi = NULL;
-  double* xtmp = NULL;
-  double* ytmp = NULL;
-  double* xo = NULL;
-  double* yo = NULL;
-  float inv_exposure_time;
-  float* data_begin, *data_end;
   int kernel_order;
-  size_t new_buffer_size;
   size_t bit_no;
+  integer_t* context_planes = p->output_context;
+  struct dobox_workspace_t* w = p->workspace;
+  double xmax;
 
   assert(p);
   assert(nmiss);
@@ -1095,23 +2798,29 @@ dobox(struct driz_param_t* p, const integer_t ystart,
     return 0;
   }
 
-  /* Some initial settings - note that the reference pixel position is
-     determined by the value of ALIGN */
-  oldcon = -1;
-
   /* The bitmask, trimmed to the appropriate range */
   np = (p->uuid - 1) / 32 + 1;
   bit_no = (size_t)(p->uuid - 1 - (32 * (np - 1)));
   assert(bit_no < 32);
   p->bv = (integer_t)(1 << bit_no);
 
-  /* Before we start we can fill the X arrays as they don't change
-     with Y */
-  new_buffer_size = (size_t)((p->kernel == kernel_square) ? p->dnx*4 : p->dnx);
+  /* Each plane of a bitmask context holds 32 images: drizzle into the
+     plane of this one */
+  if (p->output_context && p->context_table == NULL && p->context_planes > 0) {
+    if (np > p->context_planes) {
+      driz_error_set_message(error, "Not enough planes in drizzle context image");
+      goto dobox_exit_;
+    }
+    p->output_context += (size_t)(np - 1) * (size_t)p->onx * (size_t)p->ony;
+  }
 
   /* Image subset size */
   p->nsx = p->xmax - p->xmin + 1;
   p->nsy = p->ymax - p->ymin + 1;
+  p->row0 = 0;
+  p->row1 = p->nsy;
+  p->col0 = 0;
+  p->col1 = p->nsx;
   assert(p->pixel_fraction != 0.0);
   p->ac = 1.0 / (p->pixel_fraction * p->pixel_fraction);
 
@@ -1132,19 +2841,67 @@ dobox(struct driz_param_t* p, const integer_t ystart,
        divided by the scale so that there are never holes in the
        output */
     p->pfo = CLAMP_ABOVE(p->pfo, 1.2 / p->scale);
+    if (p->gaussian.tolerance > 0.0) {
+      assert(p->gaussian.lut == NULL);
+      /* Offsets run to half a pixel beyond the footprint */
+      xmax = p->pfo + 1.0;
+      if (w != NULL && w->gaussian_lut != NULL &&
+          w->gaussian_efac == p->gaussian.efac &&
+          w->gaussian_tolerance == p->gaussian.tolerance &&
+          w->gaussian_xmax == xmax) {
+        p->gaussian.lut = w->gaussian_lut;
+        p->gaussian.nlut = w->gaussian_nlut;
+        p->gaussian.sdp = w->gaussian_sdp;
+        break;
+      }
+      p->gaussian.sdp = gaussian_lut_spacing(p->gaussian.efac,
+                                             p->gaussian.tolerance);
+      if (p->gaussian.sdp == 0.0) {
+        driz_error_format_message(
+            error, "Kernel tolerance %g is finer than single precision (%g)",
+            p->gaussian.tolerance, (double)FLT_EPSILON);
+        goto dobox_exit_;
+      }
+      p->gaussian.nlut = (size_t)ceil(xmax * p->gaussian.sdp) + 2;
+      p->gaussian.lut = malloc(p->gaussian.nlut * sizeof(float));
+      if (p->gaussian.lut == NULL) {
+        driz_error_set_message(error, "Out of memory");
+        goto dobox_exit_;
+      }
+      create_gaussian_lut(p->gaussian.efac, p->gaussian.sdp,
+                          p->gaussian.nlut, p->gaussian.lut);
+      if (w != NULL) {
+        free(w->gaussian_lut);
+        w->gaussian_lut = p->gaussian.lut;
+        w->gaussian_nlut = p->gaussian.nlut;
+        w->gaussian_sdp = p->gaussian.sdp;
+        w->gaussian_efac = p->gaussian.efac;
+        w->gaussian_tolerance = p->gaussian.tolerance;
+        w->gaussian_xmax = xmax;
+      }
+    }
     break;
   case kernel_lanczos2:
   case kernel_lanczos3:
     kernel_order = (p->kernel == kernel_lanczos2) ? 2 : 3;
     p->lanczos.nlut = nlut;
     assert(p->lanczos.lut == NULL);
-    if ((p->lanczos.lut = malloc(nlut * sizeof(float))) == NULL) {
-      driz_error_set_message(error, "Out of memory");
-      goto dobox_exit_;
+    if (w != NULL && w->lanczos_order == kernel_order) {
+      p->lanczos.lut = w->lanczos_lut;
+    } else {
+      if ((p->lanczos.lut = malloc(nlut * sizeof(float))) == NULL) {
+        driz_error_set_message(error, "Out of memory");
+        goto dobox_exit_;
+      }
+      /* Set up a look-up-table for Lanczos-style interpolation
+         kernels */
+      create_lanczos_lut(kernel_order, nlut, del, p->lanczos.lut);
+      if (w != NULL) {
+        free(w->lanczos_lut);
+        w->lanczos_lut = p->lanczos.lut;
+        w->lanczos_order = kernel_order;
+      }
     }
-    /* Set up a look-up-table for Lanczos-style interpolation
-       kernels */
-    create_lanczos_lut(kernel_order, nlut, del, p->lanczos.lut);
     p->pfo = (double)kernel_order * p->pixel_fraction / p->scale;
     p->lanczos.sdp = p->scale / del / p->pixel_fraction;
     break;
@@ -1155,167 +2912,119 @@ dobox(struct driz_param_t* p, const integer_t ystart,
 
   p->pfo2 = p->pfo*p->pfo;
 
-  /* assert(p->output_done == NULL); */
-  /* p->output_done = malloc(p->nsx * p->nsy * sizeof(integer_t)); */
-  /* if (p->output_done == NULL) { */
-  /*   driz_error_set_message(error, "Out of memory"); */
-  /*   goto dobox_exit_; */
-  /* } */
-  /* for (i = 0; i < p->nsx * p->nsy; ++i) { */
-  /*   p->output_done[i] = 0; */
-  /* } */
-
-  xi = malloc(new_buffer_size * sizeof(double));
-  if (xi == NULL) {
-    driz_error_set_message(error, "Out of memory");
-    goto dobox_exit_;
-  }
-
-  yi = malloc(new_buffer_size * sizeof(double));
-  if (yi == NULL) {
-    driz_error_set_message(error, "Out of memory");
-    goto dobox_exit_;
-  }
-
-  xtmp = malloc(new_buffer_size * sizeof(double));
-  if (xtmp == NULL) {
-    driz_error_set_message(error, "Out of memory");
-    goto dobox_exit_;
-  }
-
-  ytmp = malloc(new_buffer_size * sizeof(double));
-  if (ytmp == NULL) {
-    driz_error_set_message(error, "Out of memory");
-    goto dobox_exit_;
-  }
-
-  xo = malloc((new_buffer_size + 1) * sizeof(double));
-  if (xo == NULL) {
-    driz_error_set_message(error, "Out of memory");
-    goto dobox_exit_;
-  }
-
-  yo = malloc((new_buffer_size + 1) * sizeof(double));
-  if (yo == NULL) {
-    driz_error_set_message(error, "Out of memory");
-    goto dobox_exit_;
+  /* With a context table, note the output pixels this input has been
+     added to, so that it goes into each of their contexts once */
+  assert(p->output_done == NULL);
+  if (p->output_context && p->context_table != NULL) {
+    p->output_done = calloc((size_t)p->onx * (size_t)p->ony, sizeof(integer_t));
+    if (p->output_done == NULL) {
+      driz_error_set_message(error, "Out of memory");
+      goto dobox_exit_;
+    }
   }
 
-  if (p->kernel == kernel_square) {
-    dh = 0.5 * p->pixel_fraction;
-    *mapping_4_ptr(p, xi, 1, 0) = 1.0 - dh;
-    *mapping_4_ptr(p, xi, 1, 1) = 1.0 + dh;
-    *mapping_4_ptr(p, xi, 1, 2) = 1.0 + dh;
-    *mapping_4_ptr(p, xi, 1, 3) = 1.0 - dh;
-  } else {
-    *mapping_ptr(p, xi, 0) = 1.0;
-
+  if (p->kernel != kernel_square) {
     /* Set up a function pointer to handle the appropriate kernel */
     if (p->kernel >= kernel_LAST) {
       driz_error_set_message(error, "Invalid kernel type");
       goto dobox_exit_;
     }
-    kernel_handler = kernel_handler_map[p->kernel];
-    if (kernel_handler == NULL) {
+    if (kernel_handler_map[p->kernel] == NULL) {
       driz_error_set_message(error, "Invalid kernel type");
       goto dobox_exit_;
     }
+    if (p->kernel == kernel_gaussian && p->gaussian.lut != NULL) {
+      kernel_handler = do_kernel_gaussian_lut_variants[drop_variant(p)];
+    } else {
+      kernel_handler = kernel_handler_map[p->kernel][drop_variant(p)];
+    }
   }
 
   /* If the input image is not in CPS we need to divide by the
-     exposure */
+     exposure.  The kernels do so as they read each input pixel. */
   if (p->in_units != unit_cps) {
     if (p->exposure_time == 0.0) {
       driz_error_set_message(error, "Invalid exposure time");
       goto dobox_exit_;
     }
     assert(p->exposure_time != 0.0);
-    inv_exposure_time = 1.0f / p->exposure_time;
-    /* TODO: Removing this printf causes the results to be
-       less accurate.  Frustrating Heisenbug */
-    /*printf("%f\n", inv_exposure_time); */
-    data_begin = p->data;
-    data_end = data_begin + (p->ny * p->dnx);
-    for (; data_begin != data_end; ++data_begin) {
-      *data_begin *= inv_exposure_time;
-    }
+    p->data_scale = 1.0f / p->exposure_time;
+  } else {
+    p->data_scale = 1.0f;
+  }
+
+  if (p->remove && (!p->accumulate || p->output_context == NULL ||
+                    p->output_done != NULL)) {
+    driz_error_set_message(error, "Inputs can only be removed from accumulated sums with a bitmask context");
+    goto dobox_exit_;
+  }
+
+  if (p->remove && p->output_compensation == NULL &&
+      (p->kernel == kernel_lanczos2 || p->kernel == kernel_lanczos3)) {
+    driz_error_set_message(error, "Removing an input drizzled with a Lanczos kernel needs compensated sums");
+    goto dobox_exit_;
   }
+  p->remove_scale = 0.0;
 
   DRIZLOG("-Drizzling using kernel = %s\n",kernel_enum2str(p->kernel));
 
-  /* This is the outer loop over all the lines in the input image */
-  last_x1 = p->dnx;
-  last_x2 = 0;
-  y = (double)ystart;
-  for (j = 0; j < p->ny; ++j) {
-    y += 1.0;
-    /* Check the overlap with the output */
-    if (check_over(p, (integer_t)y, 5, &ofrac, &x1, &x2, error)) {
+  /* The per-pixel context table needs the lines in order, so only the
+     bitmask context can be built in parallel.  Removing an input works
+     on the output sums themselves, not on private tiles. */
+  if (p->gather && p->output_done == NULL &&
+      (p->kernel == kernel_square || p->kernel == kernel_point ||
+       p->kernel == kernel_turbo)) {
+    if (dobox_gather(p, ystart, kernel_handler, nmiss, nskip, error)) {
       goto dobox_exit_;
     }
-
-    /* If the line falls completely off the output, then skip it */
-    if (ofrac != 0.0) {
-      assert(x1 > 0 && x1 <= p->dnx);
-      assert(x2 > 0 && x2 <= p->dnx);
-
-      /* We know there may be some misses */
-      *nmiss += p->dnx - (x2 - x1 + 1);
-
-      /* Don't read past the edge of the image
-      if (x2 == p->dnx) {
-          x2 -= 1;
-      }
-      */
-      /* At this point we can handle the different kernels separately.
-         First the cases where we just transform a single point rather
-         than four - every case except the "classic" square-pixel
-         kernel */
-      if (p->kernel != kernel_square) {
-        *mapping_ptr(p, xi, x1) = (double)x1;
-
-        *mapping_ptr(p, yi, x1) = y;
-        *mapping_ptr(p, yi, x1+1) = 0.0;
-
-
-        if (map_value(p, TRUE, x2 - x1 + 1,
-                      mapping_ptr(p, xi, x1), mapping_ptr(p, yi, x1),
-                      xtmp, ytmp,
-                      mapping_ptr(p, xo, x1), mapping_ptr(p, yo, x1), error)) {
-          goto dobox_exit_;
-        }
-
-        if (kernel_handler(p, y, x1, x2, xo, yo,
-                           &oldcon, &newcon, nmiss, error)) {
-          goto dobox_exit_;
-        }
-      } else {
-        if (do_kernel_square(p, j, y, x1, x2, last_x1, last_x2,
-                             xi, yi, xtmp, ytmp, xo, yo,
-                             &oldcon, &newcon, nmiss, error)) {
-          goto dobox_exit_;
-        }
-      }
-      last_x1 = x1;
-      last_x2 = x2;
-    } else {
-      /* If we are skipping a line, count it */
-      ++(*nskip);
-      *nmiss += p->dnx;
-      last_x1 = p->dnx;
-      last_x2 = 0;
+  } else if (p->nthreads > 1 && p->ny > 1 && p->output_done == NULL && !p->remove) {
+    if (dobox_threaded(p, ystart, kernel_handler, nmiss, nskip, error)) {
+      goto dobox_exit_;
+    }
+  } else {
+    if (dobox_rows(p, ystart, 0, p->ny, NULL, NULL, kernel_handler,
+                   nmiss, nskip, error)) {
+      goto dobox_exit_;
     }
   }
 
  dobox_exit_:
-  free(p->lanczos.lut); p->lanczos.lut = NULL;
+  /* Tables kept in the workspace stay there for the next call */
+  if (w == NULL) {
+    free(p->gaussian.lut);
+    free(p->lanczos.lut);
+  }
+  p->gaussian.lut = NULL;
+  p->lanczos.lut = NULL;
   free(p->output_done); p->output_done = NULL;
-  free(xi); xi = NULL;
-  free(yi); yi = NULL;
-  free(xo); xo = NULL;
-  free(yo); yo = NULL;
-  free(xtmp); xtmp = NULL;
-  free(ytmp); ytmp = NULL;
+  p->output_context = context_planes;
 
   return driz_error_is_set(error);
 }
+
+void
+dobox_workspace_init(struct dobox_workspace_t* w) {
+  assert(w);
+
+  w->lines = NULL;
+  w->lines_size = 0;
+  w->lanczos_lut = NULL;
+  w->lanczos_order = 0;
+  w->gaussian_lut = NULL;
+  w->gaussian_nlut = 0;
+  w->gaussian_sdp = 0.0;
+  w->gaussian_efac = 0.0;
+  w->gaussian_tolerance = 0.0;
+  w->gaussian_xmax = 0.0;
+}
+
+void
+dobox_workspace_free(struct dobox_workspace_t* w) {
+  if (w == NULL)
+    return;
+
+  free(w->lines); w->lines = NULL;
+  free(w->lanczos_lut); w->lanczos_lut = NULL;
+  free(w->gaussian_lut); w->gaussian_lut = NULL;
+  dobox_workspace_init(w);
+}
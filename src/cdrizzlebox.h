@@ -22,4 +22,39 @@ int
 dobox(struct driz_param_t* p, const integer_t ystart, integer_t* nmiss,
       integer_t* nskip, struct driz_error_t* error);
 
+/**
+The scratch buffers and kernel look-up tables dobox needs, kept from
+one call to the next when p->workspace points at one of these, so
+that drizzling many small inputs onto the same output does not set
+them up again for each.  The buffers only ever grow, and a table is
+only made again when the kernel parameters it depends on change.
+
+A workspace is for one thread at a time; dobox does not use it for the
+bands it drizzles in parallel.
+*/
+struct dobox_workspace_t {
+  /* The line buffers of dobox_rows */
+  void* lines;
+  size_t lines_size;
+
+  /* Lanczos table of order lanczos_order, 0 when there is none yet */
+  float* lanczos_lut;
+  int lanczos_order;
+
+  /* Tabulated Gaussian, for the efac, tolerance and reach it was made
+     for */
+  float* gaussian_lut;
+  size_t gaussian_nlut;
+  double gaussian_sdp;
+  double gaussian_efac;
+  double gaussian_tolerance;
+  double gaussian_xmax;
+};
+
+void
+dobox_workspace_init(struct dobox_workspace_t* w);
+
+void
+dobox_workspace_free(struct dobox_workspace_t* w);
+
 #endif /* CDRIZZLEBOX_H */
@@ -0,0 +1,243 @@
+#include "driz_portability.h"
+#include "cdrizzlecontext.h"
+#include "cdrizzleutil.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CONTEXT_INITIAL_CAPACITY 64
+#define CONTEXT_INITIAL_POOL 256
+
+/* FNV-1a over the image numbers of a context */
+static size_t
+hash_images(const integer_t* images, const integer_t n) {
+  unsigned long h = 2166136261ul;
+  integer_t i;
+
+  for (i = 0; i < n; ++i) {
+    h ^= (unsigned long)images[i] & 0xfffffffful;
+    h = (h * 16777619ul) & 0xfffffffful;
+  }
+
+  return (size_t)h;
+}
+
+/**
+Find the hash slot holding the context whose images are \a images, or
+the free slot where it would go.
+*/
+static size_t
+find_slot(const struct context_table_t* t,
+          const integer_t* images, const integer_t n) {
+  const size_t mask = t->nslots - 1;
+  size_t i = hash_images(images, n) & mask;
+  integer_t k;
+
+  while ((k = t->slots[i]) >= 0) {
+    if (t->nimages[k] == n &&
+        memcmp(t->pool + t->first[k], images, (size_t)n * sizeof(integer_t)) == 0) {
+      break;
+    }
+    i = (i + 1) & mask;
+  }
+
+  return i;
+}
+
+/**
+Double the hash index and re-insert every context into it.
+*/
+static int
+grow_slots(struct context_table_t* t, struct driz_error_t* error) {
+  integer_t* slots;
+  size_t i;
+  integer_t k;
+
+  slots = malloc(2 * t->nslots * sizeof(integer_t));
+  if (slots == NULL) {
+    driz_error_set_message(error, "Out of memory");
+    return 1;
+  }
+
+  free(t->slots);
+  t->slots = slots;
+  t->nslots *= 2;
+  for (i = 0; i < t->nslots; ++i) {
+    t->slots[i] = -1;
+  }
+
+  /* The empty context is never looked up */
+  for (k = 1; k < t->ncontexts; ++k) {
+    t->slots[find_slot(t, t->pool + t->first[k], t->nimages[k])] = k;
+  }
+
+  return 0;
+}
+
+static int
+grow_contexts(struct context_table_t* t, struct driz_error_t* error) {
+  const size_t capacity = 2 * (size_t)t->capacity;
+  size_t* first;
+  integer_t* nimages;
+  integer_t* counts;
+
+  first = realloc(t->first, capacity * sizeof(size_t));
+  if (first == NULL) {
+    goto grow_contexts_error_;
+  }
+  t->first = first;
+
+  nimages = realloc(t->nimages, capacity * sizeof(integer_t));
+  if (nimages == NULL) {
+    goto grow_contexts_error_;
+  }
+  t->nimages = nimages;
+
+  counts = realloc(t->counts, capacity * sizeof(integer_t));
+  if (counts == NULL) {
+    goto grow_contexts_error_;
+  }
+  t->counts = counts;
+
+  t->capacity = (integer_t)capacity;
+  return 0;
+
+ grow_contexts_error_:
+  driz_error_set_message(error, "Out of memory");
+  return 1;
+}
+
+int
+context_table_init(struct context_table_t* t, struct driz_error_t* error) {
+  size_t i;
+
+  assert(t);
+
+  t->ncontexts = 1;
+  t->capacity = CONTEXT_INITIAL_CAPACITY;
+  t->first = malloc((size_t)t->capacity * sizeof(size_t));
+  t->nimages = malloc((size_t)t->capacity * sizeof(integer_t));
+  t->counts = malloc((size_t)t->capacity * sizeof(integer_t));
+  t->pool_size = 0;
+  t->pool_capacity = CONTEXT_INITIAL_POOL;
+  t->pool = malloc(t->pool_capacity * sizeof(integer_t));
+  t->nslots = 2 * CONTEXT_INITIAL_CAPACITY;
+  t->slots = malloc(t->nslots * sizeof(integer_t));
+
+  if (t->first == NULL || t->nimages == NULL || t->counts == NULL ||
+      t->pool == NULL || t->slots == NULL) {
+    context_table_free(t);
+    driz_error_set_message(error, "Out of memory");
+    return 1;
+  }
+
+  for (i = 0; i < t->nslots; ++i) {
+    t->slots[i] = -1;
+  }
+
+  /* The empty context */
+  t->first[0] = 0;
+  t->nimages[0] = 0;
+  t->counts[0] = 0;
+
+  return 0;
+}
+
+void
+context_table_free(struct context_table_t* t) {
+  if (t == NULL)
+    return;
+
+  free(t->first); t->first = NULL;
+  free(t->nimages); t->nimages = NULL;
+  free(t->counts); t->counts = NULL;
+  free(t->pool); t->pool = NULL;
+  free(t->slots); t->slots = NULL;
+  t->ncontexts = t->capacity = 0;
+  t->pool_size = t->pool_capacity = 0;
+  t->nslots = 0;
+}
+
+int
+context_table_add_image(struct context_table_t* t,
+                        const integer_t context, const integer_t image,
+                        /* Output parameters */
+                        integer_t* result, struct driz_error_t* error) {
+  const integer_t* images;
+  integer_t* candidate;
+  integer_t n, i, k;
+  size_t slot, pool_capacity;
+
+  assert(t);
+  assert(result);
+  assert(context >= 0 && context < t->ncontexts);
+
+  images = t->pool + t->first[context];
+  n = t->nimages[context];
+
+  /* Is the image already part of this context? */
+  for (i = 0; i < n && images[i] < image; ++i)
+    ;
+  if (i < n && images[i] == image) {
+    *result = context;
+    return 0;
+  }
+
+  /* Make up the new set of images at the end of the pool, where it
+     stays if it turns out to be a new context */
+  if (t->pool_size + (size_t)n + 1 > t->pool_capacity) {
+    pool_capacity = MAX(2 * t->pool_capacity, t->pool_size + (size_t)n + 1);
+    candidate = realloc(t->pool, pool_capacity * sizeof(integer_t));
+    if (candidate == NULL) {
+      driz_error_set_message(error, "Out of memory");
+      return 1;
+    }
+    t->pool = candidate;
+    t->pool_capacity = pool_capacity;
+    images = t->pool + t->first[context];
+  }
+
+  candidate = t->pool + t->pool_size;
+  memcpy(candidate, images, (size_t)i * sizeof(integer_t));
+  candidate[i] = image;
+  memcpy(candidate + i + 1, images + i, (size_t)(n - i) * sizeof(integer_t));
+
+  slot = find_slot(t, candidate, n + 1);
+  if (t->slots[slot] >= 0) {
+    *result = t->slots[slot];
+    return 0;
+  }
+
+  /* A new context */
+  if (t->ncontexts == t->capacity && grow_contexts(t, error)) {
+    return 1;
+  }
+
+  k = t->ncontexts++;
+  t->first[k] = t->pool_size;
+  t->nimages[k] = n + 1;
+  t->counts[k] = 0;
+  t->pool_size += (size_t)n + 1;
+  t->slots[slot] = k;
+
+  /* Keep the index at most half full */
+  if (2 * (size_t)t->ncontexts > t->nslots && grow_slots(t, error)) {
+    return 1;
+  }
+
+  *result = k;
+  return 0;
+}
+
+const integer_t*
+context_table_images(const struct context_table_t* t, const integer_t context,
+                     /* Output parameters */
+                     integer_t* n) {
+  assert(t);
+  assert(n);
+  assert(context >= 0 && context < t->ncontexts);
+
+  *n = t->nimages[context];
+  return t->pool + t->first[context];
+}
@@ -0,0 +1,66 @@
+#ifndef CDRIZZLECONTEXT_H
+#define CDRIZZLECONTEXT_H
+
+#include "cdrizzleutil.h"
+
+/**
+The table of distinct contexts -- sets of input images -- found on the
+output when a context image of table indices is built, rather than a
+bitmask.
+
+Context 0 is the empty set; the others are numbered from 1 in the
+order they are first seen.  The images of each context are kept
+sorted, and contexts are looked up through a hash index on them, so
+neither the number of contexts nor the number of images in one is
+limited other than by memory.
+*/
+struct context_table_t {
+  /* Number of contexts, including the empty one */
+  integer_t ncontexts;
+  integer_t capacity;
+
+  /* Per context: where its images start in the pool, how many there
+     are, and on how many output pixels it is in use */
+  size_t* first; /* [capacity] */
+  integer_t* nimages; /* [capacity] */
+  integer_t* counts; /* [capacity] */
+
+  /* The sorted images of all of the contexts, one after the other */
+  integer_t* pool; /* [pool_capacity] */
+  size_t pool_size;
+  size_t pool_capacity;
+
+  /* Open-addressed hash index of context numbers, -1 when free */
+  integer_t* slots; /* [nslots] */
+  size_t nslots;
+};
+
+/**
+Set up an empty table, holding just context 0.
+*/
+int
+context_table_init(struct context_table_t* t, struct driz_error_t* error);
+
+void
+context_table_free(struct context_table_t* t);
+
+/**
+Find the context made of the images of \a context plus \a image,
+adding it to the table if it is new.  Its number is returned in
+\a result; this is \a context itself if \a image is already in it.
+*/
+int
+context_table_add_image(struct context_table_t* t,
+                        const integer_t context, const integer_t image,
+                        /* Output parameters */
+                        integer_t* result, struct driz_error_t* error);
+
+/**
+The sorted images of \a context, \a n of them.
+*/
+const integer_t*
+context_table_images(const struct context_table_t* t, const integer_t context,
+                     /* Output parameters */
+                     integer_t* n);
+
+#endif /* CDRIZZLECONTEXT_H */
@@ -11,6 +11,10 @@
 #include "cdrizzlemap.h"
 #include "cdrizzlewcs.h"
 
+#ifdef DRIZ_X86_SIMD
+#include <immintrin.h>
+#endif
+
 
 static inline_macro int
 drizzle_polynomial(void* state,
@@ -277,6 +281,91 @@ map_value(struct driz_param_t* p,
   return 0;
 }
 
+/**
+Transform one point so that WCSLIB sets up the wcsprm of \a input and
+\a output now: after that, transforming only reads them.
+*/
+static void
+wcsmap_setup_wcs(pipeline_t* input, pipeline_t* output) {
+  double pixel[2], world[2], imgcrd[2], phi, theta;
+  int stat;
+
+  pixel[0] = pixel[1] = 1.0;
+  if (pipeline_all_pixel2world(input, 1, 2, pixel, world) == 0) {
+    (void)wcss2p(output->wcs, 1, 2, world, &phi, &theta, imgcrd, pixel, &stat);
+  }
+}
+
+static int
+wcsmap_new_scratch(struct wcsmap_param_t* m,
+                   pipeline_t* input, pipeline_t* output,
+                   struct driz_error_t* error) {
+  struct wcsmap_scratch_t* s;
+
+  if ((s = calloc(1, sizeof(struct wcsmap_scratch_t))) == NULL) {
+    driz_error_set_message(error, "Out of memory");
+    return 1;
+  }
+  if ((s->lock = driz_mutex_new()) == NULL) {
+    free(s);
+    driz_error_set_message(error, "Out of memory");
+    return 1;
+  }
+  s->input_wcs = input;
+  s->output_wcs = output;
+  wcsmap_setup_wcs(input, output);
+
+  driz_mutex_lock(m->scratch_lock);
+  m->scratch[m->nscratch++] = s;
+  driz_mutex_unlock(m->scratch_lock);
+
+  return 0;
+}
+
+/**
+Lock a scratch area of \a m for \a n points: the first one not in use,
+or the first one of all, waiting for it, when all are.
+*/
+static struct wcsmap_scratch_t*
+wcsmap_scratch_take(struct wcsmap_param_t* m, const integer_t n,
+                    struct driz_error_t* error) {
+  struct wcsmap_scratch_t* s = NULL;
+  int i, nscratch;
+
+  driz_mutex_lock(m->scratch_lock);
+  nscratch = m->nscratch;
+  driz_mutex_unlock(m->scratch_lock);
+
+  for (i = 0; i < nscratch; ++i) {
+    if (driz_mutex_trylock(m->scratch[i]->lock)) {
+      s = m->scratch[i];
+      break;
+    }
+  }
+  if (s == NULL) {
+    s = m->scratch[0];
+    driz_mutex_lock(s->lock);
+  }
+
+  if (s->size < n) {
+    free(s->buffer);
+    free(s->stat);
+    s->size = 0;
+    s->buffer = malloc((size_t)n * 8 * sizeof(double));
+    s->stat = malloc((size_t)n * sizeof(int));
+    if (s->buffer == NULL || s->stat == NULL) {
+      free(s->buffer); s->buffer = NULL;
+      free(s->stat); s->stat = NULL;
+      driz_mutex_unlock(s->lock);
+      driz_error_set_message(error, "Out of memory");
+      return NULL;
+    }
+    s->size = n;
+  }
+
+  return s;
+}
+
 static int
 default_wcsmap_direct(struct wcsmap_param_t* m,
                       const double xd, const double yd,
@@ -288,133 +377,155 @@ default_wcsmap_direct(struct wcsmap_param_t* m,
 
   integer_t  i;
   int        status;
-  double    *memory = NULL;
-  double    *ptr    = NULL;
-  double    *xyin   = NULL;
+  struct wcsmap_scratch_t* scratch;
+  double    *xy     = NULL;
   double    *skyout = NULL;
-  double    *xyout  = NULL;
   double    *imgcrd = NULL;
   double    *phi    = NULL;
   double    *theta  = NULL;
-  int       *stat   = NULL;
-
-  /* Allocate memory for new 2-D array */
-  ptr = memory = (double *) malloc(n * 10 * sizeof(double));
-  if (memory == NULL) return 1;
-
-  xyin = ptr;
-  ptr += n * 2;
-  xyout = ptr;
-  ptr += n * 2;
-  skyout = ptr;
-  ptr += n * 2;
-  imgcrd = ptr;
-  ptr += n * 2;
-  phi = ptr;
-  ptr += n;
-  theta = ptr;
-
-  stat = (int *)malloc(n * sizeof(int));
-  if (stat == NULL) {
-      free(memory);
-      return 1;
-  }
 
-  /* The input arrays need to be converted to 2-D arrays for input
-     to the PyWCS (and related) functions. */
+  scratch = wcsmap_scratch_take(m, n, error);
+  if (scratch == NULL) return 1;
+
+  /* The pixel coordinates go in and come out of WCSLIB interleaved, in
+     the same part of the scratch area */
+  xy = scratch->buffer;
+  skyout = xy + n * 2;
+  imgcrd = skyout + n * 2;
+  phi = imgcrd + n * 2;
+  theta = phi + n;
 
-  /* Populate new 2-D array with values from x and y input arrays */
   for (i = 0; i < n; ++i) {
-    xyin[2*i] = xin[i];
-    xyin[2*i+1] = yin[i];
+    xy[2*i] = xin[i];
+    xy[2*i+1] = yin[i];
   }
 
   /*
     Apply pix2sky() transformation from PyWCS
   */
 
-  wcsprm_python2c(m->input_wcs->wcs);
-  status = pipeline_all_pixel2world(m->input_wcs, n, 2, xyin, skyout);
-  wcsprm_c2python(m->input_wcs->wcs);
+  status = pipeline_all_pixel2world(scratch->input_wcs, n, 2, xy, skyout);
   if (status) {
-    free(memory);
-    free(stat);
-    return 1;
+    driz_error_set_message(error, wcslib_get_error_message(status));
+    goto default_wcsmap_direct_exit_;
   }
 
   /*
     Finally, call wcs_sky2pix() for the output object.
   */
-  wcsprm_python2c(m->output_wcs->wcs);
-  status = wcss2p(m->output_wcs->wcs, n, 2,
-                  skyout, phi, theta, imgcrd, xyout, stat);
-  wcsprm_c2python(m->output_wcs->wcs);
+  status = wcss2p(scratch->output_wcs->wcs, n, 2,
+                  skyout, phi, theta, imgcrd, xy, scratch->stat);
   if (status) {
-    free(memory);
-    free(stat);
-    return 1;
+    driz_error_set_message(error, wcslib_get_error_message(status));
+    goto default_wcsmap_direct_exit_;
   }
 
-  /*
-    Transform results back to 2 1-D arrays, like the input.
-  */
   for (i = 0; i < n; ++i){
-    xout[i] = xyout[2*i];
-    yout[i] = xyout[2*i+1];
+    xout[i] = xy[2*i];
+    yout[i] = xy[2*i+1];
   }
 
-  /* Free memory allocated to internal 2-D arrays */
-  free(memory);
-  free(stat);
-  return 0;
+ default_wcsmap_direct_exit_:
+  driz_mutex_unlock(scratch->lock);
+  return status ? 1 : 0;
 }
 
-static int
-default_wcsmap_interpolate(struct wcsmap_param_t* m,
-                           const double xd, const double yd,
-                           const integer_t n,
-                           double* xin /*[n]*/, double* yin /*[n]*/,
-                           /* Output parameters */
-                           double* xout, double* yout,
-                           struct driz_error_t* error) {
+/*****************************************************************
+ TABLE INTERPOLATION
+
+ With factor > 0, the mapping interpolates bilinearly in a table of
+ the output positions of every factor'th input pixel.  The drizzle
+ kernels transform whole input lines at a time, on which y -- and so
+ the pair of table rows and the y weights -- is the same for every
+ point.  Those are worked out once per line, and on x86 processors
+ that support it the points are then interpolated four at a time.  All
+ of the versions do the same operations in the same order, so they
+ give identical results.  The same goes for cubic convolution in the
+ table, which is at least as accurate as bilinear interpolation in a
+ table four times finer.
+*/
 
-  int     i;
-  double *xiptr;
-  double *yiptr;
-  double *xoptr;
-  double *yoptr;
-  double *table;
+#define TABLE_X(x, y) (table[((y)*m->snx + (x))*2])
+#define TABLE_Y(x, y) (table[((y)*m->snx + (x))*2 + 1])
+
+static inline_macro void
+interpolate_point(const struct wcsmap_param_t* m,
+                  const double xin, const double yin,
+                  /* Output parameters */
+                  double* xout, double* yout) {
+  const double* table = m->table;
   double  x, y;
   int     xi, yi;
   double  xf, yf, ixf, iyf;
   double  tabx00, tabx01, tabx10, tabx11;
 
-  /* do the bilinear interpolation */
-  xiptr = xin;
-  yiptr = yin;
-  xoptr = xout;
-  yoptr = yout;
-  table = m->table;
+  x = xin / m->factor;
+  y = yin / m->factor;
+  xi = (int)floor(x);
+  yi = (int)floor(y);
+  xf = x - (double)xi;
+  yf = y - (double)yi;
+  ixf = 1.0 - xf;
+  iyf = 1.0 - yf;
+
+  tabx00 = TABLE_X(xi, yi);
+  tabx10 = TABLE_X(xi+1, yi);
+  tabx01 = TABLE_X(xi, yi+1);
+  tabx11 = TABLE_X(xi+1, yi+1);
+
+  /* Account for interpolating across 360-0 boundary */
+  if ((tabx00 - tabx10) > 359) {
+    tabx00 -= 360.0;
+    tabx01 -= 360.0;
+  } else if ((tabx00 - tabx10) < -359) {
+    tabx10 -= 360.0;
+    tabx11 -= 360.0;
+  }
 
-#define TABLE_X(x, y) (table[((y)*m->snx + (x))*2])
-#define TABLE_Y(x, y) (table[((y)*m->snx + (x))*2 + 1])
+  *xout =
+    tabx00 * ixf * iyf +
+    tabx10 * xf * iyf +
+    tabx01 * ixf * yf +
+    tabx11 * xf * yf;
+
+  *yout =
+    TABLE_Y(xi, yi)     * ixf * iyf +
+    TABLE_Y(xi+1, yi)   * xf * iyf +
+    TABLE_Y(xi, yi+1)   * ixf * yf +
+    TABLE_Y(xi+1, yi+1) * xf * yf;
+}
+
+/**
+Interpolate at the n points (xin[i], yin) of one line.
+*/
+static void
+interpolate_line_scalar(const struct wcsmap_param_t* m,
+                        const integer_t n, const double* xin,
+                        const double yin,
+                        /* Output parameters */
+                        double* xout, double* yout) {
+  const double y = yin / m->factor;
+  const int yi = (int)floor(y);
+  const double yf = y - (double)yi;
+  const double iyf = 1.0 - yf;
+  const double* row0 = m->table + (size_t)yi * m->snx * 2;
+  const double* row1 = row0 + (size_t)m->snx * 2;
+  double  x, xf, ixf;
+  double  tabx00, tabx01, tabx10, tabx11;
+  integer_t i;
+  int     xi;
 
   for (i = 0; i < n; ++i) {
-    x = *xiptr++ / m->factor;
-    y = *yiptr++ / m->factor;
+    x = xin[i] / m->factor;
     xi = (int)floor(x);
-    yi = (int)floor(y);
     xf = x - (double)xi;
-    yf = y - (double)yi;
     ixf = 1.0 - xf;
-    iyf = 1.0 - yf;
 
-    tabx00 = TABLE_X(xi, yi);
-    tabx10 = TABLE_X(xi+1, yi);
-    tabx01 = TABLE_X(xi, yi+1);
-    tabx11 = TABLE_X(xi+1, yi+1);
+    tabx00 = row0[2*xi];
+    tabx10 = row0[2*xi + 2];
+    tabx01 = row1[2*xi];
+    tabx11 = row1[2*xi + 2];
 
-    /* Account for interpolating across 360-0 boundary */
     if ((tabx00 - tabx10) > 359) {
       tabx00 -= 360.0;
       tabx01 -= 360.0;
@@ -423,26 +534,411 @@ default_wcsmap_interpolate(struct wcsmap_param_t* m,
       tabx11 -= 360.0;
     }
 
-    *xoptr++ =
+    xout[i] =
       tabx00 * ixf * iyf +
       tabx10 * xf * iyf +
       tabx01 * ixf * yf +
       tabx11 * xf * yf;
 
-    *yoptr++ =
-      TABLE_Y(xi, yi)     * ixf * iyf +
-      TABLE_Y(xi+1, yi)   * xf * iyf +
-      TABLE_Y(xi, yi+1)   * ixf * yf +
-      TABLE_Y(xi+1, yi+1) * xf * yf;
+    yout[i] =
+      row0[2*xi + 1] * ixf * iyf +
+      row0[2*xi + 3] * xf * iyf +
+      row1[2*xi + 1] * ixf * yf +
+      row1[2*xi + 3] * xf * yf;
   }
+}
 
-#undef TABLE_X
-#undef TABLE_Y
+#ifdef DRIZ_X86_SIMD
 
-  return 0;
+/**
+Gather the table cells of four points: the x and y of the left and
+right columns.  Each point's cell is a run of four doubles in the row,
+so this is four loads and a 4x4 transpose.
+*/
+DRIZ_TARGET_AVX2 static inline_macro void
+load_cells_avx2(const double* row, const int xi[4],
+                /* Output parameters */
+                __m256d* x0, __m256d* y0, __m256d* x1, __m256d* y1) {
+  __m256d r0, r1, r2, r3, t0, t1, t2, t3;
+
+  r0 = _mm256_loadu_pd(row + 2*xi[0]);
+  r1 = _mm256_loadu_pd(row + 2*xi[1]);
+  r2 = _mm256_loadu_pd(row + 2*xi[2]);
+  r3 = _mm256_loadu_pd(row + 2*xi[3]);
+
+  t0 = _mm256_unpacklo_pd(r0, r1);
+  t1 = _mm256_unpackhi_pd(r0, r1);
+  t2 = _mm256_unpacklo_pd(r2, r3);
+  t3 = _mm256_unpackhi_pd(r2, r3);
+
+  *x0 = _mm256_permute2f128_pd(t0, t2, 0x20);
+  *x1 = _mm256_permute2f128_pd(t0, t2, 0x31);
+  *y0 = _mm256_permute2f128_pd(t1, t3, 0x20);
+  *y1 = _mm256_permute2f128_pd(t1, t3, 0x31);
+}
+
+DRIZ_TARGET_AVX2 static void
+interpolate_line_avx2(const struct wcsmap_param_t* m,
+                      const integer_t n, const double* xin,
+                      const double yin,
+                      /* Output parameters */
+                      double* xout, double* yout) {
+  const double y = yin / m->factor;
+  const int yi = (int)floor(y);
+  const double* row0 = m->table + (size_t)yi * m->snx * 2;
+  const double* row1 = row0 + (size_t)m->snx * 2;
+  const __m256d factor = _mm256_set1_pd(m->factor);
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d wrap = _mm256_set1_pd(360.0);
+  const __m256d above = _mm256_set1_pd(359.0);
+  const __m256d below = _mm256_set1_pd(-359.0);
+  const __m256d yf = _mm256_set1_pd(y - (double)yi);
+  const __m256d iyf = _mm256_set1_pd(1.0 - (y - (double)yi));
+  __m256d x, fx, xf, ixf, d, hi, lo;
+  __m256d tabx00, tabx10, tabx01, tabx11, taby00, taby10, taby01, taby11;
+  int xi[4];
+  integer_t i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    x = _mm256_div_pd(_mm256_loadu_pd(xin + i), factor);
+    fx = _mm256_floor_pd(x);
+    _mm_storeu_si128((__m128i*)xi, _mm256_cvttpd_epi32(fx));
+    xf = _mm256_sub_pd(x, fx);
+    ixf = _mm256_sub_pd(one, xf);
+
+    load_cells_avx2(row0, xi, &tabx00, &taby00, &tabx10, &taby10);
+    load_cells_avx2(row1, xi, &tabx01, &taby01, &tabx11, &taby11);
+
+    /* Account for interpolating across 360-0 boundary */
+    d = _mm256_sub_pd(tabx00, tabx10);
+    hi = _mm256_cmp_pd(d, above, _CMP_GT_OQ);
+    lo = _mm256_cmp_pd(d, below, _CMP_LT_OQ);
+    tabx00 = _mm256_blendv_pd(tabx00, _mm256_sub_pd(tabx00, wrap), hi);
+    tabx01 = _mm256_blendv_pd(tabx01, _mm256_sub_pd(tabx01, wrap), hi);
+    tabx10 = _mm256_blendv_pd(tabx10, _mm256_sub_pd(tabx10, wrap), lo);
+    tabx11 = _mm256_blendv_pd(tabx11, _mm256_sub_pd(tabx11, wrap), lo);
+
+    _mm256_storeu_pd(xout + i, _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(
+        _mm256_mul_pd(_mm256_mul_pd(tabx00, ixf), iyf),
+        _mm256_mul_pd(_mm256_mul_pd(tabx10, xf), iyf)),
+        _mm256_mul_pd(_mm256_mul_pd(tabx01, ixf), yf)),
+        _mm256_mul_pd(_mm256_mul_pd(tabx11, xf), yf)));
+
+    _mm256_storeu_pd(yout + i, _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(
+        _mm256_mul_pd(_mm256_mul_pd(taby00, ixf), iyf),
+        _mm256_mul_pd(_mm256_mul_pd(taby10, xf), iyf)),
+        _mm256_mul_pd(_mm256_mul_pd(taby01, ixf), yf)),
+        _mm256_mul_pd(_mm256_mul_pd(taby11, xf), yf)));
+  }
+
+  interpolate_line_scalar(m, n - i, xin + i, yin, xout + i, yout + i);
 }
 
+#endif /* DRIZ_X86_SIMD */
+
+typedef void (*interpolate_line_func_t)(const struct wcsmap_param_t* m,
+                                        const integer_t n, const double* xin,
+                                        const double yin,
+                                        double* xout, double* yout);
+
+/* Chosen on first use.  Every thread that races to set it stores the
+   same value. */
+static interpolate_line_func_t interpolate_line_func = NULL;
+
+static interpolate_line_func_t
+interpolate_line_select(const enum e_simd_t level) {
+#ifdef DRIZ_X86_SIMD
+  __builtin_cpu_init();
+  if (level >= simd_avx2 && __builtin_cpu_supports("avx2")) {
+    return interpolate_line_avx2;
+  }
+#endif
+  return interpolate_line_scalar;
+}
+
+/**
+The cubic convolution (Catmull-Rom) weights of the four table points
+around a point that is a fraction \a t of the way between the middle
+two.
+*/
+static inline_macro void
+cubic_weights(const double t,
+              /* Output parameters */
+              double w[4]) {
+  const double t2 = t * t;
+  const double t3 = t2 * t;
+
+  w[0] = 0.5 * (-t3 + 2.0 * t2 - t);
+  w[1] = 0.5 * (3.0 * t3 - 5.0 * t2 + 2.0);
+  w[2] = 0.5 * (-3.0 * t3 + 4.0 * t2 + t);
+  w[3] = 0.5 * (t3 - t2);
+}
+
+/**
+Find the four table rows around the line \a yin and their weights.
+*/
+static inline_macro void
+cubic_rows(const struct wcsmap_param_t* m, const double yin,
+           /* Output parameters */
+           const double* row[4], double wy[4]) {
+  const double y = yin / m->factor + 1.0;
+  int     yi, r;
+
+  yi = (int)floor(y);
+  yi = CLAMP(yi, 1, m->sny - 3);
+  cubic_weights(y - (double)yi, wy);
+  for (r = 0; r < 4; ++r) {
+    row[r] = m->table + (size_t)(yi - 1 + r) * m->snx * 2;
+  }
+}
+
+/**
+Find where the block of table columns around \a xin starts in a row,
+and the weights of its columns.
+*/
+static inline_macro int
+cubic_column(const struct wcsmap_param_t* m, const double xin,
+             /* Output parameters */
+             double wx[4]) {
+  const double x = xin / m->factor + 1.0;
+  int     xi;
+
+  xi = (int)floor(x);
+  xi = CLAMP(xi, 1, m->snx - 3);
+  cubic_weights(x - (double)xi, wx);
 
+  return 2 * (xi - 1);
+}
+
+/**
+Interpolate with cubic convolution at the n points (xin[i], yin) of one
+line.  The four table rows and their weights are found once; each point
+then sums a 4 x 4 block of them, the outer and inner pairs of columns
+apart.  Points near or off the edges of the table use the nearest
+block.  The table holds output pixel positions, so unlike the bilinear
+code this does not look for a 360-0 wrap.
+*/
+static void
+interpolate_cubic_scalar(const struct wcsmap_param_t* m,
+                         const integer_t n, const double* xin,
+                         const double yin,
+                         /* Output parameters */
+                         double* xout, double* yout) {
+  const double* row[4];
+  const double* p;
+  double  wx[4], wy[4], xa, ya, xb, yb;
+  integer_t i;
+  int     col, r;
+
+  cubic_rows(m, yin, row, wy);
+
+  for (i = 0; i < n; ++i) {
+    col = cubic_column(m, xin[i], wx);
+
+    xa = ya = xb = yb = 0.0;
+    for (r = 0; r < 4; ++r) {
+      p = row[r] + col;
+      xa = xa + wy[r] * (wx[0] * p[0] + wx[2] * p[4]);
+      ya = ya + wy[r] * (wx[0] * p[1] + wx[2] * p[5]);
+      xb = xb + wy[r] * (wx[1] * p[2] + wx[3] * p[6]);
+      yb = yb + wy[r] * (wx[1] * p[3] + wx[3] * p[7]);
+    }
+
+    xout[i] = xa + xb;
+    yout[i] = ya + yb;
+  }
+}
+
+#ifdef DRIZ_X86_SIMD
+
+/**
+As interpolate_cubic_scalar, with the four sums of each point in the
+lanes of one vector: each row of the block is two loads.
+*/
+DRIZ_TARGET_AVX2 static void
+interpolate_cubic_avx2(const struct wcsmap_param_t* m,
+                       const integer_t n, const double* xin,
+                       const double yin,
+                       /* Output parameters */
+                       double* xout, double* yout) {
+  const double* row[4];
+  const double* p;
+  double  wx[4], wy[4];
+  __m256d w01, w23, sum;
+  __m128d xy;
+  integer_t i;
+  int     col, r;
+
+  cubic_rows(m, yin, row, wy);
+
+  for (i = 0; i < n; ++i) {
+    col = cubic_column(m, xin[i], wx);
+    w01 = _mm256_set_pd(wx[1], wx[1], wx[0], wx[0]);
+    w23 = _mm256_set_pd(wx[3], wx[3], wx[2], wx[2]);
+
+    sum = _mm256_setzero_pd();
+    for (r = 0; r < 4; ++r) {
+      p = row[r] + col;
+      sum = _mm256_add_pd(
+          sum,
+          _mm256_mul_pd(
+              _mm256_set1_pd(wy[r]),
+              _mm256_add_pd(_mm256_mul_pd(w01, _mm256_loadu_pd(p)),
+                            _mm256_mul_pd(w23, _mm256_loadu_pd(p + 4)))));
+    }
+
+    xy = _mm_add_pd(_mm256_castpd256_pd128(sum),
+                    _mm256_extractf128_pd(sum, 1));
+    _mm_storel_pd(xout + i, xy);
+    _mm_storeh_pd(yout + i, xy);
+  }
+}
+
+#endif /* DRIZ_X86_SIMD */
+
+/* Chosen on first use, as interpolate_line_func */
+static interpolate_line_func_t interpolate_cubic_func = NULL;
+
+static interpolate_line_func_t
+interpolate_cubic_select(const enum e_simd_t level) {
+#ifdef DRIZ_X86_SIMD
+  __builtin_cpu_init();
+  if (level >= simd_avx2 && __builtin_cpu_supports("avx2")) {
+    return interpolate_cubic_avx2;
+  }
+#endif
+  return interpolate_cubic_scalar;
+}
+
+void
+wcsmap_use_simd(const enum e_simd_t level) {
+  interpolate_line_func = interpolate_line_select(level);
+  interpolate_cubic_func = interpolate_cubic_select(level);
+}
+
+/**
+Interpolate at one point in an adaptive table: in the grid of the
+table cell that the point falls in.  Points off the table use the
+nearest cell.
+*/
+static inline_macro void
+interpolate_point_adaptive(const struct wcsmap_param_t* m,
+                           const double xin, const double yin,
+                           /* Output parameters */
+                           double* xout, double* yout) {
+  const int ncx = m->snx - 1;
+  const int ncy = m->sny - 1;
+  const double* grid;
+  double  x, y;
+  int     xi, yi, sxi, syi, k, c;
+  double  xf, yf, ixf, iyf;
+  double  tabx00, tabx01, tabx10, tabx11;
+
+  x = xin / m->factor;
+  y = yin / m->factor;
+  xi = (int)floor(x);
+  yi = (int)floor(y);
+  xi = CLAMP(xi, 0, ncx - 1);
+  yi = CLAMP(yi, 0, ncy - 1);
+  c = yi * ncx + xi;
+  k = 1 << m->cell_level[c];
+
+  x = (x - (double)xi) * (double)k;
+  y = (y - (double)yi) * (double)k;
+  sxi = (int)floor(x);
+  syi = (int)floor(y);
+  sxi = CLAMP(sxi, 0, k - 1);
+  syi = CLAMP(syi, 0, k - 1);
+  xf = x - (double)sxi;
+  yf = y - (double)syi;
+  ixf = 1.0 - xf;
+  iyf = 1.0 - yf;
+
+  grid = m->nodes + 2 * (m->cell_first[c] + (size_t)syi * (k + 1) + sxi);
+
+  tabx00 = grid[0];
+  tabx10 = grid[2];
+  tabx01 = grid[2*(k + 1)];
+  tabx11 = grid[2*(k + 1) + 2];
+
+  if ((tabx00 - tabx10) > 359) {
+    tabx00 -= 360.0;
+    tabx01 -= 360.0;
+  } else if ((tabx00 - tabx10) < -359) {
+    tabx10 -= 360.0;
+    tabx11 -= 360.0;
+  }
+
+  *xout =
+    tabx00 * ixf * iyf +
+    tabx10 * xf * iyf +
+    tabx01 * ixf * yf +
+    tabx11 * xf * yf;
+
+  *yout =
+    grid[1]               * ixf * iyf +
+    grid[3]               * xf * iyf +
+    grid[2*(k + 1) + 1]   * ixf * yf +
+    grid[2*(k + 1) + 3]   * xf * yf;
+}
+
+static int
+default_wcsmap_interpolate(struct wcsmap_param_t* m,
+                           const double xd, const double yd,
+                           const integer_t n,
+                           double* xin /*[n]*/, double* yin /*[n]*/,
+                           /* Output parameters */
+                           double* xout, double* yout,
+                           struct driz_error_t* error) {
+  integer_t i;
+
+  if (n <= 0) {
+    return 0;
+  }
+
+  if (m->cell_level != NULL) {
+    for (i = 0; i < n; ++i) {
+      interpolate_point_adaptive(m, xin[i], yin[i], &xout[i], &yout[i]);
+    }
+    return 0;
+  }
+
+  /* Along one line, as the kernels ask for */
+  for (i = 1; i < n && yin[i] == yin[0]; ++i)
+    ;
+
+  if (m->cubic) {
+    if (interpolate_cubic_func == NULL) {
+      interpolate_cubic_func = interpolate_cubic_select(simd_avx512);
+    }
+    if (i == n) {
+      interpolate_cubic_func(m, n, xin, yin[0], xout, yout);
+    } else {
+      for (i = 0; i < n; ++i) {
+        interpolate_cubic_func(m, 1, &xin[i], yin[i], &xout[i], &yout[i]);
+      }
+    }
+    return 0;
+  }
+
+  if (i == n) {
+    if (interpolate_line_func == NULL) {
+      interpolate_line_func = interpolate_line_select(simd_avx512);
+    }
+    interpolate_line_func(m, n, xin, yin[0], xout, yout);
+    return 0;
+  }
+
+  /* do the bilinear interpolation */
+  for (i = 0; i < n; ++i) {
+    interpolate_point(m, xin[i], yin[i], &xout[i], &yout[i]);
+  }
+
+  return 0;
+}
+
+#undef TABLE_X
+#undef TABLE_Y
 
 /*
 
@@ -467,12 +963,261 @@ default_wcsmap(void* state,
   }
 }
 
+/*****************************************************************
+ ADAPTIVE TABLE
+
+ The table is refined a level at a time.  For every cell still to be
+ done, the points halfway between those of its grid -- the middles of
+ the sub-cell edges and the sub-cell centres, where bilinear
+ interpolation of a smooth mapping is furthest out -- are transformed
+ together.  A cell whose grid interpolates all of them to within the
+ tolerance is kept as it is; the others take the finer grid that the
+ new points make up and go round again.  Only the strongly distorted
+ parts of the image end up with many points.
+*/
+
+/* Sub-cells are never made smaller than this, in input pixels */
+#define WCSMAP_MIN_STEP 0.5
+
+/**
+Transform the \a n interleaved pixel positions \a xy from the input to
+the output, in place.
+*/
+static int
+wcsmap_transform_points(pipeline_t* input, pipeline_t* output,
+                        const size_t n, double* xy,
+                        struct driz_error_t* error) {
+  double *sky    = NULL;
+  double *imgcrd = NULL;
+  double *phi    = NULL;
+  double *theta  = NULL;
+  int    *stat   = NULL;
+  int     istat  = 1;
+
+  sky = malloc(n * 2 * sizeof(double));
+  imgcrd = malloc(n * 2 * sizeof(double));
+  phi = malloc(n * sizeof(double));
+  theta = malloc(n * sizeof(double));
+  stat = malloc(n * sizeof(int));
+  if (sky == NULL || imgcrd == NULL || phi == NULL || theta == NULL ||
+      stat == NULL) {
+    driz_error_set_message(error, "Out of memory");
+    goto wcsmap_transform_points_exit_;
+  }
+
+  istat = pipeline_all_pixel2world(input, (unsigned int)n, 2, xy, sky);
+  if (istat == 0) {
+    istat = wcss2p(output->wcs, (int)n, 2, sky, phi, theta, imgcrd, xy, stat);
+  }
+  if (istat) {
+    driz_error_set_message(error, wcslib_get_error_message(istat));
+  }
+
+ wcsmap_transform_points_exit_:
+  free(sky);
+  free(imgcrd);
+  free(phi);
+  free(theta);
+  free(stat);
+
+  return istat ? 1 : 0;
+}
+
+/**
+Append the \a npoints points of \a grid to the nodes of \a m, keeping
+track of the room in \a capacity.
+*/
+static int
+wcsmap_add_nodes(struct wcsmap_param_t* m, const double* grid,
+                 const size_t npoints, size_t* capacity,
+                 struct driz_error_t* error) {
+  double* nodes;
+  size_t  new_capacity;
+
+  if (m->nnodes + npoints > *capacity) {
+    new_capacity = MAX(2 * *capacity, m->nnodes + npoints);
+    nodes = realloc(m->nodes, new_capacity * 2 * sizeof(double));
+    if (nodes == NULL) {
+      driz_error_set_message(error, "Out of memory");
+      return 1;
+    }
+    m->nodes = nodes;
+    *capacity = new_capacity;
+  }
+
+  memcpy(m->nodes + 2 * m->nnodes, grid, npoints * 2 * sizeof(double));
+  m->nnodes += npoints;
+
+  return 0;
+}
+
+/**
+Build the adaptive table of \a m from its uniform one, transforming
+with \a input and \a output.
+*/
+static int
+wcsmap_refine_table(struct wcsmap_param_t* m,
+                    pipeline_t* input, pipeline_t* output,
+                    struct driz_error_t* error) {
+  const int ncx = m->snx - 1;
+  const int ncy = m->sny - 1;
+  const size_t ncells = (size_t)ncx * (size_t)ncy;
+  size_t  *active     = NULL; /* cells still to be done */
+  size_t  *next       = NULL;
+  double  *grid       = NULL; /* their grids, (k + 1)^2 points each */
+  double  *next_grid  = NULL;
+  double  *xy         = NULL; /* the new points, nnew for each cell */
+  double  *g, *f, *p, *tmp;
+  size_t  *swap;
+  size_t   nactive, nnext, capacity, c, i;
+  size_t   nold, nnew, nfine;
+  int      level, k, a, b, cx, cy;
+  bool_t   can_split;
+  double   dx, dy, err, cell_err;
+  int      status = 1;
+
+  m->cell_level = malloc(ncells * sizeof(unsigned char));
+  m->cell_first = malloc(ncells * sizeof(size_t));
+  active = malloc(ncells * sizeof(size_t));
+  next = malloc(ncells * sizeof(size_t));
+  grid = malloc(ncells * 4 * 2 * sizeof(double));
+  capacity = ncells * 4;
+  m->nodes = malloc(capacity * 2 * sizeof(double));
+  m->nnodes = 0;
+  if (m->cell_level == NULL || m->cell_first == NULL || active == NULL ||
+      next == NULL || grid == NULL || m->nodes == NULL) {
+    driz_error_set_message(error, "Out of memory");
+    goto wcsmap_refine_table_exit_;
+  }
+
+  /* To start with, every cell has just its corners from the table */
+  for (c = 0; c < ncells; ++c) {
+    cx = (int)(c % ncx);
+    cy = (int)(c / ncx);
+    active[c] = c;
+    g = grid + c * 8;
+    memcpy(g, m->table + ((size_t)cy * m->snx + cx) * 2, 4 * sizeof(double));
+    memcpy(g + 4, m->table + ((size_t)(cy + 1) * m->snx + cx) * 2,
+           4 * sizeof(double));
+  }
+  nactive = ncells;
+  m->max_error = 0.0;
+
+  for (level = 0, k = 1; nactive > 0; ++level, k *= 2) {
+    nold = (size_t)(k + 1) * (k + 1);
+    nfine = (size_t)(2*k + 1) * (2*k + 1);
+    nnew = nfine - nold;
+    can_split = (bool_t)(level < WCSMAP_MAX_LEVEL &&
+                         m->factor / (double)(2*k) >= WCSMAP_MIN_STEP);
+
+    free(xy);
+    free(next_grid);
+    next_grid = NULL;
+    xy = malloc(nactive * nnew * 2 * sizeof(double));
+    if (xy == NULL ||
+        (can_split &&
+         (next_grid = malloc(nactive * nfine * 2 * sizeof(double))) == NULL)) {
+      driz_error_set_message(error, "Out of memory");
+      goto wcsmap_refine_table_exit_;
+    }
+
+    p = xy;
+    for (i = 0; i < nactive; ++i) {
+      cx = (int)(active[i] % ncx);
+      cy = (int)(active[i] / ncx);
+      for (b = 0; b <= 2*k; ++b) {
+        for (a = 0; a <= 2*k; ++a) {
+          if (((a | b) & 1) == 0) continue;
+          *p++ = ((double)cx + (double)a / (double)(2*k)) * m->factor;
+          *p++ = ((double)cy + (double)b / (double)(2*k)) * m->factor;
+        }
+      }
+    }
+
+    if (wcsmap_transform_points(input, output, nactive * nnew, xy, error)) {
+      goto wcsmap_refine_table_exit_;
+    }
+
+    nnext = 0;
+    p = xy;
+    for (i = 0; i < nactive; ++i) {
+      g = grid + i * nold * 2;
+      f = can_split ? next_grid + nnext * nfine * 2 : NULL;
+      cell_err = 0.0;
+
+      for (b = 0; b <= 2*k; ++b) {
+        for (a = 0; a <= 2*k; ++a) {
+          /* The grid point at or the grid points around (a, b) */
+          const double* g00 = g + ((size_t)(b / 2) * (k + 1) + a / 2) * 2;
+          const double* g10 = g00 + ((a & 1) ? 2 : 0);
+          const double* g01 = g00 + ((b & 1) ? 2 * (k + 1) : 0);
+          const double* g11 = g01 + ((a & 1) ? 2 : 0);
+
+          if (((a | b) & 1) == 0) {
+            if (f != NULL) {
+              f[0] = g00[0];
+              f[1] = g00[1];
+              f += 2;
+            }
+            continue;
+          }
+
+          dx = p[0] - 0.25 * (g00[0] + g10[0] + g01[0] + g11[0]);
+          dy = p[1] - 0.25 * (g00[1] + g10[1] + g01[1] + g11[1]);
+          err = sqrt(dx * dx + dy * dy);
+          cell_err = MAX(cell_err, err);
+
+          if (f != NULL) {
+            f[0] = p[0];
+            f[1] = p[1];
+            f += 2;
+          }
+          p += 2;
+        }
+      }
+
+      if (cell_err <= m->tolerance || !can_split) {
+        m->cell_level[active[i]] = (unsigned char)level;
+        m->cell_first[active[i]] = m->nnodes;
+        m->max_error = MAX(m->max_error, cell_err);
+        if (wcsmap_add_nodes(m, g, nold, &capacity, error)) {
+          goto wcsmap_refine_table_exit_;
+        }
+      } else {
+        next[nnext++] = active[i];
+      }
+    }
+
+    swap = active; active = next; next = swap;
+    tmp = grid; grid = next_grid; next_grid = tmp;
+    nactive = nnext;
+  }
+
+  status = 0;
+
+ wcsmap_refine_table_exit_:
+  if (status) {
+    free(m->cell_level); m->cell_level = NULL;
+    free(m->cell_first); m->cell_first = NULL;
+    free(m->nodes); m->nodes = NULL;
+    m->nnodes = 0;
+  }
+  free(active);
+  free(next);
+  free(grid);
+  free(next_grid);
+  free(xy);
+
+  return status;
+}
+
 int
 default_wcsmap_init(struct wcsmap_param_t* m,
                     pipeline_t* input,
                     pipeline_t* output,
                     int nx, int ny,
-                    double factor,
+                    double factor, double tolerance,
+                    bool_t cubic,
                     struct driz_error_t* error) {
   int     n;
   int     table_size;
@@ -496,9 +1241,21 @@ default_wcsmap_init(struct wcsmap_param_t* m,
   assert(m->output_wcs == NULL);
   assert(m->table == NULL);
 
+  if ((m->scratch_lock = driz_mutex_new()) == NULL) {
+    driz_error_set_message(error, "Out of memory");
+    goto exit;
+  }
+
+  /* The adaptive table is interpolated bilinearly */
+  cubic = (bool_t)(cubic && factor > 0 && tolerance <= 0);
+
   if (factor > 0) {
     snx = (int)((double)nx / factor) + 2;
     sny = (int)((double)ny / factor) + 2;
+    if (cubic) {
+      snx += 3;
+      sny += 3;
+    }
 
     n = (snx) * (sny);
     table_size = n << 1;
@@ -548,14 +1305,12 @@ default_wcsmap_init(struct wcsmap_param_t* m,
     ptr = pixcrd;
     for (j = 0; j < sny; ++j) {
       for (i = 0; i < snx; ++i) {
-        *ptr++ = (double)i * factor;
-        *ptr++ = (double)j * factor;
+        *ptr++ = (double)(cubic ? i - 1 : i) * factor;
+        *ptr++ = (double)(cubic ? j - 1 : j) * factor;
       }
     }
 
-    wcsprm_python2c(input->wcs);
     istat = pipeline_all_pixel2world(input, n, 2, pixcrd, tmp);
-    wcsprm_c2python(input->wcs);
 
     if (istat) {
       free(m->table);
@@ -564,9 +1319,7 @@ default_wcsmap_init(struct wcsmap_param_t* m,
       goto exit;
     }
 
-    wcsprm_python2c(output->wcs);
     istat = wcss2p(output->wcs, n, 2, tmp, phi, theta, imgcrd, m->table, stat);
-    wcsprm_c2python(output->wcs);
 
     if (istat) {
       free(m->table);
@@ -574,6 +1327,18 @@ default_wcsmap_init(struct wcsmap_param_t* m,
       driz_error_set_message(error, wcslib_get_error_message(istat));
       goto exit;
     }
+
+    if (tolerance > 0) {
+      m->snx = snx;
+      m->sny = sny;
+      m->factor = factor;
+      m->tolerance = tolerance;
+      if (wcsmap_refine_table(m, input, output, error)) {
+        goto exit;
+      }
+    }
+  } else if (wcsmap_new_scratch(m, input, output, error)) {
+    goto exit;
   } /* End if_then for factor > 0 */
 
   m->input_wcs = input;
@@ -584,6 +1349,7 @@ default_wcsmap_init(struct wcsmap_param_t* m,
   m->snx = snx;
   m->sny = sny;
   m->factor = factor;
+  m->cubic = cubic;
 
  exit:
 
@@ -610,7 +1376,21 @@ wcsmap_param_dump(struct wcsmap_param_t* m) {
 
 void
 wcsmap_param_free(struct wcsmap_param_t* m) {
+  struct wcsmap_scratch_t* s;
+  int i;
+
   free(m->table);
+  free(m->cell_level);
+  free(m->cell_first);
+  free(m->nodes);
+  for (i = 0; i < m->nscratch; ++i) {
+    s = m->scratch[i];
+    driz_mutex_free(s->lock);
+    free(s->buffer);
+    free(s->stat);
+    free(s);
+  }
+  driz_mutex_free(m->scratch_lock);
   wcsmap_param_init(m);
 }
 
@@ -622,6 +1402,31 @@ wcsmap_param_init(struct wcsmap_param_t* m) {
   m->input_wcs = NULL;
   m->output_wcs = NULL;
   m->table = NULL;
+  m->cubic = FALSE;
+  m->tolerance = 0.0;
+  m->max_error = 0.0;
+  m->cell_level = NULL;
+  m->cell_first = NULL;
+  m->nodes = NULL;
+  m->nnodes = 0;
+  m->nscratch = 0;
+  m->scratch_lock = NULL;
+}
+
+int
+wcsmap_param_add_scratch(struct wcsmap_param_t* m,
+                         pipeline_t* input, pipeline_t* output,
+                         struct driz_error_t* error) {
+  assert(m);
+  assert(m->factor == 0);
+  assert(m->nscratch > 0);
+
+  if (m->nscratch == WCSMAP_MAX_SCRATCH) {
+    driz_error_set_message(error, "Too many scratch areas");
+    return 1;
+  }
+
+  return wcsmap_new_scratch(m, input, output, error);
 }
 
 /*
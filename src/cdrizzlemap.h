@@ -10,6 +10,29 @@ Declarations for supporting the DefaultWCSMapping (WCS-based)
 transformations.
 
 */
+/* Most scratch areas, and so threads transforming at once, that a
+   direct mapping can have */
+#define WCSMAP_MAX_SCRATCH 64
+
+/* Most times a cell of an adaptive table is halved each way */
+#define WCSMAP_MAX_LEVEL 8
+
+/**
+The working space of one direct (factor == 0) transformation at a
+time.  It has pipelines of its own to transform with, since the SIP
+and WCSLIB code keep working arrays in them, and the interleaved
+coordinates and status codes that WCSLIB works on, grown to the
+longest run of points it has been used for.
+*/
+struct wcsmap_scratch_t {
+  driz_mutex_t* lock;
+  pipeline_t* input_wcs;
+  pipeline_t* output_wcs;
+  double*     buffer; /* [8 * size] */
+  int*        stat; /* [size] */
+  integer_t   size;
+};
+
 struct wcsmap_param_t {
   /* Pointers to PyWCS objects for input and output WCS */
   pipeline_t* input_wcs;
@@ -18,6 +41,32 @@ struct wcsmap_param_t {
   int         nx, ny;
   int         snx, sny;
   double      factor;
+
+  /* Interpolate in the table with cubic convolution rather than
+     bilinearly.  The table then starts one step before the image and
+     ends two after it, for the extra points that needs. */
+  bool_t      cubic;
+
+  /* With a tolerance, each cell of the table -- the square between
+     four of its points -- has a grid of 2^level x 2^level sub-cells of
+     its own, as fine as it takes for bilinear interpolation in it to
+     stay within tolerance output pixels of the transformation.  The
+     grid points of all of the cells follow one another in nodes. */
+  double      tolerance;
+  double      max_error; /* largest error found, in output pixels */
+  unsigned char* cell_level; /* [(sny - 1) * (snx - 1)] */
+  size_t*     cell_first; /* [(sny - 1) * (snx - 1)] */
+  double*     nodes; /* [2 * nnodes] */
+  size_t      nnodes;
+
+  /* Scratch areas of the direct transformation: the first one uses
+     input_wcs and output_wcs, the others copies of them added by
+     wcsmap_param_add_scratch.  Each call locks an area that is not in
+     use, so calls running at once on different threads get one each
+     as long as there are enough of them. */
+  struct wcsmap_scratch_t* scratch[WCSMAP_MAX_SCRATCH];
+  int         nscratch;
+  driz_mutex_t* scratch_lock; /* guards nscratch */
 };
 
 /**
@@ -35,6 +84,26 @@ wcsmap_param_dump(struct wcsmap_param_t* m);
 void
 wcsmap_param_free(struct wcsmap_param_t* m);
 
+/**
+Add a scratch area to the direct mapping \a m, transforming with
+\a input and \a output: copies of its pipelines that nothing else
+uses, with their wcsprm in the C form (see wcsprm_python2c).  This
+lets one more thread transform at the same time as the others.
+*/
+int
+wcsmap_param_add_scratch(struct wcsmap_param_t* m,
+                         pipeline_t* input, pipeline_t* output,
+                         /* Output parameters */
+                         struct driz_error_t* error);
+
+/**
+Make the interpolating mappings use the most capable code up to
+\a level that the CPU supports (there is an AVX2 version, but none for
+AVX-512), as \a boxer_use_simd.  Not to be called while drizzling.
+*/
+void
+wcsmap_use_simd(const enum e_simd_t level);
+
 int
 default_wcsmap(void* state,
                 const double xd, const double yd,
@@ -43,11 +112,27 @@ default_wcsmap(void* state,
                 /* Output parameters */
                 double* xout, double* yout,
                 struct driz_error_t* error);
+
+/**
+Set up the mapping from \a input to \a output.  The mapping uses the
+two pipelines as they are for as long as it lives, from any thread:
+their wcsprm must already be in the C form (see wcsprm_python2c) and
+must not be touched by anything else in the meantime.
+
+With \a factor > 0 the mapping interpolates in a table of every
+factor'th pixel.  If \a tolerance is also > 0, the cells of that table
+are split further, each as far as it needs for the interpolation error
+to be at most \a tolerance output pixels, or until the sub-cells are
+half a pixel across.  The largest error left is put in m->max_error.
+Otherwise, \a cubic interpolates in the table with cubic convolution,
+which is as accurate as bilinear interpolation in a much finer table.
+*/
 int
 default_wcsmap_init(struct wcsmap_param_t* m,
                     pipeline_t* input,
                     pipeline_t* output,
-                    int nx, int ny, double factor,
+                    int nx, int ny, double factor, double tolerance,
+                    bool_t cubic,
                     /* Output parameters */
                     struct driz_error_t* error);
 
@@ -0,0 +1,334 @@
+#include "driz_portability.h"
+#include "cdrizzleoverlap.h"
+#include "cdrizzleutil.h"
+
+#include <assert.h>
+
+#ifdef DRIZ_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/*****************************************************************
+ SET-UP
+
+ "boxer" used to sum, for each edge, the signed area under the edge
+ within the unit square (the old SGAREA).  The slope and inverse slope
+ of each edge are worked out once per quadrilateral; the x positions
+ where the edge crosses the bottom (y = 0) and top (y = 1) of a row
+ then follow with a multiply-add per row.  That leaves the per-pixel
+ part free of divisions and branches:
+
+   a, b   the part of the edge's x range inside the pixel
+   p, q   the part of [a, b] where the edge lies between y = 0 and 1
+
+   area = 0.5 (q - p) (y(p) + y(q))  +  length of [a, b] above y = 1
+*/
+
+void
+boxer_init(const double x[4], const double y[4],
+           /* Output parameters */
+           struct boxer_quad_t* q) {
+  integer_t i;
+  double x1, y1, x2, y2, dx;
+  struct boxer_edge_t* e;
+
+  assert(x);
+  assert(y);
+  assert(q);
+
+  for (i = 0; i < 4; ++i) {
+    e = &q->edge[i];
+    x1 = x[i];
+    y1 = y[i];
+    x2 = x[(i+1) & 0x3];
+    y2 = y[(i+1) & 0x3];
+
+    dx = x2 - x1;
+    e->x1 = x1;
+    e->ystart = y1;
+    e->xa = MIN(x1, x2);
+    e->xb = MAX(x1, x2);
+    e->ya = MIN(y1, y2);
+    e->yb = MAX(y1, y2);
+    e->sign = (dx < 0.0) ? -1.0 : 1.0;
+
+    if (dx == 0.0) {
+      /* Vertical: it has an empty x range, so it never adds any area,
+         but it still bounds the part of a row that is covered */
+      e->m = 0.0;
+      e->im = 0.0;
+      e->above_right = TRUE;
+    } else {
+      e->m = (y2 - y1) / dx;
+      e->im = (y2 == y1) ? 0.0 : dx / (y2 - y1);
+      e->above_right = (bool_t)(e->m >= 0.0);
+    }
+  }
+}
+
+bool_t
+boxer_row_init(struct boxer_quad_t* q, const double js,
+               /* Output parameters */
+               double* xmin, double* xmax) {
+  integer_t i;
+  double ybot, xcut, xtop;
+  struct boxer_edge_t* e;
+
+  assert(q);
+  assert(xmin);
+  assert(xmax);
+
+  /* Set up coords relative to the bottom of the row.  Note that the
+     +0.5s were added when this code was included in DRIZZLE */
+  ybot = js - 0.5;
+  *xmin = MAX_DOUBLE;
+  *xmax = -MAX_DOUBLE;
+
+  for (i = 0; i < 4; ++i) {
+    e = &q->edge[i];
+    e->y1 = e->ystart - ybot;
+
+    if (e->im != 0.0) {
+      xcut = e->x1 - e->y1 * e->im;
+      xtop = e->x1 + (1.0 - e->y1) * e->im;
+      e->lo = MIN(xcut, xtop);
+      e->hi = MAX(xcut, xtop);
+    } else if (e->xa == e->xb) {
+      /* Vertical: within the row or not */
+      if (e->ya - ybot <= 1.0 && e->yb - ybot >= 0.0) {
+        e->lo = -MAX_DOUBLE;
+        e->hi = MAX_DOUBLE;
+      } else {
+        e->lo = e->hi = MAX_DOUBLE;
+      }
+    } else {
+      /* Horizontal: within, above or below the row along its length */
+      if (e->y1 >= 1.0) {
+        e->lo = e->hi = -MAX_DOUBLE;
+      } else if (e->y1 <= 0.0) {
+        e->lo = e->hi = MAX_DOUBLE;
+      } else {
+        e->lo = -MAX_DOUBLE;
+        e->hi = MAX_DOUBLE;
+      }
+    }
+
+    /* The clipped quadrilateral is made up of the parts of its edges
+       within the row */
+    if (MAX(e->lo, e->xa) <= MIN(e->hi, e->xb)) {
+      *xmin = MIN(*xmin, MAX(e->lo, e->xa));
+      *xmax = MAX(*xmax, MIN(e->hi, e->xb));
+    }
+  }
+
+  return (bool_t)(*xmin < *xmax);
+}
+
+/*****************************************************************
+ SCALAR VERSION
+
+ The vectorised versions below must stay in step with this,
+ operation for operation, so that all of them give identical results.
+*/
+
+static void
+boxer_row_scalar(const integer_t is, const integer_t n,
+                 const struct boxer_edge_t e[4], double* dover) {
+  integer_t i, k;
+  double s, a, b, p, q, area, sum;
+
+  for (k = 0; k < n; ++k) {
+    s = (double)(is + k) - 0.5;
+
+    /* For each line in the polygon (or at this stage, input
+       quadrilateral) calculate the area common to the unit square
+       (allow negative area for subsequent `vector' addition of
+       subareas). */
+    sum = 0.0;
+    for (i = 0; i < 4; ++i) {
+      a = MAX(e[i].xa, s);
+      b = MAX(MIN(e[i].xb, s + 1.0), a);
+      p = MIN(MAX(e[i].lo, a), b);
+      q = MIN(MAX(e[i].hi, a), b);
+
+      area = 0.5 * (q - p) *
+        ((e[i].y1 + e[i].m * (p - e[i].x1)) +
+         (e[i].y1 + e[i].m * (q - e[i].x1)));
+      if (e[i].above_right) {
+        area = area + (b - q);
+      } else {
+        area = area + (p - a);
+      }
+
+      sum = sum + e[i].sign * area;
+    }
+
+    dover[k] = sum;
+  }
+}
+
+#ifdef DRIZ_X86_SIMD
+
+/*****************************************************************
+ AVX2 VERSION
+
+ Four output pixels at a time.
+*/
+
+DRIZ_TARGET_AVX2 static void
+boxer_row_avx2(const integer_t is, const integer_t n,
+               const struct boxer_edge_t e[4], double* dover) {
+  const __m256d lane = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d half = _mm256_set1_pd(0.5);
+  __m256d s, a, b, p, q, x1, y1, m, area, sum;
+  double tail[4];
+  integer_t i, k, l;
+
+  for (k = 0; k < n; k += 4) {
+    s = _mm256_add_pd(_mm256_set1_pd((double)(is + k) - 0.5), lane);
+
+    sum = _mm256_setzero_pd();
+    for (i = 0; i < 4; ++i) {
+      a = _mm256_max_pd(_mm256_set1_pd(e[i].xa), s);
+      b = _mm256_max_pd(_mm256_min_pd(_mm256_set1_pd(e[i].xb),
+                                      _mm256_add_pd(s, one)), a);
+      p = _mm256_min_pd(_mm256_max_pd(_mm256_set1_pd(e[i].lo), a), b);
+      q = _mm256_min_pd(_mm256_max_pd(_mm256_set1_pd(e[i].hi), a), b);
+
+      x1 = _mm256_set1_pd(e[i].x1);
+      y1 = _mm256_set1_pd(e[i].y1);
+      m = _mm256_set1_pd(e[i].m);
+      area = _mm256_mul_pd(
+          _mm256_mul_pd(half, _mm256_sub_pd(q, p)),
+          _mm256_add_pd(
+              _mm256_add_pd(y1, _mm256_mul_pd(m, _mm256_sub_pd(p, x1))),
+              _mm256_add_pd(y1, _mm256_mul_pd(m, _mm256_sub_pd(q, x1)))));
+      if (e[i].above_right) {
+        area = _mm256_add_pd(area, _mm256_sub_pd(b, q));
+      } else {
+        area = _mm256_add_pd(area, _mm256_sub_pd(p, a));
+      }
+
+      sum = _mm256_add_pd(sum,
+                          _mm256_mul_pd(_mm256_set1_pd(e[i].sign), area));
+    }
+
+    if (n - k >= 4) {
+      _mm256_storeu_pd(dover + k, sum);
+    } else {
+      _mm256_storeu_pd(tail, sum);
+      for (l = 0; l < n - k; ++l) {
+        dover[k + l] = tail[l];
+      }
+    }
+  }
+}
+
+/*****************************************************************
+ AVX-512 VERSION
+
+ Eight output pixels at a time.
+*/
+
+DRIZ_TARGET_AVX512 static void
+boxer_row_avx512(const integer_t is, const integer_t n,
+                 const struct boxer_edge_t e[4], double* dover) {
+  const __m512d lane = _mm512_set_pd(7.0, 6.0, 5.0, 4.0, 3.0, 2.0, 1.0, 0.0);
+  const __m512d one = _mm512_set1_pd(1.0);
+  const __m512d half = _mm512_set1_pd(0.5);
+  __m512d s, a, b, p, q, x1, y1, m, area, sum;
+  integer_t i, k;
+
+  for (k = 0; k < n; k += 8) {
+    s = _mm512_add_pd(_mm512_set1_pd((double)(is + k) - 0.5), lane);
+
+    sum = _mm512_setzero_pd();
+    for (i = 0; i < 4; ++i) {
+      a = _mm512_max_pd(_mm512_set1_pd(e[i].xa), s);
+      b = _mm512_max_pd(_mm512_min_pd(_mm512_set1_pd(e[i].xb),
+                                      _mm512_add_pd(s, one)), a);
+      p = _mm512_min_pd(_mm512_max_pd(_mm512_set1_pd(e[i].lo), a), b);
+      q = _mm512_min_pd(_mm512_max_pd(_mm512_set1_pd(e[i].hi), a), b);
+
+      x1 = _mm512_set1_pd(e[i].x1);
+      y1 = _mm512_set1_pd(e[i].y1);
+      m = _mm512_set1_pd(e[i].m);
+      area = _mm512_mul_pd(
+          _mm512_mul_pd(half, _mm512_sub_pd(q, p)),
+          _mm512_add_pd(
+              _mm512_add_pd(y1, _mm512_mul_pd(m, _mm512_sub_pd(p, x1))),
+              _mm512_add_pd(y1, _mm512_mul_pd(m, _mm512_sub_pd(q, x1)))));
+      if (e[i].above_right) {
+        area = _mm512_add_pd(area, _mm512_sub_pd(b, q));
+      } else {
+        area = _mm512_add_pd(area, _mm512_sub_pd(p, a));
+      }
+
+      sum = _mm512_add_pd(sum,
+                          _mm512_mul_pd(_mm512_set1_pd(e[i].sign), area));
+    }
+
+    if (n - k >= 8) {
+      _mm512_storeu_pd(dover + k, sum);
+    } else {
+      _mm512_mask_storeu_pd(dover + k, (__mmask8)((1u << (n - k)) - 1), sum);
+    }
+  }
+}
+
+#endif /* DRIZ_X86_SIMD */
+
+/*****************************************************************
+ DISPATCH
+*/
+
+typedef void (*boxer_row_func_t)(const integer_t is, const integer_t n,
+                                 const struct boxer_edge_t e[4],
+                                 double* dover);
+
+/* Chosen on first use.  Every thread that races to set it stores the
+   same value. */
+static boxer_row_func_t boxer_row_func = NULL;
+
+static boxer_row_func_t
+boxer_row_select(const enum e_simd_t level, enum e_simd_t* used) {
+#ifdef DRIZ_X86_SIMD
+  __builtin_cpu_init();
+  if (level >= simd_avx512 && __builtin_cpu_supports("avx512f")) {
+    *used = simd_avx512;
+    return boxer_row_avx512;
+  }
+  if (level >= simd_avx2 && __builtin_cpu_supports("avx2")) {
+    *used = simd_avx2;
+    return boxer_row_avx2;
+  }
+#endif
+  *used = simd_scalar;
+  return boxer_row_scalar;
+}
+
+enum e_simd_t
+boxer_use_simd(const enum e_simd_t level) {
+  enum e_simd_t used;
+
+  boxer_row_func = boxer_row_select(level, &used);
+  return used;
+}
+
+void
+boxer_row(const struct boxer_quad_t* q,
+          const integer_t is, const integer_t n,
+          /* Output parameters */
+          double* dover /*[n]*/) {
+  enum e_simd_t used;
+
+  assert(q);
+  assert(dover);
+
+  if (boxer_row_func == NULL) {
+    boxer_row_func = boxer_row_select(simd_avx512, &used);
+  }
+
+  boxer_row_func(is, n, q->edge, dover);
+}
@@ -0,0 +1,83 @@
+#ifndef CDRIZZLEOVERLAP_H
+#define CDRIZZLEOVERLAP_H
+
+#include "cdrizzleutil.h"
+
+/**
+One edge of an input quadrilateral, as used by the "boxer" overlap
+code.  The first group of members is set up once per quadrilateral by
+boxer_init, the second once per output row by boxer_row_init.
+*/
+struct boxer_edge_t {
+  double x1, ystart;  /* start of the edge */
+  double m, im;       /* slope and inverse slope (0 if undefined) */
+  double xa, xb;      /* x range of the edge */
+  double ya, yb;      /* y range of the edge */
+  double sign;        /* -1 for edges running right to left */
+  bool_t above_right; /* is the part above the row to the right? */
+
+  double y1;          /* start of the edge relative to the row bottom */
+  double lo, hi;      /* x range where the edge lies within the row */
+};
+
+struct boxer_quad_t {
+  struct boxer_edge_t edge[4];
+};
+
+/**
+Set up the clockwise input quadrilateral x(4), y(4) for computing its
+overlap with output pixels.
+*/
+void
+boxer_init(const double x[4], const double y[4],
+           /* Output parameters */
+           struct boxer_quad_t* q);
+
+/**
+find where a quadrilateral crosses a row of output pixels
+
+Clip the quadrilateral edge by edge against the output row
+js - 0.5 <= y <= js + 0.5 and return the x range of what is left in
+\a xmin, \a xmax.  Only the output pixels of the row whose centres lie
+within half a pixel of that range can have a non-zero overlap.  This
+also prepares \a q for boxer_row on this row.
+
+@return FALSE if the quadrilateral does not cover any of the row.
+*/
+bool_t
+boxer_row_init(struct boxer_quad_t* q, const double js,
+               /* Output parameters */
+               double* xmin, double* xmax);
+
+/**
+compute the area of box overlap for a run of output pixels
+
+Calculate the area common to the quadrilateral and each of the \a n
+unit squares (ii, js) to (ii+1, js+1) for ii = \a is, \a is + 1, ...,
+\a is + \a n - 1, where js is the row last passed to boxer_row_init.
+This replaces calling "boxer" once for each of those pixels, and
+agrees with it to rounding.
+
+The overlaps are written to \a dover (which must hold \a n values).
+On x86 processors the AVX-512 or AVX2 version is used when the CPU
+supports it; otherwise (or when built with DRIZ_NO_SIMD) this falls
+back to the scalar code.
+*/
+void
+boxer_row(const struct boxer_quad_t* q,
+          const integer_t is, const integer_t n,
+          /* Output parameters */
+          double* dover /*[n]*/);
+
+/**
+Make boxer_row use the most capable code up to \a level that the CPU
+supports: simd_avx512 (the default) for the best there is, down to
+simd_scalar, to test the versions against each other.  Not to be
+called while drizzling.
+
+@return The version now used.
+*/
+enum e_simd_t
+boxer_use_simd(const enum e_simd_t level);
+
+#endif /* CDRIZZLEOVERLAP_H */
@@ -4,12 +4,19 @@
 #include "cdrizzleutil.h"
 
 #include <assert.h>
+#include <float.h>
 #define _USE_MATH_DEFINES       /* needed for MS Windows to define M_PI */
 #include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#endif
 
 /*****************************************************************
  ERROR HANDLING
@@ -80,6 +87,162 @@ driz_default_log_func(const char *format, ...) {
 
 driz_log_func_t driz_log_func = &driz_default_log_func;
 
+/*****************************************************************
+ THREADING
+*/
+#ifdef _WIN32
+struct driz_thread_start_t {
+  driz_thread_func_t func;
+  void* arg;
+};
+
+static unsigned __stdcall
+driz_thread_start(void* state) {
+  struct driz_thread_start_t* start = (struct driz_thread_start_t*)state;
+
+  start->func(start->arg);
+  return 0;
+}
+#endif
+
+void
+driz_run_threads(const integer_t nitems, driz_thread_func_t func, void** args) {
+  integer_t i, nstarted;
+#ifdef _WIN32
+  HANDLE* threads = NULL;
+  struct driz_thread_start_t* starts = NULL;
+#else
+  pthread_t* threads = NULL;
+#endif
+
+  assert(func);
+  assert(args);
+
+  if (nitems <= 0)
+    return;
+
+  nstarted = 0;
+  if (nitems > 1) {
+    threads = malloc((size_t)(nitems - 1) * sizeof(*threads));
+#ifdef _WIN32
+    starts = malloc((size_t)(nitems - 1) * sizeof(*starts));
+    if (starts == NULL) {
+      free(threads);
+      threads = NULL;
+    }
+#endif
+  }
+
+  /* Items that can not be given their own thread (including when the
+     thread table itself could not be allocated) are run in order on
+     the calling thread */
+  for (i = 0; i < nitems - 1; ++i) {
+    if (threads != NULL) {
+#ifdef _WIN32
+      starts[nstarted].func = func;
+      starts[nstarted].arg = args[i];
+      threads[nstarted] = (HANDLE)_beginthreadex(NULL, 0, &driz_thread_start,
+                                                 &starts[nstarted], 0, NULL);
+      if (threads[nstarted] != 0) {
+        ++nstarted;
+        continue;
+      }
+#else
+      if (pthread_create(&threads[nstarted], NULL, func, args[i]) == 0) {
+        ++nstarted;
+        continue;
+      }
+#endif
+    }
+    func(args[i]);
+  }
+  func(args[nitems - 1]);
+
+  for (i = 0; i < nstarted; ++i) {
+#ifdef _WIN32
+    WaitForSingleObject(threads[i], INFINITE);
+    CloseHandle(threads[i]);
+#else
+    pthread_join(threads[i], NULL);
+#endif
+  }
+
+  free(threads);
+#ifdef _WIN32
+  free(starts);
+#endif
+}
+
+struct driz_mutex_t {
+#ifdef _WIN32
+  CRITICAL_SECTION section;
+#else
+  pthread_mutex_t mutex;
+#endif
+};
+
+driz_mutex_t*
+driz_mutex_new(void) {
+  driz_mutex_t* mutex;
+
+  if ((mutex = malloc(sizeof(driz_mutex_t))) == NULL)
+    return NULL;
+
+#ifdef _WIN32
+  InitializeCriticalSection(&mutex->section);
+#else
+  if (pthread_mutex_init(&mutex->mutex, NULL) != 0) {
+    free(mutex);
+    return NULL;
+  }
+#endif
+
+  return mutex;
+}
+
+void
+driz_mutex_free(driz_mutex_t* mutex) {
+  if (mutex == NULL)
+    return;
+
+#ifdef _WIN32
+  DeleteCriticalSection(&mutex->section);
+#else
+  pthread_mutex_destroy(&mutex->mutex);
+#endif
+  free(mutex);
+}
+
+void
+driz_mutex_lock(driz_mutex_t* mutex) {
+  assert(mutex);
+#ifdef _WIN32
+  EnterCriticalSection(&mutex->section);
+#else
+  pthread_mutex_lock(&mutex->mutex);
+#endif
+}
+
+bool_t
+driz_mutex_trylock(driz_mutex_t* mutex) {
+  assert(mutex);
+#ifdef _WIN32
+  return (bool_t)(TryEnterCriticalSection(&mutex->section) != 0);
+#else
+  return (bool_t)(pthread_mutex_trylock(&mutex->mutex) == 0);
+#endif
+}
+
+void
+driz_mutex_unlock(driz_mutex_t* mutex) {
+  assert(mutex);
+#ifdef _WIN32
+  LeaveCriticalSection(&mutex->section);
+#else
+  pthread_mutex_unlock(&mutex->mutex);
+#endif
+}
+
 /*****************************************************************
  DATA TYPES
 */
@@ -130,8 +293,6 @@ driz_param_dump(struct driz_param_t* p) {
 
 void
 driz_param_init(struct driz_param_t* p) {
-  integer_t i;
-
   assert(p);
 
   /* Actual drizzle callback */
@@ -161,6 +322,7 @@ driz_param_init(struct driz_param_t* p) {
   p->dny = 0;
   p->ny = 0;
   p->data = NULL;
+  p->data_scale = 1.0f;
   p->weights = NULL;
 
   /* Output data */
@@ -169,15 +331,27 @@ driz_param_init(struct driz_param_t* p) {
   p->output_data = NULL;
   p->output_counts = NULL;
   p->output_context = NULL;
+  p->output_stride = 1;
+  p->context_planes = 0;
   p->output_done = NULL;
 
+  p->nthreads = 1;
+  p->tile_size = 0;
+  p->gather = FALSE;
+  p->accumulate = FALSE;
+  p->remove = FALSE;
+  p->remove_scale = 0.0;
+  p->output_compensation = NULL;
+
+  p->gaussian.tolerance = 0.0;
+  p->gaussian.lut = NULL;
+  p->gaussian.x = NULL;
   p->lanczos.lut = NULL;
+  p->lanczos.x = NULL;
   p->lanczos.space = 1.0;
 
-  for (i = 0; i < MAXEN * MAXIM; ++i)
-    p->intab[i] = 0;
-
-  p->nen = 0;
+  p->context_table = NULL;
+  p->workspace = NULL;
 
   p->scale = 1.0;
   p->scale2 = 1.0;
@@ -185,6 +359,18 @@ driz_param_init(struct driz_param_t* p) {
   p->y_scale = 1.0;
 }
 
+void
+driz_param_set_interleaved_output(struct driz_param_t* p, void* output) {
+  assert(p);
+  assert(output);
+  assert(sizeof(float) == sizeof(integer_t));
+
+  p->output_data = (float*)output;
+  p->output_counts = (float*)output + 1;
+  p->output_context = (integer_t*)((float*)output + 2);
+  p->output_stride = 3;
+}
+
 /*****************************************************************
  STRING TO ENUMERATION CONVERSIONS
 */
@@ -230,6 +416,13 @@ static const char* interp_string_table[] = {
   NULL
 };
 
+static const char* simd_string_table[] = {
+  "scalar",
+  "avx2",
+  "avx512",
+  NULL
+};
+
 static const char* bool_string_table[] = {
   "FALSE",
   "TRUE",
@@ -306,6 +499,16 @@ interp_str2enum(const char* s, enum e_interp_t* result, struct driz_error_t* err
   return 0;
 }
 
+int
+simd_str2enum(const char* s, enum e_simd_t* result, struct driz_error_t* error) {
+  if (str2enum(s, simd_string_table, (int *)result, error)) {
+    driz_error_format_message(error, "Unknown vector code '%s'", s);
+    return 1;
+  }
+
+  return 0;
+}
+
 const char*
 shift_enum2str(enum e_shift_t value) {
   assert(value >= 0 && value < 2);
@@ -341,6 +544,13 @@ interp_enum2str(enum e_interp_t value) {
   return interp_string_table[value];
 }
 
+const char*
+simd_enum2str(enum e_simd_t value) {
+  assert(value >= 0 && value < simd_LAST);
+
+  return simd_string_table[value];
+}
+
 const char*
 bool2str(bool_t value) {
   return bool_string_table[value ? 1 : 0];
@@ -372,6 +582,40 @@ create_lanczos_lut(const int kernel_order, const size_t npix,
   }
 }
 
+double
+gaussian_lut_spacing(const double efac, const double tolerance) {
+  assert(efac > 0.0);
+
+  /* The factors are at most 1, so rounding an entry to single
+     precision is out by at most FLT_EPSILON/4, and interpolating
+     between entries no more.  The rest of the tolerance is left for
+     the interpolation: the second derivative of exp(-x*x*efac) is at
+     most 2 efac, so interpolating linearly over a spacing h is out by
+     at most h*h*efac/4. */
+  if (!(tolerance >= FLT_EPSILON)) {
+    return 0.0;
+  }
+
+  return sqrt(efac / (4.0 * (tolerance - 0.25 * FLT_EPSILON)));
+}
+
+void
+create_gaussian_lut(const double efac, const double sdp, const size_t nlut,
+                    /* Output parameters */
+                    float* gaussian_lut) {
+  integer_t i;
+  double x;
+
+  assert(gaussian_lut);
+  assert(efac > 0.0);
+  assert(sdp > 0.0);
+
+  for (i = 0; i < (integer_t)nlut; ++i) {
+    x = (double)i / sdp;
+    gaussian_lut[i] = (float)exp(-x * x * efac);
+  }
+}
+
 void
 put_fill(struct driz_param_t* p, const float fill_value) {
   integer_t i, j;
@@ -391,6 +635,39 @@ put_fill(struct driz_param_t* p, const float fill_value) {
   }
 }
 
+void
+normalize_output(struct driz_param_t* p, float* result) {
+  integer_t i, j;
+  float vc, vd;
+  double sum_c, sum_d;
+
+  assert(p);
+
+  for (j = 0; j < p->ony; ++j) {
+    for (i = 0; i < p->onx; ++i) {
+      vc = *output_counts_ptr(p, i, j);
+      vd = *output_data_ptr(p, i, j);
+      if (p->output_compensation) {
+        sum_d = (double)vd + *output_compensation_ptr(p, 0, i, j);
+        sum_c = (double)vc + *output_compensation_ptr(p, 1, i, j);
+        vd = (float)((sum_c != 0.0) ? sum_d / sum_c : sum_d);
+        if (result == NULL) {
+          *output_counts_ptr(p, i, j) = (float)sum_c;
+          *output_compensation_ptr(p, 0, i, j) = 0.0;
+          *output_compensation_ptr(p, 1, i, j) = 0.0;
+        }
+      } else if (vc != 0.0) {
+        vd /= vc;
+      }
+      if (result == NULL) {
+        *output_data_ptr(p, i, j) = vd;
+      } else {
+        result[j * p->onx + i] = vd;
+      }
+    }
+  }
+}
+
 double
 mgf2(double lambda) {
   double sig, sig2;
@@ -64,14 +64,6 @@ void driz_default_log_func(const char *, ...);
 #define MAX_COEFFS 128
 #define COEFF_OFFSET 100
 
-/* This parameter controls the maximum number of entries in
-   the context table. This value is rather arbitrary */
-#define MAXEN 1000
-
-/* The following parameter controls the number of images which
-   may be combined when contexts are in use. */
-#define MAXIM 128
-
 #undef TRUE
 #define TRUE 1
 
@@ -89,6 +81,46 @@ typedef int_fast8_t bool_t;
 typedef unsigned char bool_t;
 #endif
 
+/*****************************************************************
+ THREADING
+*/
+typedef void* (*driz_thread_func_t)(void*);
+
+/**
+Call func(args[i]) for each i in [0, nitems) concurrently and return
+once all of them have finished.  The last item is run on the calling
+thread.  If a thread can not be started, its item is run on the
+calling thread instead, so every item is always processed.
+*/
+void
+driz_run_threads(const integer_t nitems, driz_thread_func_t func, void** args);
+
+/**
+A lock around state that the threads of driz_run_threads share.  NULL
+is returned when one can not be made.
+*/
+typedef struct driz_mutex_t driz_mutex_t;
+
+driz_mutex_t*
+driz_mutex_new(void);
+
+void
+driz_mutex_free(driz_mutex_t* mutex);
+
+void
+driz_mutex_lock(driz_mutex_t* mutex);
+
+void
+driz_mutex_unlock(driz_mutex_t* mutex);
+
+/**
+Lock \a mutex only if no other thread holds it.
+
+@return TRUE if it is now locked by this thread
+*/
+bool_t
+driz_mutex_trylock(driz_mutex_t* mutex);
+
 enum e_shift_t {
   shift_input,
   shift_output
@@ -128,11 +160,21 @@ enum e_interp_t {
   interp_LAST
 };
 
+/* The most capable x86 vector code to use, where the CPU supports it */
+enum e_simd_t {
+  simd_scalar,
+  simd_avx2,
+  simd_avx512,
+  simd_LAST
+};
+
 /* Lanczos values */
 struct lanczos_param_t {
   size_t nlut;
   float* lut;
   double sdp;
+  /* Room for the x factors of one drop, set up by dobox_rows */
+  float* x;
   integer_t nbox;
   float space;
   float misval;
@@ -147,6 +189,9 @@ typedef int (*mapping_callback_t) \
    double* /*[n]*/, double* /*[n]*/,
    struct driz_error_t*);
 
+struct context_table_t;
+struct dobox_workspace_t;
+
 struct driz_param_t {
   /* Drizzle callback to perform the actual drizzling */
   mapping_callback_t mapping_callback;
@@ -174,15 +219,29 @@ struct driz_param_t {
   integer_t dny;
   integer_t dnx;
   integer_t ny;
-  float* data; /* [dny][dnx] */
+  const float* data; /* [dny][dnx] */
   float* weights; /* [dny][dnx] */
 
+  /* What the input values are multiplied by as they are read to bring
+     them to CPS: 1 / exposure_time for counts.  Set up by dobox; the
+     input itself is never modified. */
+  float data_scale;
+
   /* Output data */
   integer_t onx;
   integer_t ony;
   float* output_data; /* [ony][onx] */
   float* output_counts; /* [ony][onx] was: COU */
-  integer_t* output_context; /* [ony][onx] was: CONTIM */
+  integer_t* output_context; /* [context_planes][ony][onx] was: CONTIM */
+  /* Number of planes of a bitmask context, where image uuid sets a bit
+     of plane (uuid - 1) / 32.  0 when output_context is just the plane
+     of the current image. */
+  integer_t context_planes;
+  /* Elements from one output pixel to the next in the three arrays
+     above: 1 when they are separate, 3 when data, counts and context
+     are interleaved pixel by pixel in one array (see
+     driz_param_set_interleaved_output) */
+  integer_t output_stride;
 
   /* Blotting-specific parameters */
   enum e_interp_t interpolation; /* was INTERP */
@@ -205,24 +264,86 @@ struct driz_param_t {
   bool_t sub;
   bool_t no_over;
 
+  /* Number of threads dobox may split the input lines over.  Only
+     set this above 1 when mapping_callback is safe to call
+     concurrently. */
+  integer_t nthreads;
+
+  /* When above 0, the square kernel drops each block of input pixels
+     grouped by the tile_size x tile_size output tile they land on, see
+     TILED TRAVERSAL in cdrizzlebox.c.  0 drizzles line by line. */
+  integer_t tile_size;
+
+  /* When set, the square, point and turbo kernels are run output row
+     strip by output row strip, with each strip written by one thread
+     only, see GATHER MODE in cdrizzlebox.c. */
+  bool_t gather;
+
+  /* When set, output_data holds the sum of weight * data instead of
+     the weighted mean, so that drizzling needs no division per drop.
+     Call normalize_output once all the inputs are in. */
+  bool_t accumulate;
+
+  /* When set as well as accumulate, the drops of the input are taken
+     out of the sums, and its bit out of a bitmask context, rather
+     than put in.  Drizzling an input again with the same parameters
+     and mapping this way undoes an earlier call. */
+  bool_t remove;
+
+  /* While removing a Lanczos-drizzled input, the largest compensated
+     weight met so far: the scale the rounding left in a pixel the
+     input alone reached is measured against */
+  double remove_scale;
+
+  /* Optional running error terms of the data and counts sums when
+     accumulating, for compensated (Neumaier) summation.  NULL to sum
+     in plain single precision. */
+  float* output_compensation; /* [2][ony][onx] */
+
   integer_t nsx;
   integer_t nsy;
 
-  integer_t intab[MAXEN*MAXIM]; /* [maxen][maxim] */
-  integer_t nen; /* TODO: Rename me */
+  /* The rows [row0, row1) of the subset that the square, point and
+     turbo kernels may drop onto: normally all nsy of them, just one
+     strip in gather mode */
+  integer_t row0;
+  integer_t row1;
+  /* Likewise the columns [col0, col1) that the square kernel may drop
+     onto: all nsx of them, or one tile with p->tile_size */
+  integer_t col0;
+  integer_t col1;
 
   integer_t bv;
   double ac;
   double pfo;
   double pfo2;
 
-  integer_t* output_done; /* [nsy][nsx] */
+  /* When context_table is set, the output context holds indices into
+     it (see cdrizzlecontext.h) rather than a bitmask.  The table
+     belongs to the caller, so it can carry on over several inputs.
+     output_done is dobox's own, for the duration of one call. */
+  integer_t* output_done; /* [ony][onx] */
+  struct context_table_t* context_table;
+
+  /* Optional scratch buffers and kernel tables for dobox to keep from
+     one input to the next (see cdrizzlebox.h).  NULL to set them up
+     afresh in each call. */
+  struct dobox_workspace_t* workspace;
 
   /* Stuff specific to certain kernel types */
   /* Gaussian values */
   struct {
     double efac;
     double es;
+    /* When above 0, each drop uses tabulated x and y factors, each
+       within tolerance of exp(-dx*dx*efac), in place of an exp() per
+       output pixel; see gaussian_lut_spacing.  0 for the exact kernel. */
+    double tolerance;
+    size_t nlut;
+    float* lut;
+    double sdp;
+    /* Room for the x factors of one drop, set up by dobox_rows */
+    double* x;
   } gaussian;
   struct lanczos_param_t lanczos;
 
@@ -246,9 +367,18 @@ driz_param_init(struct driz_param_t* p);
 void
 driz_param_dump(struct driz_param_t* p);
 
+/**
+Point the output of \a p at an interleaved [ony][onx][3] array, each
+pixel holding its data (float), counts (float) and context (integer_t)
+in turn.  Drizzling into it touches a single cache line per output
+pixel, where separate arrays would touch three.
+*/
+void
+driz_param_set_interleaved_output(struct driz_param_t* p, void* output);
+
 /****************************************************************************/
 /* ARRAY ACCESSORS */
-static inline_macro float*
+static force_inline_macro const float*
 data_ptr(struct driz_param_t* p, integer_t x, integer_t y) {
   assert(p);
   assert(p->data);
@@ -257,7 +387,7 @@ data_ptr(struct driz_param_t* p, integer_t x, integer_t y) {
   return (p->data + (y * p->dnx) + x);
 }
 
-static inline_macro const float*
+static force_inline_macro const float*
 weights_ptr(struct driz_param_t* p, integer_t x, integer_t y) {
   assert(p);
   assert(p->weights);
@@ -266,49 +396,69 @@ weights_ptr(struct driz_param_t* p, integer_t x, integer_t y) {
   return (p->weights + (y * p->dnx) + x);
 }
 
-static inline_macro float*
+static force_inline_macro float*
 output_data_ptr(struct driz_param_t* p, integer_t x, integer_t y) {
   assert(p);
   assert(p->output_data);
   assert(x >= 0 && x < p->onx);
   assert(y >= 0 && y < p->ony);
-  return (p->output_data + (y * p->onx) + x);
+  return (p->output_data + ((y * p->onx) + x) * p->output_stride);
 }
 
-static inline_macro float*
+static force_inline_macro float*
 output_counts_ptr(struct driz_param_t* p, integer_t x, integer_t y) {
   assert(p);
   assert(p->output_counts);
   assert(x >= 0 && x < p->onx);
   assert(y >= 0 && y < p->ony);
-  return (p->output_counts + (y * p->onx) + x);
+  return (p->output_counts + ((y * p->onx) + x) * p->output_stride);
 }
 
-static inline_macro integer_t*
+static force_inline_macro integer_t*
 output_context_ptr(struct driz_param_t* p, integer_t x, integer_t y) {
   assert(p);
   assert(p->output_context);
   assert(x >= 0 && x < p->onx);
   assert(y >= 0 && y < p->ony);
-  return (p->output_context + (y * p->onx) + x);
+  return (p->output_context + ((y * p->onx) + x) * p->output_stride);
 }
 
-static inline_macro integer_t*
-output_done_ptr(struct driz_param_t* p, integer_t x, integer_t y) {
+static force_inline_macro float*
+output_compensation_ptr(struct driz_param_t* p, integer_t plane,
+                        integer_t x, integer_t y) {
   assert(p);
-  assert(p->output_done);
+  assert(p->output_compensation);
+  assert(plane >= 0 && plane < 2);
   assert(x >= 0 && x < p->onx);
   assert(y >= 0 && y < p->ony);
-  return (p->output_done + (y * p->onx) + x);
+  return (p->output_compensation + ((plane * p->ony + y) * p->onx) + x);
+}
+
+/**
+Add \a x to \a sum, keeping the rounding error of the sum in \a err
+(Neumaier's variant of Kahan summation).  The compensated total is
+sum + err.
+*/
+static force_inline_macro void
+compensated_add(float* sum, float* err, const float x) {
+  const float s = *sum;
+  const float t = s + x;
+
+  if (fabsf(s) >= fabsf(x)) {
+    *err += (s - t) + x;
+  } else {
+    *err += (x - t) + s;
+  }
+  *sum = t;
 }
 
-static inline_macro integer_t*
-intab_ptr(struct driz_param_t* p, integer_t i0, integer_t i1) {
+static force_inline_macro integer_t*
+output_done_ptr(struct driz_param_t* p, integer_t x, integer_t y) {
   assert(p);
-  assert(p->intab);
-  assert(i0 >= 0 && i0 < MAXIM);
-  assert(i1 >= 0 && i1 < MAXEN);
-  return (p->intab + (i1 * MAXIM) + i0);
+  assert(p->output_done);
+  assert(x >= 0 && x < p->onx);
+  assert(y >= 0 && y < p->ony);
+  return (p->output_done + (y * p->onx) + x);
 }
 
 /*****************************************************************
@@ -329,6 +479,9 @@ unit_str2enum(const char* s, enum e_unit_t* result, struct driz_error_t* error);
 int
 interp_str2enum(const char* s, enum e_interp_t* result, struct driz_error_t* error);
 
+int
+simd_str2enum(const char* s, enum e_simd_t* result, struct driz_error_t* error);
+
 const char*
 shift_enum2str(enum e_shift_t value);
 
@@ -344,6 +497,9 @@ unit_enum2str(enum e_unit_t value);
 const char*
 interp_enum2str(enum e_interp_t value);
 
+const char*
+simd_enum2str(enum e_simd_t value);
+
 const char*
 bool2str(bool_t value);
 
@@ -371,6 +527,44 @@ create_lanczos_lut(const int kernel_order, const size_t npix,
 void
 put_fill(struct driz_param_t* p, const float fill_value);
 
+/**
+Choose the spacing of a look-up table of the one-dimensional Gaussian
+factor exp(-x*x*efac) (see \a create_gaussian_lut): the widest for
+which linear interpolation between its single-precision entries is
+within \a tolerance of the factor for all x.
+
+@return The number of entries per unit of x (sdp), or 0 when
+   \a tolerance is below FLT_EPSILON, finer than the rounding of the
+   entries allows.
+*/
+double
+gaussian_lut_spacing(const double efac, const double tolerance);
+
+/**
+Set up a look-up table of the one-dimensional Gaussian factor
+exp(-x*x*efac) for the separable evaluation of kernel == kernel_gaussian.
+
+@param gaussian_lut 1d array of \a nlut lookup values: entry i is the
+   factor at x = i / \a sdp.
+*/
+void
+create_gaussian_lut(const double efac, const double sdp, const size_t nlut,
+                    /* Output parameters */
+                    float* gaussian_lut);
+
+/**
+Turn the weighted sums left in the output data by drizzling with
+p->accumulate set into weighted means, written to \a result, an
+[ony][onx] array (or back into the output data when \a result is
+NULL).  Pixels with no weight are copied unchanged.
+
+With p->output_compensation the error terms are added back in double
+precision.  Normalising in place also folds them into the counts and
+clears them.
+*/
+void
+normalize_output(struct driz_param_t* p, float* result);
+
 /**
  Calculate the refractive index of MgF2 for a given C wavelength (in
  nm) using the formula given by Trauger (1995)
@@ -402,7 +596,7 @@ weighted_sum_vectors(const integer_t npix,
 /**
  Round to nearest integer in a way that mimics fortrans NINT
 */
-static inline_macro integer_t
+static force_inline_macro integer_t
 fortran_round(const double x) {
   return (x >= 0) ? (integer_t)floor(x + .5) : (integer_t)-floor(.5 - x);
 }
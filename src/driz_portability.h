@@ -1,9 +1,21 @@
 #ifdef _WIN32
 #define inline_macro __inline
+#define force_inline_macro __forceinline
 #else
 /*
 * assume gcc for now
 */
 #define inline_macro inline
+#define force_inline_macro inline __attribute__((always_inline))
 #endif
 
+/* The x86 vector code is compiled function by function for the
+   instruction set it needs and picked at run time, so the module as a
+   whole still runs on any x86 processor.  Define DRIZ_NO_SIMD to leave
+   it out. */
+#if !defined(DRIZ_NO_SIMD) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define DRIZ_X86_SIMD
+#define DRIZ_TARGET_AVX2 __attribute__((target("avx2")))
+#define DRIZ_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif